@@ -36,83 +36,223 @@ Once you do this, the library will work with the TTGO module. Source: DroneBot w
 
 
 #include <Arduino.h>
+#include <atomic>
 #include <ESPNowCam.h>
 #include <TFT_eSPI.h>
 #include <SPI.h>
 #include <TJpg_Decoder.h>
+#include <esp_heap_caps.h>
+
+// Frames move from the radio to the screen through three stages that run concurrently: the ESP-NOW
+// callback fills one slot of a receive ring, a task on the second core decodes the latest complete
+// frame, and the decoded MCU blocks go out with DMA while the next ones are decoded.
+//
+// Images larger than the panel are shrunk to fit in two steps: the decoder's own 1/2, 1/4 or 1/8 scale,
+// as far as it goes without dropping below the fitted size, then a nearest-neighbour resample of each
+// block for the remaining fraction. Smaller images are shown 1:1. To compare frame times, set the camera
+// frame size (FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_VGA) and read the per second stats line.
+
+#define FRAME_BUFFER_SIZE       15000   // Largest JPEG accepted, per slot
+#define FRAME_SLOTS             3       // Receiving, latest complete, decoding
+#define DECODE_TASK_CORE        1       // WiFi and the ESP-NOW callbacks run on core 0
+#define DECODE_TASK_PRIORITY    2
+#define DECODE_TASK_STACK_SIZE  8192
+#define MCU_MAX_PIXELS          (16 * 16)
+#define STATS_INTERVAL          1000    // ms between two stats lines
 
 ESPNowCam radio;
 TFT_eSPI tft = TFT_eSPI();
 
-uint8_t fb[15000]; // Static buffer in internal RAM
+// Receive ring. The callback owns receive_slot and the decode task owns decode_slot; latest_slot is
+// swapped between them. A frame completed before the decoder took the previous one replaces it.
+const uint8_t FRAME_FRESH = 0x80; // Set in latest_slot until the decoder takes the frame
+uint8_t *frame_slots[FRAME_SLOTS];
+uint32_t frame_lengths[FRAME_SLOTS];
+uint8_t receive_slot = 0;
+uint8_t decode_slot = 1;
+std::atomic<uint8_t> latest_slot(2);
+TaskHandle_t decode_task_handle = nullptr;
+
+// TJpgDec reuses its block buffer, so each block is copied to one of these before the DMA push
+uint16_t *dma_buffers[2];
+uint8_t dma_buffer_index = 0;
+
 uint32_t dw, dh;
 int16_t xpos = 0;
 int16_t ypos = 0;
-float scale_factor = 1.0;
-bool first_frame = true;
-
-static uint32_t frame_count = 0;
-static uint_fast64_t last_time = 0;
+uint16_t image_width = 0;
+uint16_t image_height = 0;
+
+// Scaling of the current image size, see setupScaling()
+const uint32_t STEP_ONE = 1 << 16;
+uint8_t jpg_scale = 1;          // Decoder scale, 1, 2, 4 or 8
+uint16_t scaled_width = 0;      // Decoder output
+uint16_t scaled_height = 0;
+uint16_t out_width = 0;         // On screen
+uint16_t out_height = 0;
+uint32_t step_x = STEP_ONE;     // Decoded pixels per screen pixel, 16.16 fixed point
+uint32_t step_y = STEP_ONE;
+
+// Counters since the last stats line, reset by loop()
+std::atomic<uint32_t> frames_received(0);
+std::atomic<uint32_t> frames_dropped(0);  // Replaced in the ring before being decoded
+std::atomic<uint32_t> frames_decoded(0);
+std::atomic<uint32_t> decode_errors(0);
+std::atomic<uint32_t> decode_time_us(0);  // Sums over the decoded frames
+std::atomic<uint32_t> push_time_us(0);
+std::atomic<uint32_t> decode_time_max_us(0);
+std::atomic<uint32_t> last_length(0);
+uint32_t frame_push_us = 0; // Decode task only
+
+// First screen pixel whose nearest decoded pixel is at or past v
+uint16_t firstOutput(int32_t v, uint32_t step) {
+    return (uint16_t) ((((uint32_t) v << 16) + step - 1) / step);
+}
 
-// JPEG rendering callback required by TJpg_Decoder
+// JPEG rendering callback required by TJpg_Decoder, (x, y) in decoded image pixels
 bool tft_output(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t *bitmap) {
-    // Apply scaling and centering
-    int16_t scaled_x = xpos + (x * scale_factor);
-    int16_t scaled_y = ypos + (y * scale_factor);
-    int16_t scaled_w = w * scale_factor;
-    int16_t scaled_h = h * scale_factor;
+    // Screen pixels of the fitted image that sample this block
+    uint16_t x0 = firstOutput(x, step_x);
+    uint16_t x1 = min<uint16_t>(firstOutput(x + w, step_x), out_width);
+    uint16_t y0 = firstOutput(y, step_y);
+    uint16_t y1 = min<uint16_t>(firstOutput(y + h, step_y), out_height);
+
+    // Blocks come in rows from the top, nothing left to show past the bottom edge
+    if (y0 >= out_height) return false;
+    if (x0 >= x1 || y0 >= y1) return true;
+
+    // pushImageDMA waits for the previous block, which used the other buffer
+    uint32_t start = micros();
+    uint16_t *block = dma_buffers[dma_buffer_index];
+    uint16_t cw = x1 - x0;
+    uint16_t *out = block;
+    for (uint16_t row = y0; row < y1; row++) {
+        const uint16_t *src = bitmap + (int32_t) (((uint32_t) row * step_y >> 16) - y) * w;
+        if (step_x == STEP_ONE) {
+            memcpy(out, src + (x0 - x), cw * sizeof(uint16_t));
+            out += cw;
+        } else {
+            uint32_t sx = (uint32_t) x0 * step_x;
+            for (uint16_t col = x0; col < x1; col++, sx += step_x) {
+                *out++ = src[(sx >> 16) - x];
+            }
+        }
+    }
+    tft.pushImageDMA(xpos + x0, ypos + y0, cw, y1 - y0, block);
+    dma_buffer_index ^= 1;
+    frame_push_us += micros() - start;
 
-    // Check boundaries
-    if (scaled_y >= tft.height() || scaled_x >= tft.width()) return false;
+    return true;
+}
 
-    // Push image to display with scaling
-    tft.pushImage(scaled_x, scaled_y, scaled_w, scaled_h, bitmap);
+// Size of an image shrunk to fit the panel with its aspect ratio, never enlarged
+void fitToScreen(uint16_t w, uint16_t h, uint16_t &fit_w, uint16_t &fit_h) {
+    if (w <= dw && h <= dh) {
+        fit_w = w;
+        fit_h = h;
+    } else if ((uint32_t) w * dh >= (uint32_t) h * dw) {
+        fit_w = dw;
+        fit_h = max<uint32_t>((uint32_t) h * dw / w, 1);
+    } else {
+        fit_h = dh;
+        fit_w = max<uint32_t>((uint32_t) w * dh / h, 1);
+    }
+}
 
-    return true;
+// Largest decoder scale whose output still covers the fitted size, so the decoder does the least work
+// and the resample only ever drops pixels
+void setupScaling(uint16_t w, uint16_t h) {
+    uint16_t fit_w, fit_h;
+    fitToScreen(w, h, fit_w, fit_h);
+    jpg_scale = 1;
+    while (jpg_scale < 8 && w / (jpg_scale * 2) >= fit_w && h / (jpg_scale * 2) >= fit_h) {
+        jpg_scale *= 2;
+    }
+    TJpgDec.setJpgScale(jpg_scale);
+
+    scaled_width = w / jpg_scale;
+    scaled_height = h / jpg_scale;
+    fitToScreen(scaled_width, scaled_height, out_width, out_height);
+    step_x = ((uint32_t) scaled_width << 16) / out_width;
+    step_y = ((uint32_t) scaled_height << 16) / out_height;
+    xpos = (dw - out_width) / 2;
+    ypos = (dh - out_height) / 2;
 }
 
-// Calculate optimal scaling and positioning for the image
-void calculateScaling(uint16_t img_width, uint16_t img_height) {
-    float scale_w = (float) dw / img_width;
-    float scale_h = (float) dh / img_height;
+void drawFrame(const uint8_t *jpg, uint32_t length) {
+    uint16_t w = 0, h = 0;
+    if (TJpgDec.getJpgSize(&w, &h, jpg, length) != JDR_OK || w == 0 || h == 0) {
+        decode_errors++;
+        return;
+    }
 
-    // Use the smaller scaling factor to maintain aspect ratio
-    scale_factor = min(scale_w, scale_h);
+    // Frames of the same size overwrite each other, the borders only need clearing when it changes
+    if (w != image_width || h != image_height) {
+        image_width = w;
+        image_height = h;
+        setupScaling(w, h);
+        tft.fillScreen(TFT_BLACK);
+        Serial.printf("Image dimensions: %dx%d, decoded at 1/%d (%dx%d), shown %dx%d at (%d, %d)\n", w, h,
+                      jpg_scale, scaled_width, scaled_height, out_width, out_height, xpos, ypos);
+    }
 
-    // Calculate position to center the image
-    xpos = (dw - (img_width * scale_factor)) / 2;
-    ypos = (dh - (img_height * scale_factor)) / 2;
+    uint32_t start = micros();
+    frame_push_us = 0;
+    tft.startWrite();
+    JRESULT result = TJpgDec.drawJpg(0, 0, jpg, length);
+    uint32_t wait_start = micros();
+    tft.dmaWait();
+    tft.endWrite();
+    uint32_t push_us = frame_push_us + (micros() - wait_start);
+    uint32_t decode_us = micros() - start - push_us;
+
+    // JDR_INTR: tft_output stopped past the last screen row
+    if (result != JDR_OK && result != JDR_INTR) {
+        decode_errors++;
+        return;
+    }
+    frames_decoded++;
+    decode_time_us += decode_us;
+    push_time_us += push_us;
+    if (decode_us > decode_time_max_us) {
+        decode_time_max_us = decode_us;
+    }
+    last_length = length;
+}
 
-    // Apply scaling to TJpg_Decoder
-    TJpgDec.setJpgScale(1); // We'll handle scaling in the callback
+// Decodes the latest complete frame, frames that arrive meanwhile replace each other in the ring
+void decodeTask(void *) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!(latest_slot.load() & FRAME_FRESH)) {
+            continue;
+        }
+        decode_slot = latest_slot.exchange(decode_slot) & ~FRAME_FRESH;
+        drawFrame(frame_slots[decode_slot], frame_lengths[decode_slot]);
+    }
 }
 
-// Callback when data is received via ESPNowCam
+// Callback when data is received via ESPNowCam, runs in the WiFi task: publish the frame and move
+// reception to the free slot
 void onDataReady(uint32_t length) {
-    // Get image dimensions from JPEG header (only for first frame)
-    if (first_frame) {
-        uint16_t w = 0, h = 0;
-        TJpgDec.getJpgSize(&w, &h, fb, length);
-        if (w > 0 && h > 0) {
-            calculateScaling(w, h);
-            first_frame = false;
-            Serial.printf("Image dimensions: %dx%d, Scale: %.2f\n", w, h, scale_factor);
-        }
+    frame_lengths[receive_slot] = length;
+    uint8_t previous = latest_slot.exchange(receive_slot | FRAME_FRESH);
+    if (previous & FRAME_FRESH) {
+        frames_dropped++;
     }
+    receive_slot = previous & ~FRAME_FRESH;
+    radio.setRecvBuffer(frame_slots[receive_slot]);
+    frames_received++;
+    xTaskNotifyGive(decode_task_handle);
+}
 
-    // Clear screen before drawing new frame
+// Reports a setup failure on the serial port and the screen, then stops
+void halt(const char *message) {
+    Serial.println(message);
     tft.fillScreen(TFT_BLACK);
-
-    // Draw the JPEG directly to the screen
-    TJpgDec.drawJpg(0, 0, fb, length);
-
-    // FPS calculation
-    frame_count++;
-    if (millis() - last_time >= 1000) {
-        Serial.printf("FPS: %d | JPG Size: %d bytes\n", frame_count, length);
-        frame_count = 0;
-        last_time = millis();
-    }
+    tft.setTextColor(TFT_RED, TFT_BLACK);
+    tft.drawCentreString(message, dw / 2, dh / 2, 2);
+    while (1) delay(100);
 }
 
 void setup() {
@@ -123,6 +263,7 @@ void setup() {
     tft.init();
     tft.setRotation(1); // Landscape mode for T-Display (240x135)
     tft.fillScreen(TFT_BLACK);
+    tft.initDMA();
 
     // Enable backlight for T-Display (PIN 4)
     pinMode(4, OUTPUT);
@@ -133,6 +274,20 @@ void setup() {
 
     Serial.printf("Display dimensions: %dx%d\n", dw, dh);
 
+    // Receive ring in internal RAM, block buffers in DMA capable RAM
+    for (int i = 0; i < FRAME_SLOTS; i++) {
+        frame_slots[i] = (uint8_t *) heap_caps_malloc(FRAME_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (frame_slots[i] == nullptr) {
+            halt("Frame buffers: out of memory");
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        dma_buffers[i] = (uint16_t *) heap_caps_malloc(MCU_MAX_PIXELS * sizeof(uint16_t), MALLOC_CAP_DMA);
+        if (dma_buffers[i] == nullptr) {
+            halt("DMA buffers: out of memory");
+        }
+    }
+
     // Disable WiFi scanning to prevent interference
     WiFi.mode(WIFI_STA);
     WiFi.disconnect();
@@ -141,24 +296,37 @@ void setup() {
     TJpgDec.setSwapBytes(true); // Critical for correct color rendering
     TJpgDec.setCallback(tft_output);
 
+    // The receive callback notifies the decode task, which must exist before reception starts
+    if (xTaskCreatePinnedToCore(decodeTask, "decode", DECODE_TASK_STACK_SIZE, nullptr, DECODE_TASK_PRIORITY,
+                                &decode_task_handle, DECODE_TASK_CORE) != pdPASS) {
+        halt("Decode task failed");
+    }
+
+    // Drawn before the first frame can arrive, the decode task owns the screen from then on and the first
+    // frame clears the message
+    tft.setTextColor(TFT_GREEN, TFT_BLACK);
+    tft.drawCentreString("ESPNow Ready", dw / 2, dh / 2, 2);
+
     // Set ESPNowCam receiver buffer and callback
-    radio.setRecvBuffer(fb);
+    radio.setRecvBuffer(frame_slots[receive_slot]);
     radio.setRecvCallback(onDataReady);
 
-    if (radio.init()) {
-        Serial.println("ESPNowCam initialized successfully!");
-        tft.setTextColor(TFT_GREEN, TFT_BLACK);
-        tft.drawCentreString("ESPNow Ready", dw / 2, dh / 2, 2);
-        delay(1000); // Show message briefly
-        tft.fillScreen(TFT_BLACK); // Clear screen before receiving frames
-    } else {
-        Serial.println("ESPNowCam initialization failed!");
-        tft.setTextColor(TFT_RED, TFT_BLACK);
-        tft.drawCentreString("ESPNow Failed", dw / 2, dh / 2, 2);
-        while (1) delay(100); // Halt if initialization fails
+    if (!radio.init()) {
+        halt("ESPNow Failed");
     }
+    Serial.println("ESPNowCam initialized successfully!");
 }
 
 void loop() {
-    // Nothing to do here; ESP-NOW reception handled via callback
+    // Reception and decoding run in their own tasks, this one only reports
+    delay(STATS_INTERVAL);
+
+    uint32_t decoded = frames_decoded.exchange(0);
+    uint32_t decode_us = decode_time_us.exchange(0);
+    uint32_t push_us = push_time_us.exchange(0);
+    Serial.printf("FPS: %u | received %u | dropped %u | errors %u | decode %u us (max %u) | push %u us | "
+                  "JPG Size: %u bytes\n",
+                  decoded, frames_received.exchange(0), frames_dropped.exchange(0), decode_errors.exchange(0),
+                  decoded ? decode_us / decoded : 0, decode_time_max_us.exchange(0), decoded ? push_us / decoded : 0,
+                  last_length.load());
 }
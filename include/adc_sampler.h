@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.h"
+#include "hal.h"
+
+// ESP32 JoystickInput. Samples both joystick axes in the background and keeps a filtered value per axis.
+// With JOYSTICK_ADC_DMA the ADC scans VRX/VRY continuously into the driver's DMA ring buffer;
+// poll() only drains what has been converted since the last call, oversamples and filters it.
+class AdcSampler : public JoystickInput {
+public:
+    AdcSampler();
+
+    bool begin() override;
+
+    // Never blocks, cost is proportional to the samples converted since the last call
+    void poll() override;
+
+    // Filtered raw values in the JOYSTICK_RAW_MIN..JOYSTICK_RAW_MAX range
+    int getX() const override;
+
+    int getY() const override;
+
+private:
+    struct Channel {
+        uint8_t adcChannel;
+        uint32_t accumulator;
+        uint16_t count;
+        int32_t filtered; // Q8 fixed point
+        bool primed;
+    };
+
+    Channel xChannel;
+    Channel yChannel;
+
+    void addSample(Channel &channel, uint16_t sample);
+
+    static void filter(Channel &channel, uint16_t value);
+
+    static int value(const Channel &channel);
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include "hal.h"
+
+// Sprite-local rectangle
+typedef struct canvas_rect {
+    int16_t x;
+    int16_t y;
+    int16_t w;
+    int16_t h;
+} canvas_rect;
+
+// Copies the w x h window of source at (sx, sy) to target at (x, y), row by row, clipped to clip and
+// to target. Both canvases have the same color depth (4 or 16 bits); viewports are ignored.
+void blitCanvas(Canvas &target, Canvas &source, int16_t sx, int16_t sy, int16_t w, int16_t h,
+                int16_t x, int16_t y, const canvas_rect &clip);
+
+// Expansion table of 4-bit canvases: the two RGB565 pixels of each byte, first one in the low half
+typedef struct canvas_palette {
+    uint32_t pairs[256];
+} canvas_palette;
+
+// colors are stored as given, already in the byte order the screen expects
+void buildCanvasPalette(const uint16_t *colors, uint8_t count, canvas_palette &palette);
+
+// Writes w pixels of row sy, from column sx, as RGB565 to out. 16-bit canvases are copied as stored,
+// 4-bit ones are expanded through palette.
+void expandCanvasRow(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, const canvas_palette &palette,
+                     uint16_t *out);
+
+// Characters of one text style rasterized once with the built-in GLCD font, then copied into sprites
+// instead of going through the per-glyph rasterizer on every frame. Cells include their background.
+class GlyphAtlas {
+public:
+    GlyphAtlas();
+
+    // chars must outlive the atlas
+    void build(Framebuffer &framebuffer, const char *chars, uint8_t textSize, uint16_t color, uint16_t background);
+
+    // Copies text with its top-left corner at (x, y), clipped to clip. Characters missing from the
+    // atlas leave their cell untouched. Returns the x after the last character.
+    int16_t draw(Canvas &target, const char *text, int16_t x, int16_t y, const canvas_rect &clip) const;
+
+    int16_t getGlyphWidth() const;
+
+private:
+    Canvas *canvas;
+    const char *chars;
+    int16_t glyphWidth;
+    int16_t glyphHeight;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "protocol.h"
+
+// Car side of the channel switch (protocol.h). Like protocol.h it has no Arduino dependency, so the
+// car can use it as is: it follows the announcements, goes back when the transmitter is not heard on
+// the new channel, and once the transmitter has been silent for CHANNEL_LOST_TIMEOUT tries the previous
+// channel, then every channel in turn. Times are in ms.
+class ChannelFollower {
+public:
+    ChannelFollower();
+
+    // Every frame heard from the transmitter, after authentication when the link has it
+    void receive(const uint8_t *buffer, size_t length, unsigned long now);
+
+    // Returns the channel the radio must be on
+    uint8_t update(unsigned long now);
+
+    uint8_t getChannel() const;
+
+    uint32_t getSwitches() const;
+
+    // Switches undone because the transmitter was not heard on the new channel
+    uint32_t getFallbacks() const;
+
+private:
+    uint8_t channel;
+    uint8_t previous;
+    uint8_t pendingChannel;
+    bool pending;
+    bool probation;         // Switched, the transmitter not heard on the new channel yet
+    bool scanning;
+    bool hasHop;
+    uint16_t lastHop;
+    unsigned long switchTime;
+    unsigned long lastHeard;
+    uint32_t switches;
+    uint32_t fallbacks;
+};
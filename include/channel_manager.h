@@ -0,0 +1,91 @@
+#pragma once
+
+#include "types.h"
+#include "protocol.h"
+#include "config.h"
+
+typedef struct channel_stats {
+    uint8_t channel;        // Current
+    uint32_t hops;          // Switches every car confirmed, or forced
+    uint32_t fallbacks;     // Switches undone, a car did not confirm in time
+    uint32_t aborted;       // Switches not made, a car did not acknowledge the announcement
+    uint32_t forced;        // Made without every car, the channel was too lossy to announce them
+} channel_stats;
+
+// Transmitter side of the channel switch (protocol.h): scores the channels from the survey, decides when
+// to leave the current one, and runs the announce/confirm handshake with every car. Cars without a
+// delivered frame for CHANNEL_LOST_TIMEOUT are left out of both, they are off or scanning. It does not
+// touch the radio, the caller applies the channel changes and sends the frames. Times are in ms.
+class ChannelManager {
+public:
+    ChannelManager();
+
+    // Loss-triggered switches, off by default; the move to a quieter surveyed channel happens either way
+    void setEnabled(bool enabled);
+
+    void recordSurvey(const channel_survey &survey);
+
+    // Outcome of a frame sent to car on the current channel
+    void recordSend(uint8_t car, bool delivered, unsigned long now);
+
+    // Advances the handshake. Returns true when the radio has to move to channel now.
+    bool update(unsigned long now, uint8_t cars, uint8_t &channel);
+
+    // Channel frame car needs this tick, false if none
+    bool frameFor(uint8_t car, unsigned long now, channel_frame &frame) const;
+
+    // The car's radio acknowledged frame
+    void acknowledge(uint8_t car, const channel_frame &frame);
+
+    uint8_t getChannel() const;
+
+    // Score of a channel, lower is quieter; 0 until it was surveyed
+    int getScore(uint8_t channel) const;
+
+    channel_stats getStats() const;
+
+private:
+    enum State {
+        STATE_IDLE,
+        STATE_ANNOUNCING,   // On the current channel, until switchTime
+        STATE_CONFIRMING    // On the new channel, until every car acknowledged a confirmation
+    };
+
+    State state;
+    bool enabled;
+    bool surveyed;          // A survey is in and the move to the quietest channel not done yet
+    bool leaving;           // The switch in progress is for the loss on the current channel
+    bool forced;            // The switch in progress goes ahead without every car
+    uint8_t channel;
+    uint8_t previous;
+    uint8_t target;
+    uint16_t hop;
+    unsigned long switchTime;
+    unsigned long nextAttempt;
+    uint32_t acknowledged;  // One bit per car that has the announcement
+    uint32_t confirmed;     // One bit per car heard on the new channel
+    uint32_t window;        // Send outcomes, bit 0 the most recent, 1 = delivered
+    uint8_t windowSize;
+    uint8_t failureRun;
+    uint8_t abortRun;       // Aborted attempts in a row
+    unsigned long lastDelivered[COMS_MAX_PEERS];
+    int scores[CHANNEL_LAST + 1];
+    unsigned long avoidUntil[CHANNEL_LAST + 1];
+    bool avoided[CHANNEL_LAST + 1];
+    channel_stats stats;
+
+    bool lossy() const;
+
+    // One bit per car with a frame delivered within CHANNEL_LOST_TIMEOUT
+    uint32_t presentCars(unsigned long now, uint8_t cars) const;
+
+    // Moves to target, returns the channel for update()
+    uint8_t startSwitch();
+
+    // Lowest score other than the current channel and the avoided ones, 0 if there is none
+    uint8_t pickChannel(unsigned long now, bool leavingForLoss) const;
+
+    void avoid(uint8_t channel, unsigned long now);
+
+    void resetWindow();
+};
@@ -1,30 +1,242 @@
 #pragma once
 
-#include <esp_now.h>
-#include <WiFi.h>
+#include <atomic>
+#include "hal.h"
 #include "types.h"
+#include "protocol.h"
+#include "frame_auth.h"
+#include "send_policy.h"
+#include "link_monitor.h"
+#include "channel_manager.h"
+#include "spsc_ring.h"
+#include "loop_profiler.h"
 #include "config.h"
 
+// Round trips of the probes of one RTT_WINDOW
+typedef struct rtt_stats {
+    uint32_t probes;    // Sent during the window
+    uint32_t echoes;    // Received during the window
+    uint32_t p50Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+} rtt_stats;
+
+// Button events since boot, over every car they were sent to
+typedef struct button_stats {
+    uint32_t events;        // Queued for a car
+    uint32_t delivered;
+    uint32_t retries;
+    uint32_t dropped;       // Queue full, or not acknowledged after BUTTON_MAX_ATTEMPTS
+    uint32_t p50Us;         // Edge to acknowledgement of the delivered ones
+    uint32_t p99Us;
+    uint32_t maxUs;
+} button_stats;
+
 class Communication {
 public:
-    Communication();
+    // Target covering every registered car
+    static const int TARGET_ALL = -1;
+
+    Communication(Radio &radio, Clock &clock);
 
     bool begin();
 
+    // Registers a car, returns its index or -1 when COMS_MAX_PEERS are registered or the radio refused it
+    int addPeer(const uint8_t *address);
+
+    // With broadcast, the ALL target costs a single frame on air instead of one per car, but without acks.
+    // Ignored with encryption, ESP-NOW cannot encrypt broadcasts.
+    void setBroadcast(bool enabled);
+
+    // ESP-NOW encryption (LINK_AUTH_CCMP) of the cars added afterwards, before begin(). The keys are
+    // 16 bytes, not copied, and must outlive Communication.
+    void setEncryption(const uint8_t *primaryKey, const uint8_t *localKey);
+
+    // Signs every frame put on air (LINK_AUTH_MAC) and drops what the cars send back unless they signed
+    // it, see frame_auth.h. Before begin(); epoch must grow with every boot.
+    void setFrameAuthentication(const uint8_t *key, uint16_t epoch);
+
+    // One pass over the peer table: the target gets the stick, the other cars a neutral stick, each
+    // as often as the send policy decides for that peer. Frames are built first, then queued back to back.
     bool send(const struct_message &data);
 
+    // Queues a button event for the target, for every car with ALL, and puts it on air at once, ahead
+    // of the stick and whatever the send policy says. Resent until acknowledged, one in flight per car,
+    // so the car gets them in order.
+    void sendButtonEvent(const button_event &event);
+
+    button_stats getButtonStats() const;
+
+    void setTarget(int target);
+
+    int getTarget() const;
+
+    // ALL, then every car in turn
+    void selectNextTarget();
+
+    int getPeerCount() const;
+
+    // Of the target, the weakest car for ALL
     int getSignalStrength() const;
 
+    // Of the target, every car for ALL
     bool isConnected() const;
 
+    link_stats getLinkStats(int peer) const;
+
+    // Sends a probe every interval ms to measure the round trip to the car, 0 stops probing
+    void setProbeInterval(uint32_t interval);
+
+    // Last complete window of the target, the car with the highest p99 for ALL
+    rtt_stats getRttStats() const;
+
+    rtt_stats getRttStats(int peer) const;
+
+    // 0 sends single-sample control frames, otherwise history frames that also carry the samples of
+    // up to depth previous frames, so the car can rebuild lost ones (see HistoryReceiver)
+    void setHistoryDepth(uint8_t depth);
+
+    // Shared by every peer, each keeps its own send state; not owned and must outlive Communication.
+    // Defaults to a fixed SEND_INTERVAL rate.
+    void setSendPolicy(SendPolicy *policy);
+
+    // Frames actually put on air during the last full second
+    uint32_t getPacketsPerSecond() const;
+
+    // Control frames put on air since boot, probes and button frames excluded
+    uint32_t getFramesSent() const;
+
+    // Clock time (ms since boot) at which the first frame was put on air, 0 before that
+    unsigned long getFirstFrameTime() const;
+
+    // Listens to every channel for dwell ms, after the cars are added and before the first send(). The
+    // cars are moved to the quietest channel with the first frames if it beats the current one.
+    void surveyChannels(uint32_t dwell);
+
+    // Moves the cars to another channel when delivery collapses on the current one, off by default
+    void setChannelHopping(bool enabled);
+
+    channel_stats getChannelStats() const;
+
+    // True until the send callback has reported every frame put on air. The radio is off in light sleep,
+    // a frame still in flight then may never be reported.
+    bool hasPendingSends() const;
+
 private:
-    esp_now_peer_info_t peerInfo;
-    bool connected;
-    int signalStrength;
-    unsigned long lastSignalUpdate;
-    unsigned long lastSendTime;
+    // Compact record pushed by the radio callbacks, drained by the main loop
+    struct LinkEvent {
+        uint32_t timestamp;     // micros()
+        uint32_t probeTime;     // Probe send micros() for EVENT_ECHO
+        uint16_t sequence;      // Send completion count of the peer (completions arrive in send order),
+                                // probe sequence for EVENT_ECHO
+        uint8_t peer;           // Radio peer index
+        uint8_t type;
+        int8_t value;           // 1 if delivered for EVENT_SEND_DONE, dBm for EVENT_RSSI
+    };
+
+    enum {
+        EVENT_SEND_DONE,
+        EVENT_RSSI,
+        EVENT_ECHO
+    };
+
+    // Everything Communication tracks about one destination
+    struct Peer {
+        int radioPeer;
+        bool connected;
+        LinkMonitor linkMonitor;
+        send_state sendState;
+        uint16_t txSequence;
+        control_frame recent[HISTORY_MAX_SAMPLES]; // Last samples built for this peer, newest first
+        uint8_t recentCount;
+        uint16_t acceptedSends;
+        uint32_t sendTimes[LINK_EVENT_RING_SIZE];
+        uint32_t sendErrors;
+        uint16_t probeSequence;
+        uint32_t pendingProbes;     // Bit i set until the echo of probe probeSequence - 1 - i arrives
+        uint32_t windowProbes;
+        LatencyHistogram rtt;       // Current window
+        rtt_stats lastRtt;          // Last complete window
+        button_event buttonQueue[BUTTON_EVENT_QUEUE_SIZE];
+        uint8_t buttonHead;
+        uint8_t buttonCount;
+        uint16_t buttonSequence;    // Of the event at the head of the queue
+        uint8_t buttonAttempts;     // Of the event at the head of the queue
+        bool buttonInFlight;
+        uint16_t buttonSendIndex;   // acceptedSends value of the frame in flight
+        uint32_t buttonSentUs;
+        bool channelInFlight;
+        uint16_t channelSendIndex;  // acceptedSends value of the channel frame in flight
+        uint32_t channelSentUs;
+        channel_frame channelFrame;
+    };
+
+    Radio &radio;
+    Clock &clock;
+    Peer peers[COMS_MAX_PEERS];
+    int peerCount;
+    Peer broadcastPeer;
+    bool broadcast;
+    const uint8_t *primaryKey;
+    const uint8_t *localKey;
+    bool frameAuthentication;
+    FrameSigner signer;
+    int target;
+    uint8_t historyDepth;
+
+    // Radio peer index to entry, and completion counts: the send callback counts each frame, expireSends()
+    // skips the ones it never reported
+    Peer *radioPeers[RADIO_MAX_PEERS];
+    std::atomic<uint16_t> completions[RADIO_MAX_PEERS];
+    FrameVerifier verifiers[RADIO_MAX_PEERS]; // Used by the receive callback only
+
+    // Both callbacks run in the radio task, so the ring has a single producer
+    SpscRing<LinkEvent, LINK_EVENT_RING_SIZE> linkEvents;
+    FixedRatePolicy defaultPolicy;
+    SendPolicy *sendPolicy;
+    uint32_t packetsSent;
+    uint32_t framesSent;
+    unsigned long firstFrameTime;
+    uint32_t packetsPerSecond;
+    unsigned long lastRateTime;
+    uint32_t probeInterval;
+    unsigned long lastProbeTime;
+    int nextProbePeer;
+    unsigned long rttWindowStart;
+    button_stats buttonStats;
+    LatencyHistogram buttonLatency;
+    ChannelManager channels;
+    mutable SpinLock statsLock; // The control task updates the button and channel stats, the report reads
+
+    bool registerPeer(Peer &peer, const uint8_t *address, const uint8_t *key);
+
+    // Queues a frame to the peer, signed with frame authentication, keeping the completion bookkeeping in step
+    bool sendFrame(Peer &peer, const uint8_t *data, size_t length);
+
+    void sendProbe(Peer &peer);
+
+    // Puts the head of each button queue on air where nothing is in flight
+    void serviceButtons();
+
+    // Completion of the button frame in flight
+    void completeButton(Peer &peer, bool delivered, uint32_t now);
+
+    // Moves the radio when the channel manager says so and sends each car the channel frame it needs
+    void serviceChannel(unsigned long now);
+
+    // Gives up on the completions that did not come within LINK_SEND_TIMEOUT_US: the button and channel
+    // frames in flight count as failed, and once the newest frame is that old the count of the callback
+    // is put back in step with the frames sent
+    void expireSends(Peer &peer, uint32_t now);
+
+    void rollRttWindow(unsigned long now);
+
+    // Then expires what the callbacks did not report
+    void drainLinkEvents();
+
+    static void onRadioSent(void *context, uint8_t peer, bool delivered);
 
-    static void onSendCallback(const uint8_t *mac_addr, esp_now_send_status_t status);
+    static void onRadioRssi(void *context, uint8_t peer, int8_t rssi);
 
-    static Communication *instance;
+    static void onRadioReceive(void *context, uint8_t peer, const uint8_t *data, size_t length);
 };
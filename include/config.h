@@ -1,5 +1,5 @@
 #pragma once
-#include <Arduino.h>
+#include <cstdint>
 
 // Pin definitions
 #define VRX_PIN             32
@@ -7,24 +7,103 @@
 #define SW_PIN              27
 
 // Joystick configuration
-#define JOYSTICK_DEADZONE   50
+#define JOYSTICK_DEADZONE   20
 #define NUM_CALIBRATIONS    20
 #define JOYSTICK_MIN_RANGE  (-255)
 #define JOYSTICK_MAX_RANGE  255
 #define JOYSTICK_RAW_MIN    0
 #define JOYSTICK_RAW_MAX    4095
 
+// Boot: with FAST_BOOT the calibration stored in NVS is reused, hold the button at power-on to redo it
+#define FAST_BOOT                   1
+#define JOYSTICK_SETTLE_TIME        5       // ms for the sampler to produce its first values
+#define JOYSTICK_DRIFT_THRESHOLD    24      // Raw units the rest position may move before recentering
+#define JOYSTICK_DRIFT_SETTLE_TIME  1000    // ms at rest before a drift is trusted
+#define JOYSTICK_DRIFT_FILTER_SHIFT 5
+#define CALIBRATION_NVS_NAMESPACE   "joystick"
+#define CALIBRATION_NVS_VERSION     1
+
+// Joystick sampling: continuous DMA scan of both axes, oversampled and IIR filtered
+#define JOYSTICK_ADC_DMA    1       // 0 falls back to one analogRead per axis per read()
+#define ADC_SAMPLE_RATE_HZ  20000   // Total conversions per second, shared by both axes
+#define ADC_OVERSAMPLE      16      // Conversions averaged per filter step
+#define ADC_IIR_SHIFT       2       // Filter coefficient 1/2^n
+#define ADC_DMA_FRAME_SIZE  256     // Bytes per DMA conversion frame
+#define ADC_DMA_BUFFER_SIZE 4096    // Bytes buffered by the driver between polls
+
+// Joystick button: edges are caught by a GPIO interrupt and reported at once, a hardware timer then
+// masks the bounces for BUTTON_DEBOUNCE_US and reports a level that changed meanwhile
+#define BUTTON_DEBOUNCE_US  5000
+#define BUTTON_TIMER        1       // One of the four hardware timers
+#define BUTTON_EDGE_RING_SIZE 16    // Interrupt to control task, power of two
+
 // Display update intervals (ms)
 #define DISPLAY_UPDATE_INTERVAL  50
-#define SIGNAL_UPDATE_INTERVAL   1000
 #define SEND_INTERVAL            20
 
+// Scheduler: periodic tasks on the application core, the control task preempts the UI task
+#define SCHEDULER_MAX_TASKS         4
+#define SCHEDULER_CORE              1
+#define SCHEDULER_TASK_STACK_SIZE   4096
+#define SCHEDULER_REPORT_INTERVAL   10000   // ms between two S, reports over serial
+#define CONTROL_PERIOD_US           5000    // Sample and send, a change goes out within SEND_MIN_INTERVAL
+#define CONTROL_TASK_PRIORITY       5
+#define UI_PERIOD_US                (DISPLAY_UPDATE_INTERVAL * 1000UL)
+#define UI_TASK_PRIORITY            2
+#define REPORT_CHECK_INTERVAL       100     // ms, loop() only prints reports
+
+// Adaptive send policy
+#define SEND_CHANGE_THRESHOLD    4     // Mapped units an axis must move to trigger a send
+#define SEND_MIN_INTERVAL        5     // ms, caps on-change sends at 200 Hz
+#define SEND_KEEPALIVE_INTERVAL  250   // ms, heartbeat while the input is idle
+
+// Loop instrumentation, enable with -DLOOP_INSTRUMENTATION=1 in build_flags
+#ifndef LOOP_INSTRUMENTATION
+#define LOOP_INSTRUMENTATION     0
+#endif
+#define LOOP_REPORT_INTERVAL     5000  // ms between two CSV dumps over serial
+
+// Display task (rendering and DMA pushes run off the control loop core)
+#define DISPLAY_TASK_CORE        0
+#define DISPLAY_TASK_PRIORITY    1
+#define DISPLAY_TASK_STACK_SIZE  4096
+#define DISPLAY_DMA_STRIP_ROWS   16
+#define DISPLAY_MODE_MAX_LEN     16
+
 // Color theme
 #define COLOR_GREEN         0x5E0A
 #define COLOR_BLUE          0x04DF
 #define COLOR_DARK          0x0200
 #define COLOR_TEXT          0xBFFA
 #define COLOR_CRITICAL      0xF800
+#define COLOR_BLACK         0x0000
+
+// Sprite color depth: 4 stores palette indices, two pixels per byte, expanded to RGB565 while the
+// regions are pushed; 16 stores RGB565. Build with -DDISPLAY_COLOR_DEPTH=16 to compare.
+#ifndef DISPLAY_COLOR_DEPTH
+#define DISPLAY_COLOR_DEPTH 4
+#endif
+#if DISPLAY_COLOR_DEPTH != 4 && DISPLAY_COLOR_DEPTH != 16
+#error "DISPLAY_COLOR_DEPTH must be 4 or 16"
+#endif
+#define DISPLAY_PALETTE     {COLOR_BLACK, COLOR_GREEN, COLOR_BLUE, COLOR_DARK, COLOR_TEXT, COLOR_CRITICAL}
+
+// Colors passed to the sprite drawing calls: the DISPLAY_PALETTE index, or the color itself at 16 bits
+#if DISPLAY_COLOR_DEPTH == 4
+#define PEN_BLACK           0
+#define PEN_GREEN           1
+#define PEN_BLUE            2
+#define PEN_DARK            3
+#define PEN_TEXT            4
+#define PEN_CRITICAL        5
+#else
+#define PEN_BLACK           COLOR_BLACK
+#define PEN_GREEN           COLOR_GREEN
+#define PEN_BLUE            COLOR_BLUE
+#define PEN_DARK            COLOR_DARK
+#define PEN_TEXT            COLOR_TEXT
+#define PEN_CRITICAL        COLOR_CRITICAL
+#endif
 
 // Display dimensions
 #define DISPLAY_WIDTH       240
@@ -47,5 +126,118 @@
 #define SIGNAL_BAR_SPACING  8
 #define SIGNAL_BAR_X_START  65
 
-// Default mode
-#define DEFAULT_MODE        "RACE"
+// Link monitor
+#define LINK_WINDOW_SIZE    32      // Send outcomes in the delivery ratio window (max 32)
+#define LINK_FAILURE_BURST  5       // Consecutive failures that drop the bars to 0
+#define LINK_RSSI_MAX_AGE   1000    // ms after which the last peer RSSI is ignored
+#define LINK_EVENT_RING_SIZE 32     // Callback to main loop records, power of two
+#define LINK_SEND_TIMEOUT_US 50000  // Without a send callback by then, a frame counts as lost
+
+// Peers: the cars listed in RECEIVER_MAC_ADDRESSES (secrets.h), a double press cycles the target
+#define COMS_MAX_PEERS              4
+#define RADIO_MAX_PEERS             (COMS_MAX_PEERS + 1) // Plus the broadcast address
+#define COMS_BROADCAST              0       // 1: the ALL target sends one broadcast frame, without acks
+#define TARGET_SWITCH_PRESS_TIME    400     // ms between the releases of a double press
+#define DISPLAY_TARGET_MAX_LEN      8
+
+// Channel: the cars start on CHANNEL_HOME (protocol.h). At power-on every channel is listened to for
+// CHANNEL_SURVEY_DWELL ms, which delays the first frame by 11 times that (0 skips the survey), and the
+// cars are moved to a quieter one. Other resets, a brownout among them, skip it. A collapsing delivery
+// ratio moves them again, see channel_manager.h.
+#define CHANNEL_SURVEY_DWELL        20      // ms per channel
+#define CHANNEL_SURVEY_MARGIN       10      // Score points a channel must beat the current one by
+#define CHANNEL_NOISE_REFERENCE     (-92)   // dBm, each dB of noise floor above it scores like 1% busy
+#define CHANNEL_OVERLAP_PENALTY     20      // Score of the channels overlapping one left for its loss
+#define CHANNEL_HOPPING             1
+#define CHANNEL_WINDOW              16      // Send outcomes the delivery ratio is taken over (max 32)
+#define CHANNEL_HOP_THRESHOLD       60      // Delivery ratio (%) under which the cars are moved
+#define CHANNEL_HOP_BURST           6       // Consecutive failed sends that move them at once
+#define CHANNEL_SWITCH_DELAY        15      // ms between the first announcement and the switch
+#define CHANNEL_ABORT_RETRIES       3       // Failed announcements in a row before going anyway (loss) or holding off
+#define CHANNEL_HOP_HOLDOFF         1000    // ms after a switch or a fallback before the next one
+#define CHANNEL_AVOID_TIME          30000   // ms a channel left for its loss, or failed, is skipped
+
+// Button events go to the target (every car for ALL) ahead of the stick, one in flight per car, and
+// are resent until acknowledged
+#define BUTTON_EVENT_QUEUE_SIZE     8       // Per car, power of two
+#define BUTTON_MAX_ATTEMPTS         10      // Then the event is dropped
+
+// Link authentication, the cars must use the same mode and the keys of secrets.h.
+// CCMP: ESP-NOW encrypts and authenticates unicast frames in the radio; broadcasts cannot be, so
+// COMS_BROADCAST is ignored. MAC: every frame carries a boot epoch, a counter and a truncated SipHash
+// tag (frame_auth.h) checked by the car, broadcasts included.
+#define LINK_AUTH_NONE              0
+#define LINK_AUTH_CCMP              1
+#define LINK_AUTH_MAC               2
+#ifndef LINK_AUTH
+#define LINK_AUTH                   LINK_AUTH_NONE
+#endif
+#define AUTH_EPOCH_NVS_NAMESPACE    "frameauth"
+
+// Samples of previous frames repeated in each frame, 0 keeps the single-sample control frame
+#define FRAME_HISTORY_DEPTH         0
+
+// Round-trip probes: timestamped frames the car echoes back (protocol.h). They go to the target, to
+// each car in turn for ALL. 0 disables them and the RTT readout.
+#define RTT_PROBE_INTERVAL          0       // ms between two probes
+#define RTT_WINDOW                  5000    // ms of echoes behind the p50/p99 shown
+#define DISPLAY_RTT_MAX_LEN         16
+
+// Input recording on LittleFS (input_trace.h). RECORD logs every drive, starting at the first move
+// of the stick; REPLAY feeds the last recording to the radio and the screen instead of the stick.
+#define INPUT_TRACE_OFF             0
+#define INPUT_TRACE_RECORD          1
+#define INPUT_TRACE_REPLAY          2
+#ifndef INPUT_TRACE_MODE
+#define INPUT_TRACE_MODE            INPUT_TRACE_OFF
+#endif
+#define INPUT_TRACE_PATH            "/input.rec"
+#define INPUT_TRACE_BLOCK_SIZE      512     // Bytes per flash write
+#define INPUT_TRACE_BLOCKS          4       // RAM blocks queued for the writer, power of two
+#define INPUT_TRACE_FLUSH_INTERVAL  1000    // ms a block may wait, bounds what a power off loses
+#define INPUT_TRACE_MAX_SIZE        (1024UL * 1024UL) // Recording stops there
+
+// Event log (event_log.h): binary records written from any task or callback, sent over serial by
+// loop() and turned back into text by tools/decode_log.py
+#define LOG_RING_SIZE               64      // Records, power of two
+#define LOG_MAX_ARGS                4
+#define LOG_RATE_INTERVAL           1000    // ms, a message repeated within it is counted, not sent
+#define LOG_DRAIN_BYTES             128     // Written per loop() pass at most, the size of the UART FIFO
+
+// Power management (power_manager.h): once the stick rests the CPU is clocked down, then the backlight
+// dims and goes off, and after POWER_STANDBY_TIME the control task slows down and light-sleeps between
+// its ticks. A stick move wakes it at the next tick, a button press at once. 0 keeps everything on.
+#define POWER_MANAGEMENT            1
+#define POWER_ACTIVE_CPU_MHZ        240
+#define POWER_IDLE_CPU_MHZ          80      // Lowest clock WiFi runs at
+#define POWER_ACTIVITY_THRESHOLD    8       // Mapped units off neutral that count as a move
+#define POWER_IDLE_TIME             2000    // ms at rest before each step
+#define POWER_DIM_TIME              20000
+#define POWER_BLANK_TIME            60000
+#define POWER_STANDBY_TIME          120000
+#define POWER_STANDBY_PERIOD_US     100000  // Control period in standby, bounds the wake-up on a stick move
+#define POWER_SLEEP_GUARD_US        3000    // Awake ahead of the next standby tick, covers the wake-up
+#define POWER_SEND_WAIT_US          5000    // Longest wait for the send callbacks before a light sleep
+#define BACKLIGHT_PIN               4       // TTGO T-Display
+#define BACKLIGHT_PWM_CHANNEL       0
+#define BACKLIGHT_FULL              255
+#define BACKLIGHT_DIM               40
+
+// Current model behind the runtime estimate, mA at the battery: rough ESP32 datasheet and T-Display
+// figures, measure the board and adjust
+#define POWER_BATTERY_MAH           1200
+#define POWER_CURRENT_CPU_FAST      40      // At POWER_ACTIVE_CPU_MHZ, idle between the ticks
+#define POWER_CURRENT_CPU_SLOW      22      // At POWER_IDLE_CPU_MHZ
+#define POWER_CURRENT_RX            60      // Receiver on, whenever the chip is awake
+#define POWER_CURRENT_TX            180     // On top of it while a frame is on air
+#define POWER_TX_FRAME_US           700     // Air time of a frame and its ack at 1 Mbit/s
+#define POWER_CURRENT_BACKLIGHT     20      // At BACKLIGHT_FULL, scales with the duty
+#define POWER_CURRENT_PANEL         5       // Panel awake
+#define POWER_CURRENT_BOARD         6       // Regulator, USB bridge and stick potentiometers, always drawn
+#define POWER_CURRENT_SLEEP         1       // ESP32 in light sleep
+
+// Drive modes, see drive_mode.h
+#define DEFAULT_DRIVE_MODE      DRIVE_MODE_RACE
+#define MODE_SWITCH_HOLD_TIME   800     // ms the button must be held to cycle modes
+#define CURVE_SCALE_SHIFT       12
+#define CURVE_MIN_SPAN          64      // Raw units, guards the scale against a bad calibration
@@ -1,29 +1,120 @@
 #pragma once
 
-#include <TFT_eSPI.h>
+#include <atomic>
 #include "config.h"
+#include "hal.h"
 #include "types.h"
+#include "canvas_cache.h"
+
+// Render pipeline counters, reported by the display task
+typedef struct display_stats {
+    uint32_t pixelsPerSecond; // Pixels pushed over SPI during the last full second
+    uint32_t framesRendered;
+    uint32_t framesDropped;   // Published states overwritten before the task picked them up
+    uint32_t renderTimeUs;    // Last frame, time spent drawing into sprites
+    uint32_t pushTimeUs;      // Last frame, time spent staging and waiting on DMA
+} display_stats;
 
 class Display {
 public:
-    Display();
+    Display(Framebuffer &framebuffer, Clock &clock);
 
+    // Starts the screen and the boot animation without waiting for them on the device
     void begin();
 
     void drawBootScreen();
 
-    void update(const struct_message &joystickData, int signalStrength, int speed, const String &mode);
+    // Publishes the latest state to the display task, called at the UI rate; never blocks on SPI.
+    // rtt is shown in the header as is, e.g. "RTT 1.2/3.4MS", empty when not measured.
+    void update(const struct_message &joystickData, int signalStrength, int speed, const char *mode,
+                const char *target, const char *rtt);
+
+    // Applied by the display task between frames; nothing is rendered while it is 0
+    void setBacklight(uint8_t level);
+
+    display_stats getStats() const;
 
 private:
-    TFT_eSPI tft;
-    TFT_eSprite headerSprite;
-    TFT_eSprite joystickSprite;
-    TFT_eSprite footerSprite;
-    unsigned long lastUpdateTime;
+    // Sprite-local rectangle used for partial repaints
+    typedef canvas_rect Region;
+
+    // Everything needed to render one frame
+    struct State {
+        struct_message joystickData;
+        int signalStrength;
+        int speed;
+        char mode[DISPLAY_MODE_MAX_LEN];
+        char target[DISPLAY_TARGET_MAX_LEN];
+        char rtt[DISPLAY_RTT_MAX_LEN];
+    };
+
+    Framebuffer &framebuffer;
+    Clock &clock;
+    Canvas *headerSprite;
+    Canvas *joystickSprite;
+    Canvas *footerSprite;
+
+    // Static background of each sprite, rendered once and copied in at the start of a repaint
+    Canvas *headerLayer;
+    Canvas *joystickLayer;
+    Canvas *footerLayer;
+
+    // Pre-rasterized dynamic text
+    GlyphAtlas speedDigits;
+    GlyphAtlas speedUnit;
+    GlyphAtlas footerText;
+    GlyphAtlas headerText;
+    std::atomic<bool> running; // Set once the boot animation is done
+
+    // Handoff between update() and the display task (latest state wins)
+#ifndef NATIVE_BUILD
+    TaskHandle_t renderTaskHandle;
+#endif
+    mutable SpinLock stateLock;
+    State pendingState;
+    bool statePending;
+    uint8_t backlight;
+
+    // Owned by the display task
+    uint8_t backlightApplied;
+
+    // Retained state of what is currently on screen, owned by the display task
+    bool frameValid;
+    State lastState;
+
+    // Stats, written by the display task under stateLock
+    display_stats stats;
+    uint32_t pixelsPushed;
+    uint32_t pushTimeUs;
+    unsigned long lastStatsTime;
 
-    void drawHeader(int signalStrength);
+#ifndef NATIVE_BUILD
+    static void renderTask(void *param);
+#endif
+
+    void startup();
+
+    void buildStaticLayers();
+
+    void renderPending();
+
+    void renderFrame(const State &state);
+
+    void drawHeader(int signalStrength, const char *rtt);
 
     void drawJoystickVisual(const struct_message &joystickData, int speed);
 
-    void drawFooter(const String &mode);
-};
\ No newline at end of file
+    void drawFooter(const char *mode, const char *target);
+
+    void renderJoystickScene(const Region &region, const struct_message &joystickData, int speed);
+
+    void repaintJoystickRegion(const Region &region, const struct_message &joystickData, int speed);
+
+    void pushRegion(Canvas &canvas, int16_t screenY, const Region &region);
+
+    void pushBootFrame();
+
+    static uint8_t directionMask(const struct_message &joystickData);
+
+    static Region pointerRegion(const struct_message &joystickData);
+};
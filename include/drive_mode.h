@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Response curves are indexed by the calibrated stick position, CURVE_CENTER being neutral
+#define CURVE_TABLE_BITS    12
+#define CURVE_TABLE_SIZE    (1 << CURVE_TABLE_BITS)
+#define CURVE_CENTER        (CURVE_TABLE_SIZE / 2)
+
+enum DriveMode : uint8_t {
+    DRIVE_MODE_RACE,
+    DRIVE_MODE_ECO,
+    DRIVE_MODE_PRECISION,
+    DRIVE_MODE_COUNT
+};
+
+// CURVE_TABLE_SIZE entries in JOYSTICK_MIN_RANGE..JOYSTICK_MAX_RANGE, deadzone and output limit included
+const int16_t *driveModeCurve(DriveMode mode);
+
+const char *driveModeName(DriveMode mode);
+
+DriveMode nextDriveMode(DriveMode mode);
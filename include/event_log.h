@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "config.h"
+#include "hal.h"
+#include "log_messages.h"
+#include "mpsc_ring.h"
+
+// Event log: logEvent() stores the message id, the time and up to LOG_MAX_ARGS integers in a lock-free
+// ring, from any task or callback, without formatting or touching the UART. A low priority task
+// drains it into frames for the serial port:
+//   [0]     mark           LOG_FRAME_MARK, a byte the text lines on the same port never hold
+//   [1]     id             LogId, see log_messages.h
+//   [2]     argc           bits 0-3 number of arguments, bit 7 set for a summary (no arguments)
+//   [3..6]  time           uint32, us
+//           varint         records of the id counted instead of sent before this one
+//           varint         zigzag(argument), argc times
+//   [last]  crc            CRC-8 over every byte before it
+// A message logged again within LOG_RATE_INTERVAL of the last one sent is only counted. The count
+// goes out with the next one sent, or in a summary once the interval is over.
+
+#define LOG_FRAME_MARK      0xFE
+#define LOG_FRAME_MAX_SIZE  (7 + 5 + 5 * LOG_MAX_ARGS + 1)
+#define LOG_FLAG_SUMMARY    0x80
+
+typedef struct log_record {
+    uint32_t timeUs;
+    uint8_t id;
+    uint8_t argc;
+    uint32_t repeated;      // Counted instead of sent since the previous record of the id
+    int32_t args[LOG_MAX_ARGS];
+} log_record;
+
+typedef struct log_stats {
+    uint32_t records;       // Logged, counted ones included
+    uint32_t sent;          // Frames drained, summaries included
+    uint32_t coalesced;     // Counted instead of sent
+    uint32_t dropped;       // Lost to a full ring
+    uint32_t bytes;         // Drained
+} log_stats;
+
+class EventLog {
+public:
+    explicit EventLog(const Clock &clock);
+
+    // Uninstalls the log
+    ~EventLog();
+
+    // Makes this the log logEvent() writes to
+    void install();
+
+    static EventLog *getInstance();
+
+    // Any context, never blocks
+    void write(LogId id, const int32_t *args, uint8_t argc);
+
+    // Low priority task: fills buffer with whole frames, at most size bytes; returns the bytes written
+    size_t drain(uint8_t *buffer, size_t size);
+
+    // From the draining task
+    log_stats getStats() const;
+
+private:
+    const Clock &clock;
+    MpscRing<log_record, LOG_RING_SIZE> ring;
+    std::atomic<uint32_t> lastSentUs[LOG_ID_COUNT];
+    std::atomic<uint32_t> suppressed[LOG_ID_COUNT];
+    std::atomic<bool> seen[LOG_ID_COUNT];
+    std::atomic<uint32_t> records;
+    std::atomic<uint32_t> coalesced;
+
+    // Owned by the draining task
+    uint8_t pending[LOG_FRAME_MAX_SIZE];    // Frame that did not fit in the last buffer
+    size_t pendingLength;
+    uint32_t droppedReported;
+    uint32_t sent;
+    uint32_t bytes;
+
+    // Pops or builds the next frame into pending, false when there is none
+    bool nextFrame();
+
+    size_t encode(const log_record &record, uint8_t flags);
+
+    static EventLog *instance;
+};
+
+// Logs to the installed EventLog, if any
+template<typename... Args>
+void logEvent(LogId id, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many arguments for a log record");
+    EventLog *log = EventLog::getInstance();
+    if (log != nullptr) {
+        const int32_t values[] = {(int32_t) args..., 0};
+        log->write(id, values, (uint8_t) sizeof...(Args));
+    }
+}
@@ -6,4 +6,22 @@
 // Example: if MAC is 3C:61:05:12:34:56
 // then use: {0x3C, 0x61, 0x05, 0x12, 0x34, 0x56}
 
-const uint8_t RECEIVER_MAC_ADDRESS[] = {0x3C, 0x61, 0x05, 0x12, 0x34, 0x56};
+// One line per car, up to COMS_MAX_PEERS. A double press on the joystick button cycles between
+// all of them and each one in turn.
+const uint8_t RECEIVER_MAC_ADDRESSES[][6] = {
+        {0x3C, 0x61, 0x05, 0x12, 0x34, 0x56},
+};
+
+// Link keys for LINK_AUTH (config.h), 16 bytes each, the same in the car firmware. Replace them with
+// random bytes of your own, anyone with these values can drive the cars.
+// LINK_AUTH_CCMP: ESP-NOW primary and local master keys
+const uint8_t ESPNOW_PMK[16] = {
+        0x5a, 0x13, 0xc8, 0x77, 0x02, 0x9e, 0x41, 0xd6, 0x3b, 0xf0, 0x68, 0x2c, 0x91, 0x0d, 0xe4, 0x85,
+};
+const uint8_t ESPNOW_LMK[16] = {
+        0xa7, 0x3e, 0x19, 0xc2, 0x64, 0xdb, 0x08, 0x7f, 0xe1, 0x56, 0x9a, 0x2b, 0x4d, 0xf3, 0x70, 0x1c,
+};
+// LINK_AUTH_MAC: SipHash key of the frame tags
+const uint8_t FRAME_MAC_KEY[16] = {
+        0x0f, 0xb4, 0x62, 0x9d, 0x35, 0xe8, 0x1a, 0xc7, 0x7b, 0x26, 0xd1, 0x53, 0x8e, 0x40, 0xfa, 0x99,
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Frame authentication for LINK_AUTH_MAC, shared with the car firmware like protocol.h. Each frame gets
+// a trailer that proves it comes from a holder of the key and was not heard before:
+//   [0..1]  epoch          uint16, bit 15 set for frames sent by the car, bits 0..14 the boot count
+//   [2..5]  counter        uint32, incremented per frame, restarts at 0 with each epoch
+//   [6..9]  tag            SipHash-2-4 over the frame and bytes [0..5] of the trailer, low 32 bits
+// The receiver only accepts an (epoch, counter) above the last one it accepted. The epoch must grow with
+// every boot of the sender, so it is kept in non-volatile memory; the car should keep the last epoch
+// it accepted there as well, otherwise frames recorded before its reboot are accepted once more.
+
+#define FRAME_AUTH_KEY_SIZE     16
+#define FRAME_AUTH_TAG_SIZE     4
+#define FRAME_AUTH_SIZE         (6 + FRAME_AUTH_TAG_SIZE)
+#define FRAME_AUTH_FROM_CAR     0x8000
+#define FRAME_AUTH_EPOCH_MASK   0x7FFF
+
+uint64_t sipHash24(const uint8_t *key, const uint8_t *data, size_t length);
+
+class FrameSigner {
+public:
+    FrameSigner();
+
+    // key is copied; epoch is truncated to 15 bits, 0 means none could be kept and nothing is signed
+    void begin(const uint8_t *key, uint16_t epoch, bool fromCar);
+
+    // Appends the trailer to the length bytes of frame. Returns the new length, 0 if size is too small
+    // or the counter is exhausted (2^32 frames in one epoch).
+    size_t sign(uint8_t *frame, size_t length, size_t size);
+
+private:
+    uint8_t key[FRAME_AUTH_KEY_SIZE];
+    uint16_t epoch;
+    uint32_t counter;
+    bool exhausted;
+};
+
+class FrameVerifier {
+public:
+    FrameVerifier();
+
+    // fromCar: the direction of the frames this verifier accepts
+    void begin(const uint8_t *key, bool fromCar);
+
+    // Returns the length of the frame without its trailer, 0 when the tag does not match, the direction
+    // is wrong or the counter was already used
+    size_t verify(const uint8_t *frame, size_t length);
+
+    uint32_t getAccepted() const;
+
+    uint32_t getRejected() const;
+
+private:
+    uint8_t key[FRAME_AUTH_KEY_SIZE];
+    bool fromCar;
+    bool started;
+    uint16_t lastEpoch;
+    uint32_t lastCounter;
+    uint32_t accepted;
+    uint32_t rejected;
+};
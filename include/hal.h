@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "types.h"
+#include "config.h"
+
+// Thin hardware interfaces used by Joystick, Communication and Display, so the same classes run
+// on the ESP32 (hal_esp32.h) and on the host against deterministic fakes (src/native).
+
+#ifdef NATIVE_BUILD
+#include "memory_canvas.h"
+typedef MemoryCanvas Canvas;
+#else
+#include <TFT_eSPI.h>
+typedef TFT_eSprite Canvas;
+#endif
+
+class Clock {
+public:
+    virtual ~Clock() = default;
+
+    virtual uint32_t millis() const = 0;
+
+    virtual uint32_t micros() const = 0;
+
+    virtual void delay(uint32_t ms) = 0;
+};
+
+// Joystick axes, filtered raw ADC values
+class JoystickInput {
+public:
+    virtual ~JoystickInput() = default;
+
+    virtual bool begin() = 0;
+
+    // Fetches whatever was sampled since the last call, must not block
+    virtual void poll() = 0;
+
+    virtual int getX() const = 0;
+
+    virtual int getY() const = 0;
+};
+
+// Joystick push button, debounced
+class ButtonInput {
+public:
+    virtual ~ButtonInput() = default;
+
+    virtual bool begin() = 0;
+
+    // Oldest level change not read yet, false when there is none; must not block
+    virtual bool readEdge(button_edge &edge) = 0;
+
+    // Current level, may be ahead of the edges read so far
+    virtual bool isPressed() const = 0;
+};
+
+// Non-volatile storage for the joystick calibration
+class CalibrationStore {
+public:
+    virtual ~CalibrationStore() = default;
+
+    virtual bool load(joystick_calibration &calibration) = 0;
+
+    virtual bool save(const joystick_calibration &calibration) = 0;
+};
+
+// One input recording (input_trace.h), written and read sequentially, one open mode at a time
+class RecordingStorage {
+public:
+    virtual ~RecordingStorage() = default;
+
+    virtual bool begin() = 0;
+
+    // Replaces the recording with an empty one
+    virtual bool openWrite() = 0;
+
+    // False when there is no recording
+    virtual bool openRead() = 0;
+
+    // Appends, the data is expected to survive a power off once this returns
+    virtual bool write(const uint8_t *data, size_t length) = 0;
+
+    // Returns the number of bytes read, 0 at the end
+    virtual size_t read(uint8_t *data, size_t size) = 0;
+
+    virtual void close() = 0;
+};
+
+// Link to the cars. Peers are addressed by the index addPeer() returned. Callbacks may run in
+// another task than send().
+class Radio {
+public:
+    typedef void (*SendCallback)(void *context, uint8_t peer, bool delivered);
+    typedef void (*RssiCallback)(void *context, uint8_t peer, int8_t rssi);
+    // Frames from unregistered senders are dropped; data is only valid during the call
+    typedef void (*ReceiveCallback)(void *context, uint8_t peer, const uint8_t *data, size_t length);
+
+    virtual ~Radio() = default;
+
+    virtual bool begin() = 0;
+
+    // ESP-NOW primary master key (16 bytes), encrypts the local keys of the peers; after begin()
+    virtual bool setPrimaryKey(const uint8_t *key) = 0;
+
+    // Returns the peer index, or -1 when the peer table (RADIO_MAX_PEERS) is full. The broadcast
+    // address is accepted; its frames are not acknowledged and always complete as delivered.
+    // With a local key (16 bytes, nullptr for none) frames to and from the peer are encrypted and
+    // authenticated (CCMP) by the radio, which the broadcast address does not support.
+    virtual int addPeer(const uint8_t *address, const uint8_t *localKey) = 0;
+
+    // Queues a frame, completions are reported through the send callback in send order
+    virtual bool send(uint8_t peer, const uint8_t *data, size_t length) = 0;
+
+    // Moves to a WiFi channel, every peer is reached there from then on
+    virtual bool setChannel(uint8_t channel) = 0;
+
+    // Listens to channel for dwell ms and reports the traffic heard, then returns to the current
+    // channel. Blocks, nothing can be sent meanwhile.
+    virtual bool survey(uint8_t channel, uint32_t dwell, channel_survey &result) = 0;
+
+    virtual void setCallbacks(SendCallback onSent, RssiCallback onRssi, ReceiveCallback onReceive,
+                              void *context) = 0;
+};
+
+// Screen the Display pushes rendered regions to
+class Framebuffer {
+public:
+    virtual ~Framebuffer() = default;
+
+    virtual void begin() = 0;
+
+    // Offscreen canvas the size of a screen area, owned by the framebuffer. Its color depth is
+    // DISPLAY_COLOR_DEPTH: at 4 bits it holds DISPLAY_PALETTE indices and width must be even.
+    virtual Canvas *createCanvas(int16_t width, int16_t height) = 0;
+
+    // Pixel memory held by the canvases created so far
+    virtual size_t getCanvasBytes() const = 0;
+
+    virtual void startFrame() = 0;
+
+    // Copies a w x h window of canvas at (sx, sy) to the screen at (x, y), expanding palette indices
+    // to RGB565; may return before the transfer completes
+    virtual void pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h,
+                            int16_t x, int16_t y) = 0;
+
+    // Waits for every pushed region to reach the screen
+    virtual void endFrame() = 0;
+
+    // 0 (off, the panel asleep) to BACKLIGHT_FULL; called between frames
+    virtual void setBacklight(uint8_t level) = 0;
+};
+
+// CPU clock and sleep of the controller
+class PowerControl {
+public:
+    virtual ~PowerControl() = default;
+
+    virtual bool setCpuFrequency(uint32_t mhz) = 0;
+
+    // Light-sleeps for us or until the joystick button is pressed, true for the button. The radio is
+    // off meanwhile, frames in flight are lost.
+    virtual bool lightSleep(uint32_t us) = 0;
+};
+
+// Short critical section around state shared between the control loop and the display task
+#ifdef NATIVE_BUILD
+class SpinLock {
+public:
+    // Native builds are single threaded
+    void lock() {}
+
+    void unlock() {}
+};
+#else
+#include <freertos/FreeRTOS.h>
+
+class SpinLock {
+public:
+    void lock() { portENTER_CRITICAL(&mux); }
+
+    void unlock() { portEXIT_CRITICAL(&mux); }
+
+private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+#endif
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include <LittleFS.h>
+#include <TFT_eSPI.h>
+#include "hal.h"
+#include "canvas_cache.h"
+#include "config.h"
+
+class EspClock : public Clock {
+public:
+    uint32_t millis() const override;
+
+    uint32_t micros() const override;
+
+    void delay(uint32_t ms) override;
+};
+
+// Calibration kept in the NVS partition, survives reflashing the application
+class NvsCalibrationStore : public CalibrationStore {
+public:
+    bool load(joystick_calibration &calibration) override;
+
+    bool save(const joystick_calibration &calibration) override;
+
+private:
+    Preferences preferences;
+};
+
+// Recording in a LittleFS file, the partition is formatted on first use
+class LittleFsRecordingStorage : public RecordingStorage {
+public:
+    explicit LittleFsRecordingStorage(const char *path);
+
+    bool begin() override;
+
+    bool openWrite() override;
+
+    bool openRead() override;
+
+    bool write(const uint8_t *data, size_t length) override;
+
+    size_t read(uint8_t *data, size_t size) override;
+
+    void close() override;
+
+private:
+    const char *path;
+    File file;
+};
+
+// The button wakes the chip from light sleep on its low level, and is left on edge interrupts again
+// afterwards. A press during the sleep never reached InterruptButton, resync() it.
+class EspPowerControl : public PowerControl {
+public:
+    bool setCpuFrequency(uint32_t mhz) override;
+
+    bool lightSleep(uint32_t us) override;
+};
+
+// Boot count in NVS, the epoch of the frame authentication counters (frame_auth.h)
+class NvsBootCounter {
+public:
+    // Returns the incremented count, 0 when NVS cannot be written or the 32767 epochs are used up. Then
+    // change FRAME_MAC_KEY and the key of the cars, and erase the AUTH_EPOCH_NVS_NAMESPACE namespace.
+    uint16_t increment();
+
+private:
+    Preferences preferences;
+};
+
+// ESP-NOW to a table of peers; RSSI comes from the peers' frames seen in promiscuous mode
+class EspNowRadio : public Radio {
+public:
+    EspNowRadio();
+
+    bool begin() override;
+
+    bool setPrimaryKey(const uint8_t *key) override;
+
+    int addPeer(const uint8_t *address, const uint8_t *localKey) override;
+
+    bool send(uint8_t peer, const uint8_t *data, size_t length) override;
+
+    bool setChannel(uint8_t channel) override;
+
+    // Every frame heard in promiscuous mode counts, its airtime estimated from its length and rate
+    bool survey(uint8_t channel, uint32_t dwell, channel_survey &result) override;
+
+    void setCallbacks(SendCallback onSent, RssiCallback onRssi, ReceiveCallback onReceive,
+                      void *context) override;
+
+private:
+    uint8_t peerAddresses[RADIO_MAX_PEERS][ESP_NOW_ETH_ALEN];
+    int peerCount;
+    volatile bool surveying;
+    volatile uint32_t surveyFrames;     // Written by the promiscuous callback during a survey
+    volatile uint32_t surveyAirtimeUs;
+    volatile int32_t surveyNoiseSum;
+    SendCallback sendCallback;
+    RssiCallback rssiCallback;
+    ReceiveCallback receiveCallback;
+    void *callbackContext;
+
+    // Linear search, the table holds a handful of entries
+    int findPeer(const uint8_t *address) const;
+
+    static void onSendCallback(const uint8_t *mac_addr, esp_now_send_status_t status);
+
+    static void onReceiveCallback(const uint8_t *mac_addr, const uint8_t *data, int length);
+
+    static void onPromiscuousCallback(void *buf, wifi_promiscuous_pkt_type_t type);
+
+    static EspNowRadio *instance;
+};
+
+// TFT_eSPI screen, regions are sent with DMA through two ping-pong staging strips. 4-bit sprites
+// are expanded to RGB565 while a strip is filled, which overlaps the previous strip's transfer. Without
+// the RAM for the strips, regions are pushed from the sprites directly, blocking.
+class TftFramebuffer : public Framebuffer {
+public:
+    TftFramebuffer();
+
+    void begin() override;
+
+    Canvas *createCanvas(int16_t width, int16_t height) override;
+
+    size_t getCanvasBytes() const override;
+
+    void startFrame() override;
+
+    void pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t x, int16_t y) override;
+
+    void endFrame() override;
+
+    // PWM on BACKLIGHT_PIN; at 0 the panel goes to sleep, keeping its picture
+    void setBacklight(uint8_t level) override;
+
+private:
+    TFT_eSPI tft;
+    uint8_t backlight;
+    uint16_t *dmaBuffer[2];
+    int dmaBufferIndex;
+    canvas_palette palette; // DISPLAY_PALETTE byte swapped, the order sprites store RGB565 in
+    size_t canvasBytes;
+};
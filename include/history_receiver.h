@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "protocol.h"
+
+// Reference receiver for control and history frames: rebuilds the ordered input stream from
+// whatever frames arrive. Like protocol.h it has no Arduino dependency, so the car can use it as is.
+class HistoryReceiver {
+public:
+    HistoryReceiver();
+
+    // Decodes a received frame and writes the samples not delivered yet to out, oldest first. out must
+    // hold HISTORY_MAX_SAMPLES. Returns how many were written, 0 for a stale, duplicate or corrupt frame.
+    int receive(const uint8_t *buffer, size_t length, control_frame *out);
+
+    // Samples delivered from the newest slot of a frame
+    uint32_t getReceived() const;
+
+    // Samples rebuilt from the history of a later frame
+    uint32_t getRecovered() const;
+
+    // Samples skipped for good, their frame and every frame carrying them were lost
+    uint32_t getLost() const;
+
+    uint32_t getCorrupt() const;
+
+    // Sequence numbers that jumped back by more than HISTORY_MAX_SAMPLES, the transmitter rebooted
+    uint32_t getRestarts() const;
+
+private:
+    bool started;
+    uint16_t nextSequence;
+    uint32_t received;
+    uint32_t recovered;
+    uint32_t lost;
+    uint32_t corrupt;
+    uint32_t restarts;
+};
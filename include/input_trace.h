@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "config.h"
+#include "types.h"
+#include "hal.h"
+#include "drive_mode.h"
+
+// Input recording: the mapped joystick stream, encoded into RAM blocks by the control task and
+// appended to storage a whole block at a time by a low priority task.
+//
+// Recording:
+//   [0..3]  magic          "JREC"
+//   [4]     version        INPUT_TRACE_VERSION
+//   then blocks, each decodable on its own:
+//   [0..1]  length         uint16, bytes of samples that follow
+//   [2..5]  time           uint32, ms from the start of the recording to the first sample
+//   then per sample, relative to the previous one (the first to time and x = y = 0)
+//           varint         (dt << 4) | flags, dt in ms; flags bit 0 button, bit 1 double press,
+//                          bits 2-3 drive mode
+//           varint         zigzag(x - previous x)
+//           varint         zigzag(y - previous y)
+// A sample that repeats the previous one is not stored, it holds until the next one.
+
+#define INPUT_TRACE_VERSION         1
+#define INPUT_TRACE_HEADER_SIZE     5
+#define INPUT_TRACE_BLOCK_HEADER    6
+#define INPUT_TRACE_SAMPLE_MAX_SIZE 15
+
+typedef struct input_sample {
+    uint32_t timeMs;        // From the start of the recording
+    struct_message data;
+    DriveMode mode;
+    bool doublePress;       // A double press completed since the previous sample
+} input_sample;
+
+class InputRecorder {
+public:
+    explicit InputRecorder(RecordingStorage &storage);
+
+    // Control task, never touches storage. The recording starts at the first sample off the rest
+    // position, so a reset keeps the previous recording until the stick is moved.
+    void record(uint32_t timeMs, const struct_message &data, DriveMode mode, bool doublePress);
+
+    // Low priority task: writes the blocks record() has filled
+    void flush();
+
+    bool isStarted() const;
+
+    uint32_t getSamples() const;
+
+    uint32_t getBytesWritten() const;
+
+    // Samples lost to a full block queue, a failed write or INPUT_TRACE_MAX_SIZE
+    uint32_t getDropped() const;
+
+private:
+    struct Block {
+        uint8_t data[INPUT_TRACE_BLOCK_SIZE];
+        size_t length;
+        uint32_t samples;
+    };
+
+    RecordingStorage &storage;
+
+    // Owned by the control task
+    std::atomic<bool> started;
+    uint32_t startTime;
+    bool blockOpen;
+    uint32_t blockTime;
+    input_sample last;      // Last stored sample, for the repeat check
+    input_sample previous;  // Delta base inside the open block
+
+    // Filled blocks, control task to writer
+    Block blocks[INPUT_TRACE_BLOCKS];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+
+    // Owned by the writer
+    bool opened;
+    bool failed;
+
+    std::atomic<uint32_t> samples;
+    std::atomic<uint32_t> bytesWritten;
+    std::atomic<uint32_t> dropped;
+
+    bool openBlock(uint32_t time);
+
+    void commitBlock();
+};
+
+class InputPlayer {
+public:
+    explicit InputPlayer(RecordingStorage &storage);
+
+    // Opens the recording and reads its first blocks, false when there is none or it has another version
+    bool begin();
+
+    // Low priority task: reads the next blocks into RAM while there is room
+    void prefetch();
+
+    // Control task, never touches storage. Sample in effect timeMs after the start of the replay, with
+    // doublePress set if one was passed since the previous call. Returns false once the recording is over;
+    // sample then holds the stick at rest in the last mode. While the next block is not read yet, the
+    // current sample holds and the ones missed are caught up once it is.
+    bool read(uint32_t timeMs, input_sample &sample);
+
+    uint32_t getSamples() const;
+
+    // Blocks that could not be decoded, the replay ends at the first one
+    uint32_t getCorrupt() const;
+
+    // Calls to read() that found the next block still in storage
+    uint32_t getUnderruns() const;
+
+private:
+    struct Block {
+        uint8_t data[INPUT_TRACE_BLOCK_SIZE];
+        size_t length;
+        uint32_t time;
+    };
+
+    RecordingStorage &storage;
+
+    // Blocks read ahead, reader to control task
+    Block blocks[INPUT_TRACE_BLOCKS];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<bool> exhausted;    // Nothing more will be read: end of the recording or a corrupt block
+
+    // Owned by the control task
+    const Block *block;             // Being decoded, still in the ring
+    size_t position;
+    bool ended;
+    bool failed;
+    bool hasNext;
+    input_sample current;
+    input_sample next;
+    uint32_t samples;
+    uint32_t underruns;
+
+    std::atomic<uint32_t> corrupt;
+
+    // Moves to the next block in the ring, false when there is none yet
+    bool loadBlock();
+
+    bool decodeNext();
+
+    void fail();
+};
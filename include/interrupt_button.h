@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+#include "hal.h"
+#include "spsc_ring.h"
+
+// ESP32 ButtonInput on SW_PIN. A GPIO interrupt reports the first edge right away and starts a
+// one-shot hardware timer; edges are ignored until it fires BUTTON_DEBOUNCE_US later, then the pin is
+// read again and a level that changed meanwhile is reported too. A tap shorter than a control period
+// (or than the debounce) is never lost, it shows up as a press and a release.
+class InterruptButton : public ButtonInput {
+public:
+    InterruptButton();
+
+    bool begin() override;
+
+    bool readEdge(button_edge &edge) override;
+
+    bool isPressed() const override;
+
+    // Reads the pin again right away, for edges the interrupt missed (light sleep)
+    void resync();
+
+private:
+    hw_timer_t *debounceTimer;
+    SpscRing<button_edge, BUTTON_EDGE_RING_SIZE> edges; // Produced in the interrupts only
+    volatile bool pressed;
+    volatile bool masked;
+
+    void IRAM_ATTR report(bool level);
+
+    static void IRAM_ATTR onEdge();
+
+    static void IRAM_ATTR onDebounceTimer();
+
+    static InterruptButton *instance;
+};
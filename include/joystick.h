@@ -2,22 +2,51 @@
 
 #include "config.h"
 #include "types.h"
+#include "hal.h"
+#include "drive_mode.h"
+#include "protocol.h"
+#include "spsc_ring.h"
 
 class Joystick {
 public:
-    Joystick();
+    Joystick(JoystickInput &input, ButtonInput &button, Clock &clock, CalibrationStore &store);
 
+    // Uses the stored calibration with FAST_BOOT, unless the button is held at power-on
     void begin();
 
+    // Samples the rest position and saves it
     void calibrate();
 
+    // Samples the axes and turns the button edges since the last call into events
     void read();
 
     struct_message getData() const;
 
     int getSpeed() const;
 
+    // Simulated speed in percent, from the mapped Y position
+    static int speedFor(int y);
+
+    DriveMode getMode() const;
+
+    // Double presses since boot, compare with a previous value to detect a new one
+    uint32_t getDoublePressCount() const;
+
+    // Oldest button event not taken yet, false when there is none
+    bool nextButtonEvent(button_event &event);
+
+    joystick_calibration getCalibration() const;
+
+    void setCalibration(const joystick_calibration &calibration);
+
+    // From a low priority task: saves the center moved by drift tracking, if it moved since the last call
+    void saveCalibration();
+
 private:
+    JoystickInput &input;
+    ButtonInput &button;
+    Clock &clock;
+    CalibrationStore &store;
     struct_message data;
     int xCenter;
     int yCenter;
@@ -27,7 +56,40 @@ private:
     int yMax;
     int speed;
 
-    int applyDeadzone(int value, int deadzone);
+    // Fixed-point factors (CURVE_SCALE_SHIFT) from raw offset to curve index, per side of the center
+    int32_t xScaleLow;
+    int32_t xScaleHigh;
+    int32_t yScaleLow;
+    int32_t yScaleHigh;
+
+    DriveMode mode;
+    bool buttonDown;
+    uint32_t pressTimeUs;
+    bool modeSwitched;
+    bool releasePending;        // A short press is waiting for its second one
+    uint32_t lastReleaseTimeUs;
+    uint32_t doublePresses;
+    SpscRing<button_event, BUTTON_EVENT_QUEUE_SIZE> buttonEvents;
+
+    // Rest position tracking, Q4 offsets from the calibrated center
+    unsigned long restStartTime;
+    int32_t driftX;
+    int32_t driftY;
+
+    // Calibration waiting for saveCalibration(), the flash write stays off the control task
+    SpinLock calibrationLock;
+    joystick_calibration pendingCalibration;
+    bool calibrationPending;
+
+    void updateScales();
+
+    static int32_t scaleFor(int span);
+
+    static int curveIndex(int raw, int center, int32_t scaleLow, int32_t scaleHigh);
+
+    void handleEdge(const button_edge &edge);
+
+    void checkLongPress(uint32_t nowUs);
 
-    int mapJoystickToRange(int value, int valueMin, int valueMax, int valueCenter, int outMin, int outMax);
+    void trackDrift(int rawX, int rawY, bool pressed);
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+// Raw link counters, for logging
+typedef struct link_stats {
+    uint32_t sent;              // Outcomes recorded since boot
+    uint32_t delivered;
+    uint32_t failed;
+    uint8_t windowSize;         // Outcomes currently in the sliding window
+    uint8_t windowDelivered;
+    uint16_t failureBurst;      // Current run of consecutive failures
+    uint16_t maxFailureBurst;
+    int8_t rssi;                // dBm of the last frame heard from the peer
+    bool rssiValid;             // False until a frame was heard, or when the last one is stale
+    uint8_t level;              // 0..MAX_SIGNAL_STRENGTH bars
+    uint32_t ackLatencyUs;      // Send to MAC-level ack, last frame
+    uint32_t ackLatencyAvgUs;   // Moving average, 1/8 weight per frame
+    uint32_t ackLatencyMaxUs;
+    uint32_t sendErrors;        // esp_now_send rejected the frame
+    uint32_t eventsDropped;     // Callback records lost because the ring was full
+    uint32_t rejected;          // Frames from the peer failing authentication (LINK_AUTH_MAC)
+} link_stats;
+
+// Link quality from the last LINK_WINDOW_SIZE send outcomes and the RSSI of frames heard from the peer.
+// Times are in ms.
+class LinkMonitor {
+public:
+    LinkMonitor();
+
+    void recordSend(bool success);
+
+    void recordRssi(int8_t rssi, unsigned long now);
+
+    void recordAckLatency(uint32_t latencyUs);
+
+    // Bar level, recomputed on every call so it follows the window immediately
+    uint8_t getLevel(unsigned long now) const;
+
+    // Packet delivery ratio over the window, in percent
+    uint8_t getDeliveryRatio() const;
+
+    link_stats getStats(unsigned long now) const;
+
+private:
+    uint32_t window;            // One bit per outcome, bit 0 is the most recent, 1 = delivered
+    uint8_t windowSize;
+    uint32_t sent;
+    uint32_t delivered;
+    uint16_t failureBurst;
+    uint16_t maxFailureBurst;
+    int8_t rssi;
+    unsigned long lastRssiTime;
+    bool rssiHeard;
+    uint32_t ackLatencyUs;
+    uint32_t ackLatencyAvgUs;
+    uint32_t ackLatencyMaxUs;
+
+    uint8_t windowDelivered() const;
+
+    bool rssiFresh(unsigned long now) const;
+};
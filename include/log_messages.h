@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Every message the event log can carry. A record holds the id and the arguments only, the text is
+// put back together on the host by tools/decode_log.py, which reads this list: keep one entry per
+// line, append new ones at the end so older captures still decode, and use %d, %u or %x only.
+#define LOG_MESSAGES(X) \
+    X(LOG_RECORDS_DROPPED,      "%u log records dropped, the ring was full") \
+    X(LOG_CONTROLLER_READY,     "Controller initialized") \
+    X(LOG_CALIBRATION,          "Joystick calibration. xCenter: %d yCenter: %d") \
+    X(LOG_ADC_INIT_FAILED,      "ADC DMA init failed") \
+    X(LOG_ADC_START_FAILED,     "ADC DMA start failed") \
+    X(LOG_RADIO_INIT_FAILED,    "ESP-NOW init failed") \
+    X(LOG_RADIO_READY,          "ESP-NOW communication initialized") \
+    X(LOG_PEER_ADD_FAILED,      "Failed to add peer") \
+    X(LOG_COMS_INIT_FAILED,     "Communication initialization failed") \
+    X(LOG_TOO_MANY_RECEIVERS,   "Too many receivers, raise COMS_MAX_PEERS") \
+    X(LOG_EPOCH_NOT_SAVED,      "Boot count not saved or used up, frames are not sent") \
+    X(LOG_RECORDING_UNAVAILABLE, "LittleFS mount failed, input will not be recorded") \
+    X(LOG_NO_RECORDING,         "No input recording, replaying the stick at rest") \
+    X(LOG_FIRST_FRAME,          "Time to first packet: %u ms") \
+    X(LOG_DISPLAY_MEMORY,       "Display: %u-bit sprites in %u bytes, %u bytes of internal RAM free") \
+    X(LOG_SEND_FAILED,          "Send Failed, radio peer %u") \
+    X(LOG_SIGNER_EXHAUSTED,     "Frame not signed: no epoch, or counter exhausted until reboot") \
+    X(LOG_LINK_EVENTS_DROPPED,  "Radio callback ring full, radio peer %u") \
+    X(LOG_BUTTON_DROPPED,       "Button event %u dropped, radio peer %u") \
+    X(LOG_CHANNEL_SWITCH,       "Channel %u") \
+    X(LOG_POWER_STATE,          "Power state %u (0 active, 1 idle, 2 dimmed, 3 blank, 4 standby)") \
+    X(LOG_DISPLAY_DMA_FAILED,   "Display DMA strips not allocated, regions are pushed without DMA")
+
+#define LOG_MESSAGE_ID(name, format) name,
+
+enum LogId : uint8_t {
+    LOG_MESSAGES(LOG_MESSAGE_ID)
+    LOG_ID_COUNT
+};
+
+#undef LOG_MESSAGE_ID
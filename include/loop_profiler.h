@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "config.h"
+#include "hal.h"
+
+#ifndef NATIVE_BUILD
+// Xtensa CCOUNT register, one tick per CPU cycle, ~1 instruction to read
+static inline uint32_t readCycleCount() {
+    uint32_t cycles;
+    asm volatile("rsr %0, ccount" : "=r"(cycles));
+    return cycles;
+}
+#else
+#include <chrono>
+
+// Host builds count nanoseconds instead of cycles, start loops with cyclesPerUs = 1000
+static inline uint32_t readCycleCount() {
+    return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Log-linear histogram: 4 buckets per power of two, exact min/max
+class LatencyHistogram {
+public:
+    static const int NUM_BUCKETS = 124;
+
+    LatencyHistogram();
+
+    void record(uint32_t value);
+
+    void reset();
+
+    uint32_t getCount() const;
+
+    uint32_t getMin() const;
+
+    uint32_t getMax() const;
+
+    // Approximate value below which the given per-mille of samples fall, e.g. 990 for p99
+    uint32_t percentile(uint16_t perMille) const;
+
+private:
+    uint32_t buckets[NUM_BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+
+    static int bucketFor(uint32_t value);
+
+    static uint32_t bucketMidpoint(int index);
+};
+
+enum LoopStage : uint8_t {
+    STAGE_READ,
+    STAGE_SEND,
+    STAGE_DISPLAY,
+    STAGE_LOOP,          // Whole control tick
+    STAGE_SEND_INTERVAL, // Time between two frames actually put on air
+    STAGE_COUNT
+};
+
+// Per-stage histograms of the control and UI ticks, reported as CSV lines:
+//   L,<uptime ms>,<stage>,<count>,<min us>,<p50 us>,<p99 us>,<max us>
+// Samples are kept in ns, converted from cycles at the clock of the time: the power manager moves the CPU
+// between two clocks. Only compiled into main.cpp when LOOP_INSTRUMENTATION is set.
+class LoopProfiler {
+public:
+    typedef void (*LineWriter)(const char *line);
+
+    LoopProfiler();
+
+    // cyclesPerUs is the current CPU clock in MHz, the stages until the next loop are converted with it
+    void startLoop(uint32_t cyclesPerUs);
+
+    // Records the cycles since the previous mark (loop start or previous stage)
+    void endStage(LoopStage stage);
+
+    // Records a stage timed outside the startLoop()/endStage() sequence, e.g. from another task
+    void recordStage(LoopStage stage, uint32_t cycles);
+
+    // framesSent is the running count of frames on air. The send interval is timed with nowUs, the cycle
+    // counter stops in light sleep.
+    void endLoop(uint32_t framesSent, uint32_t nowUs);
+
+    bool reportDue(uint32_t nowMs) const;
+
+    // Writes one line per stage and starts a new window
+    void report(LineWriter write, uint32_t nowMs);
+
+private:
+    void recordNs(LoopStage stage, uint64_t ns);
+
+    // Recorded from the control and UI tasks, reported from loop()
+    SpinLock histogramLock;
+    LatencyHistogram histograms[STAGE_COUNT];   // ns
+    std::atomic<uint32_t> cyclesPerUs;
+    uint32_t loopStart;
+    uint32_t stageStart;
+    uint32_t lastFramesSent;
+    uint32_t lastSendUs;
+    bool sendSeen;
+    uint32_t lastReportMs;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free multi-producer/single-consumer ring. Each slot carries a sequence number, so producers
+// claim slots with a compare-and-swap and the consumer only reads slots whose producer is done;
+// push() can run in any task, callback or ISR. N must be a power of two.
+template<typename T, size_t N>
+class MpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "MpscRing size must be a power of two");
+
+public:
+    MpscRing() : head(0), tail(0), dropped(0) {
+        for (size_t i = 0; i < N; i++) {
+            slots[i].sequence.store((uint32_t) i, std::memory_order_relaxed);
+        }
+    }
+
+    // Producer side; returns false and counts a drop when full
+    bool push(const T &item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = slots[h & (N - 1)];
+            int32_t lag = (int32_t) (slot.sequence.load(std::memory_order_acquire) - h);
+            if (lag < 0) {
+                // Still holds the item from one lap ago
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (lag > 0) {
+                // Another producer claimed it
+                h = head.load(std::memory_order_relaxed);
+            } else if (head.compare_exchange_weak(h, h + 1, std::memory_order_relaxed)) {
+                slot.item = item;
+                slot.sequence.store(h + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Consumer side; a slot claimed but not written yet ends the pop, even if later ones are ready
+    bool pop(T &item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        Slot &slot = slots[t & (N - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != t + 1) {
+            return false;
+        }
+        item = slot.item;
+        slot.sequence.store(t + N, std::memory_order_release);
+        tail.store(t + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint32_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;     // Index it expects to be pushed at, plus one once written
+        T item;
+    };
+
+    Slot slots[N];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> dropped;
+};
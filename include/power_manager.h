@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include "config.h"
+#include "hal.h"
+
+// Steps taken as the stick rests, each one from its POWER_*_TIME on
+enum PowerState : uint8_t {
+    POWER_ACTIVE,
+    POWER_IDLE,         // CPU at POWER_IDLE_CPU_MHZ
+    POWER_DIMMED,       // Backlight at BACKLIGHT_DIM
+    POWER_BLANK,        // Backlight off, the panel asleep
+    POWER_STANDBY,      // Control ticks every POWER_STANDBY_PERIOD_US, light sleep in between
+    POWER_STATE_COUNT
+};
+
+const char *powerStateName(PowerState state);
+
+typedef struct power_stats {
+    PowerState state;
+    uint32_t timeInStateMs[POWER_STATE_COUNT];  // Since begin()
+    uint32_t averageCurrentUa;                  // Since begin(), from the current model
+    uint32_t runtimeMinutes;                    // Of POWER_BATTERY_MAH at that average
+    uint32_t sleeps;
+    uint32_t wakeups;                           // Out of standby
+} power_stats;
+
+// Follows the activity of the stick through the power states, sets the CPU clock and estimates the
+// current drawn from the POWER_CURRENT_* model. The caller applies the backlight and the control
+// period. Disabled, it stays active and only estimates.
+class PowerManager {
+public:
+    PowerManager(PowerControl &control, Clock &clock);
+
+    void begin();
+
+    void setEnabled(bool enabled);
+
+    // Once per control tick. active: the stick is off neutral or the button moved; framesSent: frames
+    // put on air so far. Returns true when the control period changed.
+    bool update(bool active, uint32_t framesSent);
+
+    // Last thing in a control tick that started at tickStartUs: in standby, light-sleeps until
+    // POWER_SLEEP_GUARD_US before the next one. Returns true when the button woke the controller, the
+    // control period changed then.
+    bool sleepUntilNextTick(uint32_t tickStartUs);
+
+    PowerState getState() const;
+
+    uint8_t getBacklight() const;
+
+    uint32_t getControlPeriodUs() const;
+
+    power_stats getStats() const;
+
+    // Modelled draw while awake in state, transmissions aside
+    static uint32_t stateCurrentUa(PowerState state);
+
+private:
+    PowerControl &control;
+    Clock &clock;
+    bool enabled;
+    PowerState state;
+    uint32_t lastActivityMs;
+    uint32_t lastAccountUs;
+    uint32_t lastFramesSent;
+    uint32_t sleptUs;           // Light sleep since the last accounting
+    uint64_t timeInStateUs[POWER_STATE_COUNT];
+    uint64_t chargeUaUs;
+    uint32_t sleeps;
+    uint32_t wakeups;
+    mutable SpinLock statsLock; // The control task accounts, the report reads
+
+    // Adds the charge drawn since the last call
+    void account(uint32_t framesSent);
+
+    // Returns true when the control period changed
+    bool enter(PowerState next);
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Wire format shared with the car firmware. Everything is explicitly little-endian and
+// independent of compiler struct layout, so this header has no Arduino dependency.
+//
+// Control frame (CONTROL_FRAME_SIZE bytes):
+//   [0]     version        PROTOCOL_VERSION
+//   [1]     type | buttons high nibble = frame type, low nibble = button bits
+//   [2..3]  sequence       uint16, incremented per frame, wraps
+//   [4..5]  timestamp      uint16, sender millis() truncated, wraps every 65.5 s
+//   [6..7]  x              int16
+//   [8..9]  y              int16
+//   [10]    crc            CRC-8 (poly 0x07, init 0x00) over bytes [0..9]
+//
+// History frame: the newest sample as in a control frame, followed by the samples of the previous
+// frames so the car can rebuild the ones it missed:
+//   [0..9]  as above, with FRAME_TYPE_HISTORY
+//   [10]    count          older samples that follow, 0..HISTORY_MAX_SAMPLES - 1
+//   then per older sample, newest first, each relative to the sample just after it
+//           varint         (dt << 4) | buttons, dt = ms between the two samples
+//           varint         zigzag(x - newer x)
+//           varint         zigzag(y - newer y)
+//   [last]  crc            CRC-8 over every byte before it
+// Sample i (0 = newest) has sequence number sequence - i.
+//
+// Probe frame (PROBE_FRAME_SIZE bytes), sent with FRAME_TYPE_PROBE to measure the round trip. The car
+// sends it back unchanged except for the type, FRAME_TYPE_ECHO, and the crc (see echoProbeFrame):
+//   [0]     version        PROTOCOL_VERSION
+//   [1]     type           high nibble, low nibble 0
+//   [2..3]  sequence       uint16, incremented per probe, wraps
+//   [4..7]  timestamp      uint32, sender micros(), only meaningful to the sender
+//   [8]     crc            CRC-8 over bytes [0..7]
+//
+// Button frame (BUTTON_FRAME_SIZE bytes), sent with FRAME_TYPE_BUTTON as soon as a button event happens,
+// outside the stick stream, and resent until acknowledged. The car acts once per sequence number:
+//   [0]     version        PROTOCOL_VERSION
+//   [1]     type | event   high nibble = frame type, low nibble = BUTTON_EVENT_*
+//   [2..3]  sequence       uint16, incremented per event, the same for every attempt
+//   [4..5]  timestamp      uint16, sender millis() of the event truncated
+//   [6]     attempt        0 for the first transmission, saturates at 255
+//   [7]     crc            CRC-8 over bytes [0..6]
+//
+// Channel frame (CHANNEL_FRAME_SIZE bytes), FRAME_TYPE_CHANNEL, moves the car to another WiFi channel.
+// The transmitter first announces the switch on the current channel, then confirms it from the new one:
+//   [0]     version        PROTOCOL_VERSION
+//   [1]     type           high nibble, low nibble 0
+//   [2..3]  hop            uint16, incremented per switch attempt
+//   [4]     channel        CHANNEL_FIRST..CHANNEL_LAST
+//   [5]     delay          ms until the switch, 0 in the confirmations sent on the new channel
+//   [6]     crc            CRC-8 over bytes [0..5]
+// The car goes back to its previous channel if it hears nothing from the transmitter within
+// CHANNEL_FALLBACK_TIMEOUT of the switch. The transmitter does the same when a car does not acknowledge a
+// confirmation in time, so a failed switch costs at most a few frames. See ChannelFollower.
+
+#define PROTOCOL_VERSION    1
+#define CONTROL_FRAME_SIZE  11
+
+// Newest sample included; the largest frame stays far below the 250 byte ESP-NOW payload
+#define HISTORY_MAX_SAMPLES     16
+#define HISTORY_FRAME_MAX_SIZE  (CONTROL_FRAME_SIZE + 1 + (HISTORY_MAX_SAMPLES - 1) * 9)
+#define PROBE_FRAME_SIZE        9
+#define BUTTON_FRAME_SIZE       8
+#define CHANNEL_FRAME_SIZE      7
+
+// Channels both sides use, and the one they start on
+#define CHANNEL_FIRST           1
+#define CHANNEL_LAST            11
+#define CHANNEL_HOME            1
+#define CHANNEL_FALLBACK_TIMEOUT 25     // ms
+#define CHANNEL_LOST_TIMEOUT    1000    // ms of silence after which the car looks for the transmitter
+#define CHANNEL_SCAN_DWELL      300     // ms the car listens on each channel while scanning
+
+// Frame types, stored in the high nibble of byte 1
+#define FRAME_TYPE_CONTROL  0x0
+#define FRAME_TYPE_HISTORY  0x1
+#define FRAME_TYPE_PROBE    0x2
+#define FRAME_TYPE_ECHO     0x3
+#define FRAME_TYPE_BUTTON   0x4
+#define FRAME_TYPE_CHANNEL  0x5
+
+// Button bits, stored in the low nibble of byte 1
+#define BUTTON_MAIN         0x01
+
+// Button events, stored in the low nibble of byte 1 of a button frame
+#define BUTTON_EVENT_PRESS      0x1
+#define BUTTON_EVENT_RELEASE    0x2
+#define BUTTON_EVENT_LONG_PRESS 0x3     // Held for MODE_SWITCH_HOLD_TIME, sent while still held
+#define BUTTON_EVENT_DOUBLE_TAP 0x4     // Sent with the second release
+
+typedef struct control_frame {
+    uint16_t sequence;
+    uint16_t timestamp;
+    int16_t x;
+    int16_t y;
+    uint8_t buttons;
+} control_frame;
+
+// Samples of a history frame, samples[0] is the newest
+typedef struct history_frame {
+    control_frame samples[HISTORY_MAX_SAMPLES];
+    uint8_t count;
+} history_frame;
+
+// Probe or echo, as given by type
+typedef struct probe_frame {
+    uint8_t type;
+    uint16_t sequence;
+    uint32_t timestamp;
+} probe_frame;
+
+typedef struct button_frame {
+    uint8_t event;
+    uint16_t sequence;
+    uint16_t timestamp;
+    uint8_t attempt;
+} button_frame;
+
+typedef struct channel_frame {
+    uint16_t hop;
+    uint8_t channel;
+    uint8_t delay;
+} channel_frame;
+
+enum DecodeResult {
+    DECODE_OK,
+    DECODE_TOO_SHORT,
+    DECODE_BAD_VERSION,
+    DECODE_BAD_TYPE,
+    DECODE_BAD_CRC,
+    DECODE_BAD_LENGTH
+};
+
+// Writes the frame into buffer, returns the number of bytes written or 0 if size is too small
+size_t encodeControlFrame(const control_frame &frame, uint8_t *buffer, size_t size);
+
+DecodeResult decodeControlFrame(const uint8_t *buffer, size_t length, control_frame &frame);
+
+// samples[0] is the newest, count 1..HISTORY_MAX_SAMPLES; the sequence numbers of the older samples
+// are implied. Returns the number of bytes written or 0 if size is too small.
+size_t encodeHistoryFrame(const control_frame *samples, uint8_t count, uint8_t *buffer, size_t size);
+
+// Also accepts a control frame, decoded as a history of one sample
+DecodeResult decodeHistoryFrame(const uint8_t *buffer, size_t length, history_frame &frame);
+
+size_t encodeProbeFrame(const probe_frame &frame, uint8_t *buffer, size_t size);
+
+// Accepts probes and echoes
+DecodeResult decodeProbeFrame(const uint8_t *buffer, size_t length, probe_frame &frame);
+
+// Car side: turns a valid probe into its echo in place. Returns false, leaving buffer untouched, for
+// anything else.
+bool echoProbeFrame(uint8_t *buffer, size_t length);
+
+size_t encodeButtonFrame(const button_frame &frame, uint8_t *buffer, size_t size);
+
+DecodeResult decodeButtonFrame(const uint8_t *buffer, size_t length, button_frame &frame);
+
+size_t encodeChannelFrame(const channel_frame &frame, uint8_t *buffer, size_t size);
+
+DecodeResult decodeChannelFrame(const uint8_t *buffer, size_t length, channel_frame &frame);
+
+uint8_t crc8(const uint8_t *data, size_t length);
+
+// Little-endian fields
+void putU16(uint8_t *p, uint16_t value);
+
+uint16_t getU16(const uint8_t *p);
+
+void putU32(uint8_t *p, uint32_t value);
+
+uint32_t getU32(const uint8_t *p);
+
+// LEB128, 7 bits per byte, at most 5 bytes; returns the number of bytes written
+size_t putVarint(uint8_t *p, uint32_t value);
+
+// Returns the number of bytes read, 0 if the varint runs past end
+size_t getVarint(const uint8_t *p, const uint8_t *end, uint32_t &value);
+
+// Maps small negative and positive values to small varints
+uint32_t zigzag(int32_t value);
+
+int32_t unzigzag(uint32_t value);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include "config.h"
+#include "hal.h"
+#include "loop_profiler.h"
+
+#ifndef NATIVE_BUILD
+#include <esp_timer.h>
+#endif
+
+// Counters of one periodic task over the current report window
+typedef struct task_stats {
+    uint32_t runs;
+    uint32_t deadlineMisses; // Runs that finished after their next release
+    uint32_t overruns;       // Releases dropped because the previous run was still going
+    uint32_t runTimeMaxUs;
+} task_stats;
+
+// Runs registered functions at fixed periods. On the ESP32 every task is a FreeRTOS task woken by
+// an esp_timer, so a higher priority task preempts a lower one and the core idles between releases.
+// Native builds drive the same bookkeeping from a single thread through runDue().
+class Scheduler {
+public:
+    typedef void (*TaskFunction)(void *context);
+    typedef void (*LineWriter)(const char *line);
+
+    explicit Scheduler(Clock &clock);
+
+    // Returns the task index, or -1 once SCHEDULER_MAX_TASKS are registered. Call before begin().
+    int addTask(const char *name, TaskFunction function, void *context, uint32_t periodUs, uint8_t priority);
+
+    // The first release of every task is one period from now
+    void begin();
+
+#ifdef NATIVE_BUILD
+    // Runs every released task, highest priority first; returns the time to the next release in us
+    uint32_t runDue();
+#endif
+
+    // From the task itself: its next release is one new period after the call
+    void setPeriod(int task, uint32_t periodUs);
+
+    int getTaskCount() const;
+
+    task_stats getStats(int task) const;
+
+    bool reportDue(uint32_t nowMs) const;
+
+    // One line per task, then starts a new window:
+    //   S,<uptime ms>,<task>,<runs>,<deadline misses>,<overruns>,<jitter p50 us>,<jitter p99 us>,<jitter max us>,<run max us>
+    void report(LineWriter write, uint32_t nowMs);
+
+private:
+    struct Task {
+        const char *name;
+        TaskFunction function;
+        void *context;
+        uint32_t periodUs;
+        uint8_t priority;
+        uint32_t nextReleaseUs;
+        task_stats stats;
+        LatencyHistogram jitterUs; // Start of the run minus its release time
+#ifndef NATIVE_BUILD
+        Scheduler *scheduler;
+        TaskHandle_t handle;
+        esp_timer_handle_t timer;
+#endif
+    };
+
+    Clock &clock;
+    Task tasks[SCHEDULER_MAX_TASKS]; // Sorted by descending priority
+    int taskCount;
+    mutable SpinLock statsLock;
+    uint32_t lastReportMs;
+
+    // Runs the current release of task, after dropping the given number of missed ones
+    void runTask(Task &task, uint32_t droppedReleases);
+
+#ifndef NATIVE_BUILD
+    static void taskLoop(void *param);
+
+    static void onTimer(void *param);
+#endif
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+
+// What a policy needs to know about the frames already sent to one peer
+typedef struct send_state {
+    bool hasSent;
+    struct_message lastSent;
+    unsigned long lastSendTime;
+} send_state;
+
+// Decides when Communication::send actually puts a frame on air. Times are in ms.
+// Policies hold no per-peer data, so one instance serves every peer through its send_state.
+class SendPolicy {
+public:
+    virtual ~SendPolicy() = default;
+
+    virtual bool shouldSend(const send_state &state, const struct_message &data, unsigned long now) const = 0;
+
+    // Called once the frame has been handed to the radio
+    virtual void onSent(send_state &state, const struct_message &data, unsigned long now) const;
+
+protected:
+    static bool changedBeyond(const send_state &state, const struct_message &data, int threshold);
+};
+
+// One frame every interval, whatever the input does (historical behaviour)
+class FixedRatePolicy : public SendPolicy {
+public:
+    explicit FixedRatePolicy(unsigned long interval);
+
+    bool shouldSend(const send_state &state, const struct_message &data, unsigned long now) const override;
+
+private:
+    unsigned long interval;
+};
+
+// Sends as soon as the input moved by more than threshold, at most once per minInterval,
+// and a keepalive when nothing changed for keepaliveInterval
+class OnChangePolicy : public SendPolicy {
+public:
+    OnChangePolicy(int threshold, unsigned long minInterval, unsigned long keepaliveInterval);
+
+    bool shouldSend(const send_state &state, const struct_message &data, unsigned long now) const override;
+
+protected:
+    int threshold;
+    unsigned long minInterval;
+    unsigned long keepaliveInterval;
+};
+
+// On-change sending plus a steady stream every streamInterval while the stick is deflected,
+// so a held command keeps refreshing; falls back to keepalives when centered
+class HybridPolicy : public OnChangePolicy {
+public:
+    HybridPolicy(int threshold, unsigned long minInterval, unsigned long streamInterval,
+                 unsigned long keepaliveInterval);
+
+    bool shouldSend(const send_state &state, const struct_message &data, unsigned long now) const override;
+
+private:
+    unsigned long streamInterval;
+};
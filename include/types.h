@@ -1,8 +1,40 @@
 #pragma once
 
+#include <cstdint>
+
 // Data structure for joystick values
 typedef struct struct_message {
     int x;
     int y;
     bool button;
 } struct_message;
+
+// Raw ADC limits and rest position of both joystick axes
+typedef struct joystick_calibration {
+    int xCenter;
+    int yCenter;
+    int xMin;
+    int xMax;
+    int yMin;
+    int yMax;
+} joystick_calibration;
+
+// Debounced level change of the joystick button
+typedef struct button_edge {
+    uint32_t timeUs;    // micros() when the level changed, before any debounce delay
+    bool pressed;
+} button_edge;
+
+// Button event for the car, see BUTTON_EVENT_* in protocol.h
+typedef struct button_event {
+    uint8_t type;
+    uint32_t timeUs;    // micros() of the edge or, for a long press, of the hold threshold
+} button_event;
+
+// What was heard on one WiFi channel during a survey
+typedef struct channel_survey {
+    uint8_t channel;
+    uint16_t frames;        // Frames heard, from any network
+    uint8_t busyPercent;    // Estimated airtime of those frames over the time listened
+    int8_t noiseFloor;      // dBm, mean over the frames heard, 0 when none was
+} channel_survey;
@@ -0,0 +1,106 @@
+#include <Arduino.h>
+#include "adc_sampler.h"
+#include "event_log.h"
+
+#if JOYSTICK_ADC_DMA
+#include <driver/adc.h>
+#endif
+
+AdcSampler::AdcSampler() :
+        xChannel{0, 0, 0, (JOYSTICK_RAW_MAX / 2) << 8, false},
+        yChannel{0, 0, 0, (JOYSTICK_RAW_MAX / 2) << 8, false} {
+}
+
+bool AdcSampler::begin() {
+    xChannel.adcChannel = digitalPinToAnalogChannel(VRX_PIN);
+    yChannel.adcChannel = digitalPinToAnalogChannel(VRY_PIN);
+
+#if JOYSTICK_ADC_DMA
+    adc_digi_init_config_t initConfig = {};
+    initConfig.max_store_buf_size = ADC_DMA_BUFFER_SIZE;
+    initConfig.conv_num_each_intr = ADC_DMA_FRAME_SIZE;
+    initConfig.adc1_chan_mask = BIT(xChannel.adcChannel) | BIT(yChannel.adcChannel);
+    initConfig.adc2_chan_mask = 0;
+    if (adc_digi_initialize(&initConfig) != ESP_OK) {
+        logEvent(LOG_ADC_INIT_FAILED);
+        return false;
+    }
+
+    adc_digi_pattern_config_t pattern[2] = {};
+    pattern[0].atten = ADC_ATTEN_DB_11;
+    pattern[0].channel = xChannel.adcChannel;
+    pattern[0].unit = 0; // ADC1
+    pattern[0].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    pattern[1] = pattern[0];
+    pattern[1].channel = yChannel.adcChannel;
+
+    adc_digi_configuration_t digiConfig = {};
+    digiConfig.conv_limit_en = 1; // Required on ESP32
+    digiConfig.conv_limit_num = 250;
+    digiConfig.pattern_num = 2;
+    digiConfig.adc_pattern = pattern;
+    digiConfig.sample_freq_hz = ADC_SAMPLE_RATE_HZ;
+    digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    digiConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+    if (adc_digi_controller_configure(&digiConfig) != ESP_OK || adc_digi_start() != ESP_OK) {
+        logEvent(LOG_ADC_START_FAILED);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void AdcSampler::poll() {
+#if JOYSTICK_ADC_DMA
+    uint8_t buffer[ADC_DMA_FRAME_SIZE];
+    uint32_t length = 0;
+
+    // Drain everything the DMA produced since the last call, without waiting for more
+    while (adc_digi_read_bytes(buffer, sizeof(buffer), &length, 0) == ESP_OK && length > 0) {
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            const adc_digi_output_data_t *result = (const adc_digi_output_data_t *) &buffer[i];
+            if (result->type1.channel == xChannel.adcChannel) {
+                addSample(xChannel, result->type1.data);
+            } else if (result->type1.channel == yChannel.adcChannel) {
+                addSample(yChannel, result->type1.data);
+            }
+        }
+    }
+#else
+    filter(xChannel, analogRead(VRX_PIN));
+    filter(yChannel, analogRead(VRY_PIN));
+#endif
+}
+
+int AdcSampler::getX() const {
+    return value(xChannel);
+}
+
+int AdcSampler::getY() const {
+    return value(yChannel);
+}
+
+void AdcSampler::addSample(Channel &channel, uint16_t sample) {
+    // Oversample then decimate, the filter runs at ADC_SAMPLE_RATE_HZ / 2 / ADC_OVERSAMPLE
+    channel.accumulator += sample;
+    if (++channel.count == ADC_OVERSAMPLE) {
+        filter(channel, channel.accumulator / ADC_OVERSAMPLE);
+        channel.accumulator = 0;
+        channel.count = 0;
+    }
+}
+
+void AdcSampler::filter(Channel &channel, uint16_t value) {
+    // First order IIR in Q8: filtered += (value - filtered) / 2^ADC_IIR_SHIFT
+    int32_t target = (int32_t) value << 8;
+    if (!channel.primed) {
+        channel.filtered = target;
+        channel.primed = true;
+    } else {
+        channel.filtered += (target - channel.filtered) >> ADC_IIR_SHIFT;
+    }
+}
+
+int AdcSampler::value(const Channel &channel) {
+    return (channel.filtered + (1 << 7)) >> 8;
+}
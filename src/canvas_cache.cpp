@@ -0,0 +1,137 @@
+#include "canvas_cache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+uint8_t getNibble(const uint8_t *row, int16_t x) {
+    return x & 1 ? row[x >> 1] & 0x0F : row[x >> 1] >> 4;
+}
+
+void setNibble(uint8_t *row, int16_t x, uint8_t index) {
+    uint8_t &pair = row[x >> 1];
+    pair = x & 1 ? (pair & 0xF0) | index : (pair & 0x0F) | (index << 4);
+}
+
+// Pixels x0 to x1 (excluded) of a 4-bit row from src starting at column sx
+void copyNibbles(uint8_t *dst, int16_t x0, int16_t x1, const uint8_t *src, int16_t sx) {
+    if ((x0 ^ sx) & 1) {
+        // Different nibble alignment, nothing to copy whole bytes of
+        for (int16_t x = x0; x < x1; x++, sx++) {
+            setNibble(dst, x, getNibble(src, sx));
+        }
+        return;
+    }
+    if (x0 & 1) {
+        setNibble(dst, x0++, getNibble(src, sx++));
+    }
+    if (x1 & 1 && x0 < x1) {
+        x1--;
+        setNibble(dst, x1, getNibble(src, sx + x1 - x0));
+    }
+    memcpy(dst + (x0 >> 1), src + (sx >> 1), (x1 - x0) >> 1);
+}
+
+}
+
+void blitCanvas(Canvas &target, Canvas &source, int16_t sx, int16_t sy, int16_t w, int16_t h,
+                int16_t x, int16_t y, const canvas_rect &clip) {
+    int16_t x0 = std::max<int16_t>(x, std::max<int16_t>(clip.x, 0));
+    int16_t y0 = std::max<int16_t>(y, std::max<int16_t>(clip.y, 0));
+    int16_t x1 = std::min<int16_t>(x + w, std::min<int16_t>(clip.x + clip.w, target.width()));
+    int16_t y1 = std::min<int16_t>(y + h, std::min<int16_t>(clip.y + clip.h, target.height()));
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    int16_t targetWidth = target.width();
+    int16_t sourceWidth = source.width();
+    if (target.getColorDepth() == 4) {
+        uint8_t *dst = static_cast<uint8_t *>(target.getPointer());
+        const uint8_t *src = static_cast<const uint8_t *>(source.getPointer());
+        for (int16_t row = y0; row < y1; row++) {
+            copyNibbles(dst + row * targetWidth / 2, x0, x1, src + (sy + row - y) * sourceWidth / 2, sx + (x0 - x));
+        }
+        return;
+    }
+
+    uint16_t *dst = static_cast<uint16_t *>(target.getPointer());
+    const uint16_t *src = static_cast<const uint16_t *>(source.getPointer());
+    size_t rowBytes = (x1 - x0) * sizeof(uint16_t);
+    for (int16_t row = y0; row < y1; row++) {
+        memcpy(dst + row * targetWidth + x0, src + (sy + row - y) * sourceWidth + sx + (x0 - x), rowBytes);
+    }
+}
+
+void buildCanvasPalette(const uint16_t *colors, uint8_t count, canvas_palette &palette) {
+    for (int pair = 0; pair < 256; pair++) {
+        uint32_t first = (pair >> 4) < count ? colors[pair >> 4] : 0;
+        uint32_t second = (pair & 0x0F) < count ? colors[pair & 0x0F] : 0;
+        palette.pairs[pair] = first | (second << 16);
+    }
+}
+
+void expandCanvasRow(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, const canvas_palette &palette,
+                     uint16_t *out) {
+    if (canvas.getColorDepth() != 4) {
+        const uint16_t *image = static_cast<const uint16_t *>(canvas.getPointer());
+        memcpy(out, image + sy * canvas.width() + sx, w * sizeof(uint16_t));
+        return;
+    }
+
+    // One table load per byte; a lone pixel uses the entry where both halves are its color
+    const uint8_t *row = static_cast<const uint8_t *>(canvas.getPointer()) + sy * canvas.width() / 2;
+    int16_t x = sx;
+    int16_t end = sx + w;
+    if (x & 1 && x < end) {
+        *out++ = (uint16_t) palette.pairs[(row[x >> 1] & 0x0F) * 0x11];
+        x++;
+    }
+    for (; x + 1 < end; x += 2) {
+        // out is only 2-byte aligned
+        memcpy(out, &palette.pairs[row[x >> 1]], sizeof(uint32_t));
+        out += 2;
+    }
+    if (x < end) {
+        *out = (uint16_t) palette.pairs[(row[x >> 1] >> 4) * 0x11];
+    }
+}
+
+GlyphAtlas::GlyphAtlas() :
+        canvas(nullptr),
+        chars(""),
+        glyphWidth(0),
+        glyphHeight(0) {
+}
+
+void GlyphAtlas::build(Framebuffer &framebuffer, const char *chars, uint8_t textSize, uint16_t color,
+                       uint16_t background) {
+    this->chars = chars;
+    glyphWidth = 6 * textSize;
+    glyphHeight = 8 * textSize;
+    canvas = framebuffer.createCanvas(glyphWidth * strlen(chars), glyphHeight);
+
+    canvas->fillSprite(background);
+    canvas->setTextColor(color);
+    canvas->setTextSize(textSize);
+    for (size_t i = 0; chars[i]; i++) {
+        char glyph[2] = {chars[i], '\0'};
+        canvas->setCursor(i * glyphWidth, 0);
+        canvas->print(glyph);
+    }
+}
+
+int16_t GlyphAtlas::draw(Canvas &target, const char *text, int16_t x, int16_t y, const canvas_rect &clip) const {
+    for (const char *c = text; *c; c++) {
+        const char *glyph = strchr(chars, *c);
+        if (glyph != nullptr) {
+            blitCanvas(target, *canvas, (glyph - chars) * glyphWidth, 0, glyphWidth, glyphHeight, x, y, clip);
+        }
+        x += glyphWidth;
+    }
+    return x;
+}
+
+int16_t GlyphAtlas::getGlyphWidth() const {
+    return glyphWidth;
+}
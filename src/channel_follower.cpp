@@ -0,0 +1,76 @@
+#include "channel_follower.h"
+
+ChannelFollower::ChannelFollower() :
+        channel(CHANNEL_HOME),
+        previous(CHANNEL_HOME),
+        pendingChannel(CHANNEL_HOME),
+        pending(false),
+        probation(false),
+        scanning(false),
+        hasHop(false),
+        lastHop(0),
+        switchTime(0),
+        lastHeard(0),
+        switches(0),
+        fallbacks(0) {
+}
+
+void ChannelFollower::receive(const uint8_t *buffer, size_t length, unsigned long now) {
+    lastHeard = now;
+    probation = false;
+    scanning = false;
+
+    // Announcements are repeated until acknowledged, only the first one of a hop counts
+    channel_frame frame;
+    if (decodeChannelFrame(buffer, length, frame) != DECODE_OK || frame.delay == 0 ||
+        (hasHop && frame.hop == lastHop) || frame.channel < CHANNEL_FIRST || frame.channel > CHANNEL_LAST) {
+        return;
+    }
+    hasHop = true;
+    lastHop = frame.hop;
+    pending = frame.channel != channel;
+    pendingChannel = frame.channel;
+    switchTime = now + frame.delay;
+}
+
+uint8_t ChannelFollower::update(unsigned long now) {
+    if (pending && (long) (now - switchTime) >= 0) {
+        pending = false;
+        previous = channel;
+        channel = pendingChannel;
+        probation = true;
+        lastHeard = now;
+        switches++;
+    }
+
+    if (probation) {
+        if (now - lastHeard >= CHANNEL_FALLBACK_TIMEOUT) {
+            channel = previous;
+            probation = false;
+            lastHeard = now;
+            fallbacks++;
+        }
+    } else if (now - lastHeard >= CHANNEL_LOST_TIMEOUT) {
+        // The transmitter fell back, or moved without this car: the previous channel first, then the next
+        // ones, each listened to for CHANNEL_SCAN_DWELL
+        uint8_t next = scanning || previous == channel ? (channel >= CHANNEL_LAST ? CHANNEL_FIRST : channel + 1)
+                                                       : previous;
+        previous = channel;
+        channel = next;
+        scanning = true;
+        lastHeard = now - CHANNEL_LOST_TIMEOUT + CHANNEL_SCAN_DWELL;
+    }
+    return channel;
+}
+
+uint8_t ChannelFollower::getChannel() const {
+    return channel;
+}
+
+uint32_t ChannelFollower::getSwitches() const {
+    return switches;
+}
+
+uint32_t ChannelFollower::getFallbacks() const {
+    return fallbacks;
+}
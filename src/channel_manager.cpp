@@ -0,0 +1,244 @@
+#include "channel_manager.h"
+#include <algorithm>
+#include <cstdlib>
+
+ChannelManager::ChannelManager() :
+        state(STATE_IDLE),
+        enabled(false),
+        surveyed(false),
+        leaving(false),
+        forced(false),
+        channel(CHANNEL_HOME),
+        previous(CHANNEL_HOME),
+        target(CHANNEL_HOME),
+        hop(0),
+        switchTime(0),
+        nextAttempt(0),
+        acknowledged(0),
+        confirmed(0),
+        window(0),
+        windowSize(0),
+        failureRun(0),
+        abortRun(0),
+        lastDelivered{},
+        scores{},
+        avoidUntil{},
+        avoided{},
+        stats{} {
+}
+
+void ChannelManager::setEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+void ChannelManager::recordSurvey(const channel_survey &survey) {
+    if (survey.channel < CHANNEL_FIRST || survey.channel > CHANNEL_LAST) {
+        return;
+    }
+    int noise = survey.frames > 0 ? std::max(survey.noiseFloor - CHANNEL_NOISE_REFERENCE, 0) : 0;
+    scores[survey.channel] = survey.busyPercent + noise;
+    surveyed = true;
+}
+
+void ChannelManager::recordSend(uint8_t car, bool delivered, unsigned long now) {
+    if (car >= COMS_MAX_PEERS) {
+        return;
+    }
+    if (delivered) {
+        lastDelivered[car] = now;
+    }
+    // Outcomes of the frames still in flight when the radio moved say nothing about the new channel, and
+    // a missing car says nothing about any channel
+    if (state == STATE_CONFIRMING || now - lastDelivered[car] >= CHANNEL_LOST_TIMEOUT) {
+        return;
+    }
+    window = (window << 1) | (delivered ? 1 : 0);
+    windowSize = std::min<uint8_t>(windowSize + 1, CHANNEL_WINDOW);
+    failureRun = delivered ? 0 : std::min<uint8_t>(failureRun + 1, UINT8_MAX);
+}
+
+bool ChannelManager::lossy() const {
+    if (failureRun >= CHANNEL_HOP_BURST) {
+        return true;
+    }
+    uint32_t mask = windowSize >= 32 ? 0xFFFFFFFFu : ((1u << windowSize) - 1);
+    int delivered = __builtin_popcount(window & mask);
+    return windowSize >= CHANNEL_WINDOW && delivered * 100 < CHANNEL_HOP_THRESHOLD * windowSize;
+}
+
+uint32_t ChannelManager::presentCars(unsigned long now, uint8_t cars) const {
+    uint32_t present = 0;
+    for (uint8_t car = 0; car < std::min<uint8_t>(cars, COMS_MAX_PEERS); car++) {
+        if (now - lastDelivered[car] < CHANNEL_LOST_TIMEOUT) {
+            present |= 1u << car;
+        }
+    }
+    return present;
+}
+
+bool ChannelManager::update(unsigned long now, uint8_t cars, uint8_t &newChannel) {
+    uint32_t everyCar = presentCars(now, cars);
+
+    if (state == STATE_IDLE) {
+        if (everyCar == 0 || (long) (now - nextAttempt) < 0) {
+            return false;
+        }
+        // The scores only describe the channels at boot, so the move to a quieter one happens once
+        leaving = enabled && lossy();
+        uint8_t candidate = pickChannel(now, leaving);
+        bool quieter = surveyed && candidate != 0 && scores[candidate] + CHANNEL_SURVEY_MARGIN <= scores[channel];
+        if (candidate == 0 || (!leaving && !quieter)) {
+            surveyed = false;
+            return false;
+        }
+        if (leaving) {
+            avoid(channel, now);
+        }
+        target = candidate;
+        forced = false;
+        hop++;
+        switchTime = now + CHANNEL_SWITCH_DELAY;
+        acknowledged = 0;
+        confirmed = 0;
+        state = STATE_ANNOUNCING;
+        return false;
+    }
+
+    if (state == STATE_ANNOUNCING) {
+        if ((long) (now - switchTime) < 0) {
+            return false;
+        }
+        if ((acknowledged & everyCar) != everyCar) {
+            // The cars that got the announcement come back on their own after the fallback timeout. The
+            // current channel is no better than before, so the next attempts start right away.
+            stats.aborted++;
+            if (++abortRun < CHANNEL_ABORT_RETRIES) {
+                state = STATE_IDLE;
+                return false;
+            }
+            abortRun = 0;
+            if (!leaving) {
+                nextAttempt = now + CHANNEL_HOP_HOLDOFF;
+                state = STATE_IDLE;
+                return false;
+            }
+            // Too lossy to get the announcement through: go anyway, the cars left behind lose the
+            // transmitter and find it by scanning
+            forced = true;
+            stats.forced++;
+        }
+        abortRun = 0;
+        newChannel = startSwitch();
+        return true;
+    }
+
+    // Confirming: every car must be heard on the new channel within the fallback timeout
+    surveyed = false;
+    if ((confirmed & everyCar) == everyCar) {
+        stats.hops++;
+        nextAttempt = now + CHANNEL_HOP_HOLDOFF;
+        state = STATE_IDLE;
+        return false;
+    }
+    if (now - switchTime < CHANNEL_FALLBACK_TIMEOUT) {
+        return false;
+    }
+    if (forced) {
+        // The missing cars are scanning, their failed sends must not move the others again
+        for (uint8_t car = 0; car < std::min<uint8_t>(cars, COMS_MAX_PEERS); car++) {
+            if (!(confirmed & (1u << car))) {
+                lastDelivered[car] = now - CHANNEL_LOST_TIMEOUT;
+            }
+        }
+        stats.hops++;
+        nextAttempt = now + CHANNEL_HOP_HOLDOFF;
+        state = STATE_IDLE;
+        return false;
+    }
+    stats.fallbacks++;
+    avoid(channel, now);
+    channel = previous;
+    resetWindow();
+    nextAttempt = now + CHANNEL_HOP_HOLDOFF;
+    state = STATE_IDLE;
+    newChannel = channel;
+    return true;
+}
+
+bool ChannelManager::frameFor(uint8_t car, unsigned long now, channel_frame &frame) const {
+    uint32_t bit = 1u << car;
+    if (state == STATE_ANNOUNCING && !(acknowledged & bit)) {
+        long delay = (long) (switchTime - now);
+        frame = {hop, target, (uint8_t) std::min<long>(std::max<long>(delay, 1), UINT8_MAX)};
+        return true;
+    }
+    if (state == STATE_CONFIRMING && !(confirmed & bit)) {
+        // Heard on the new channel, so the car keeps it even if the stick is quiet
+        frame = {hop, channel, 0};
+        return true;
+    }
+    return false;
+}
+
+void ChannelManager::acknowledge(uint8_t car, const channel_frame &frame) {
+    if (frame.hop != hop) {
+        return;
+    }
+    if (state == STATE_ANNOUNCING && frame.delay > 0) {
+        acknowledged |= 1u << car;
+    } else if (state == STATE_CONFIRMING && frame.delay == 0) {
+        confirmed |= 1u << car;
+    }
+}
+
+uint8_t ChannelManager::startSwitch() {
+    previous = channel;
+    channel = target;
+    resetWindow();
+    state = STATE_CONFIRMING;
+    return channel;
+}
+
+uint8_t ChannelManager::pickChannel(unsigned long now, bool leavingForLoss) const {
+    uint8_t best = 0;
+    int bestScore = 0;
+    for (uint8_t candidate = CHANNEL_FIRST; candidate <= CHANNEL_LAST; candidate++) {
+        if (candidate == channel || (avoided[candidate] && (long) (now - avoidUntil[candidate]) < 0)) {
+            continue;
+        }
+        // Interference that hit the current channel spreads over the four channels on each side
+        int distance = std::abs(candidate - channel);
+        int score = scores[candidate] + (leavingForLoss && distance < 5 ? CHANNEL_OVERLAP_PENALTY : 0);
+        if (best == 0 || score < bestScore ||
+            (score == bestScore && distance > std::abs(best - channel))) {
+            best = candidate;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+void ChannelManager::avoid(uint8_t channel, unsigned long now) {
+    avoided[channel] = true;
+    avoidUntil[channel] = now + CHANNEL_AVOID_TIME;
+}
+
+void ChannelManager::resetWindow() {
+    window = 0;
+    windowSize = 0;
+    failureRun = 0;
+}
+
+uint8_t ChannelManager::getChannel() const {
+    return channel;
+}
+
+int ChannelManager::getScore(uint8_t channel) const {
+    return channel >= CHANNEL_FIRST && channel <= CHANNEL_LAST ? scores[channel] : 0;
+}
+
+channel_stats ChannelManager::getStats() const {
+    channel_stats result = stats;
+    result.channel = channel;
+    return result;
+}
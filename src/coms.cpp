@@ -1,77 +1,562 @@
 #include "coms.h"
-#include "secrets.h" // Contains RECEIVER_MAC_ADDRESS
+#include "event_log.h"
+#include <algorithm>
+#include <cstring>
 
-Communication *Communication::instance = nullptr;
+namespace {
+
+const uint8_t BROADCAST_ADDRESS[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+const struct_message NEUTRAL_STICK = {0, 0, false};
 
-Communication::Communication() :
-        connected(false),
-        signalStrength(0),
-        lastSignalUpdate(0),
-        lastSendTime(0) {
-    instance = this;
+}
+
+Communication::Communication(Radio &radio, Clock &clock) :
+        radio(radio),
+        clock(clock),
+        peers{},
+        peerCount(0),
+        broadcastPeer{},
+        broadcast(false),
+        primaryKey(nullptr),
+        localKey(nullptr),
+        frameAuthentication(false),
+        signer(),
+        target(TARGET_ALL),
+        historyDepth(FRAME_HISTORY_DEPTH),
+        radioPeers{},
+        completions{},
+        verifiers(),
+        linkEvents(),
+        defaultPolicy(SEND_INTERVAL),
+        sendPolicy(&defaultPolicy),
+        packetsSent(0),
+        framesSent(0),
+        firstFrameTime(0),
+        packetsPerSecond(0),
+        lastRateTime(0),
+        probeInterval(RTT_PROBE_INTERVAL),
+        lastProbeTime(0),
+        nextProbePeer(0),
+        rttWindowStart(0),
+        buttonStats{},
+        buttonLatency(),
+        channels(),
+        statsLock() {
 }
 
 bool Communication::begin() {
-    // Initialize WiFi
-    WiFi.mode(WIFI_STA);
+    radio.setCallbacks(onRadioSent, onRadioRssi, onRadioReceive, this);
+    return radio.begin() && radio.setChannel(channels.getChannel()) &&
+           (primaryKey == nullptr || radio.setPrimaryKey(primaryKey)) &&
+           registerPeer(broadcastPeer, BROADCAST_ADDRESS, nullptr);
+}
 
-    // Initialize ESP-NOW
-    if (esp_now_init() != ESP_OK) {
-        Serial.println("ESP-NOW init failed");
-        return false;
+int Communication::addPeer(const uint8_t *address) {
+    if (peerCount >= COMS_MAX_PEERS || !registerPeer(peers[peerCount], address, localKey)) {
+        return -1;
     }
+    return peerCount++;
+}
 
-    esp_now_register_send_cb(onSendCallback);
-
-    // Register peer
-    memcpy(peerInfo.peer_addr, RECEIVER_MAC_ADDRESS, 6);
-    peerInfo.channel = 0;
-    peerInfo.encrypt = false;
-
-    if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-        Serial.println("Failed to add peer");
+bool Communication::registerPeer(Peer &peer, const uint8_t *address, const uint8_t *key) {
+    int radioPeer = radio.addPeer(address, key);
+    if (radioPeer < 0 || radioPeer >= RADIO_MAX_PEERS) {
         return false;
     }
-
-    Serial.println("ESP-NOW communication initialized");
+    peer.radioPeer = radioPeer;
+    radioPeers[radioPeer] = &peer;
     return true;
 }
 
-void Communication::onSendCallback(const uint8_t *mac_addr, esp_now_send_status_t status) {
-    if (instance) {
-        instance->connected = (status == ESP_NOW_SEND_SUCCESS);
+void Communication::onRadioSent(void *context, uint8_t peer, bool delivered) {
+    Communication *self = static_cast<Communication *>(context);
+    if (peer >= RADIO_MAX_PEERS) {
+        return;
+    }
+    uint16_t sequence = self->completions[peer].fetch_add(1, std::memory_order_relaxed);
+    LinkEvent event = {self->clock.micros(), 0, sequence, peer, EVENT_SEND_DONE, (int8_t) delivered};
+    if (!self->linkEvents.push(event)) {
+        logEvent(LOG_LINK_EVENTS_DROPPED, peer);
+    }
+}
 
-        // Update signal strength based on success/failure
-        if (millis() - instance->lastSignalUpdate > SIGNAL_UPDATE_INTERVAL) {
-            if (instance->connected) {
-                if (instance->signalStrength < MAX_SIGNAL_STRENGTH)
-                    instance->signalStrength++;
-            } else {
-                if (instance->signalStrength > 0)
-                    instance->signalStrength--;
+void Communication::onRadioRssi(void *context, uint8_t peer, int8_t rssi) {
+    Communication *self = static_cast<Communication *>(context);
+    LinkEvent event = {self->clock.micros(), 0, 0, peer, EVENT_RSSI, rssi};
+    if (!self->linkEvents.push(event)) {
+        logEvent(LOG_LINK_EVENTS_DROPPED, peer);
+    }
+}
+
+void Communication::onRadioReceive(void *context, uint8_t peer, const uint8_t *data, size_t length) {
+    Communication *self = static_cast<Communication *>(context);
+    uint32_t now = self->clock.micros();
+    if (self->frameAuthentication) {
+        // Forged, replayed and unsigned frames stop here
+        length = peer < RADIO_MAX_PEERS ? self->verifiers[peer].verify(data, length) : 0;
+        if (length == 0) {
+            return;
+        }
+    }
+    probe_frame echo;
+    if (decodeProbeFrame(data, length, echo) != DECODE_OK || echo.type != FRAME_TYPE_ECHO) {
+        return;
+    }
+    LinkEvent event = {now, echo.timestamp, echo.sequence, peer, EVENT_ECHO, 0};
+    if (!self->linkEvents.push(event)) {
+        logEvent(LOG_LINK_EVENTS_DROPPED, peer);
+    }
+}
+
+void Communication::drainLinkEvents() {
+    LinkEvent event;
+    while (linkEvents.pop(event)) {
+        Peer *peer = event.peer < RADIO_MAX_PEERS ? radioPeers[event.peer] : nullptr;
+        if (peer == nullptr) {
+            continue;
+        }
+        if (event.type == EVENT_SEND_DONE) {
+            peer->connected = event.value != 0;
+            peer->linkMonitor.recordSend(peer->connected);
+            peer->linkMonitor.recordAckLatency(
+                    event.timestamp - peer->sendTimes[event.sequence & (LINK_EVENT_RING_SIZE - 1)]);
+            if (peer->buttonInFlight && event.sequence == peer->buttonSendIndex) {
+                completeButton(*peer, event.value != 0, event.timestamp);
             }
-            instance->lastSignalUpdate = millis();
+            // Broadcasts always complete as delivered, they say nothing about the channel
+            if (peer != &broadcastPeer) {
+                channels.recordSend((uint8_t) (peer - peers), event.value != 0, clock.millis());
+            }
+            if (peer->channelInFlight && event.sequence == peer->channelSendIndex) {
+                peer->channelInFlight = false;
+                if (event.value != 0) {
+                    channels.acknowledge((uint8_t) (peer - peers), peer->channelFrame);
+                }
+            }
+        } else if (event.type == EVENT_ECHO) {
+            // Only the first echo of a probe still outstanding counts, duplicates and strays are ignored
+            uint16_t age = (uint16_t) (peer->probeSequence - 1 - event.sequence);
+            if (age < 32 && (peer->pendingProbes & (1UL << age))) {
+                peer->pendingProbes &= ~(1UL << age);
+                peer->rtt.record(event.timestamp - event.probeTime);
+            }
+        } else {
+            peer->linkMonitor.recordRssi(event.value, clock.millis());
         }
     }
+
+    uint32_t now = clock.micros();
+    for (int i = 0; i < peerCount; i++) {
+        expireSends(peers[i], now);
+    }
+    expireSends(broadcastPeer, now);
 }
 
 bool Communication::send(const struct_message &data) {
-    if (millis() - lastSendTime < SEND_INTERVAL) {
-        return true; // Not time to send yet
+    drainLinkEvents();
+
+    unsigned long now = clock.millis();
+    if (now - lastRateTime >= 1000) {
+        packetsPerSecond = packetsSent;
+        packetsSent = 0;
+        lastRateTime = now;
+    }
+    if (now - rttWindowStart >= RTT_WINDOW) {
+        rollRttWindow(now);
+    }
+
+    // A channel switch and the retries of button events go out before the stick
+    serviceChannel(now);
+    serviceButtons();
+
+    // Pick the peers that get a frame this tick and encode them all before touching the radio
+    struct Outgoing {
+        Peer *peer;
+        const struct_message *data;
+        uint8_t buffer[HISTORY_FRAME_MAX_SIZE];
+        size_t length;
+    };
+    Outgoing batch[COMS_MAX_PEERS];
+    int batchSize = 0;
+
+    bool broadcastAll = broadcast && target == TARGET_ALL;
+    for (int i = 0; i < (broadcastAll ? 1 : peerCount); i++) {
+        Peer &peer = broadcastAll ? broadcastPeer : peers[i];
+        const struct_message &input = broadcastAll || target == TARGET_ALL || target == i ? data : NEUTRAL_STICK;
+        if (!sendPolicy->shouldSend(peer.sendState, input, now)) {
+            continue;
+        }
+
+        control_frame frame;
+        frame.sequence = peer.txSequence++;
+        frame.timestamp = (uint16_t) now;
+        frame.x = (int16_t) std::min(std::max(input.x, INT16_MIN), INT16_MAX);
+        frame.y = (int16_t) std::min(std::max(input.y, INT16_MIN), INT16_MAX);
+        frame.buttons = input.button ? BUTTON_MAIN : 0;
+
+        // Keep the newest samples for the next frames' history
+        std::copy_backward(peer.recent, peer.recent + HISTORY_MAX_SAMPLES - 1, peer.recent + HISTORY_MAX_SAMPLES);
+        peer.recent[0] = frame;
+        peer.recentCount = std::min(peer.recentCount + 1, HISTORY_MAX_SAMPLES);
+
+        Outgoing &outgoing = batch[batchSize++];
+        outgoing.peer = &peer;
+        outgoing.data = &input;
+        if (historyDepth == 0) {
+            outgoing.length = encodeControlFrame(frame, outgoing.buffer, sizeof(outgoing.buffer));
+        } else {
+            uint8_t count = std::min<uint8_t>(peer.recentCount, historyDepth + 1);
+            outgoing.length = encodeHistoryFrame(peer.recent, count, outgoing.buffer, sizeof(outgoing.buffer));
+        }
     }
 
-    bool result = (esp_now_send(peerInfo.peer_addr, (uint8_t *) &data, sizeof(data)) == ESP_OK);
-    if (!result) {
-        Serial.println("Send Failed");
+    bool result = true;
+    for (int i = 0; i < batchSize; i++) {
+        Outgoing &outgoing = batch[i];
+        Peer &peer = *outgoing.peer;
+        if (sendFrame(peer, outgoing.buffer, outgoing.length)) {
+            if (framesSent++ == 0) {
+                firstFrameTime = now;
+            }
+        } else {
+            result = false;
+        }
+        sendPolicy->onSent(peer.sendState, *outgoing.data, now);
+    }
+
+    // Probes go after the control frames, they never delay them
+    if (probeInterval > 0 && peerCount > 0 && now - lastProbeTime >= probeInterval) {
+        lastProbeTime = now;
+        if (target != TARGET_ALL) {
+            sendProbe(peers[target]);
+        } else {
+            sendProbe(peers[nextProbePeer]);
+            nextProbePeer = (nextProbePeer + 1) % peerCount;
+        }
     }
-    lastSendTime = millis();
     return result;
 }
 
+bool Communication::sendFrame(Peer &peer, const uint8_t *data, size_t length) {
+    uint8_t signedFrame[HISTORY_FRAME_MAX_SIZE + FRAME_AUTH_SIZE];
+    if (frameAuthentication) {
+        // Signed in a copy, so the encoders need no room for the trailer
+        memcpy(signedFrame, data, std::min(length, sizeof(signedFrame)));
+        length = signer.sign(signedFrame, length, sizeof(signedFrame));
+        if (length == 0) {
+            peer.sendErrors++;
+            logEvent(LOG_SIGNER_EXHAUSTED);
+            return false;
+        }
+        data = signedFrame;
+    }
+
+    // Stamped before sending, the completion callback can fire before radio.send returns
+    peer.sendTimes[peer.acceptedSends & (LINK_EVENT_RING_SIZE - 1)] = clock.micros();
+    if (!radio.send(peer.radioPeer, data, length)) {
+        peer.sendErrors++;
+        logEvent(LOG_SEND_FAILED, peer.radioPeer);
+        return false;
+    }
+    peer.acceptedSends++;
+    packetsSent++;
+    return true;
+}
+
+void Communication::sendProbe(Peer &peer) {
+    probe_frame probe = {FRAME_TYPE_PROBE, peer.probeSequence, clock.micros()};
+    uint8_t buffer[PROBE_FRAME_SIZE];
+    size_t length = encodeProbeFrame(probe, buffer, sizeof(buffer));
+    if (sendFrame(peer, buffer, length)) {
+        peer.probeSequence++;
+        peer.pendingProbes = (peer.pendingProbes << 1) | 1;
+        peer.windowProbes++;
+    }
+}
+
+void Communication::sendButtonEvent(const button_event &event) {
+    drainLinkEvents();
+    for (int i = 0; i < peerCount; i++) {
+        if (target != TARGET_ALL && target != i) {
+            continue;
+        }
+        Peer &peer = peers[i];
+        bool full = peer.buttonCount == BUTTON_EVENT_QUEUE_SIZE;
+        statsLock.lock();
+        buttonStats.events++;
+        buttonStats.dropped += full ? 1 : 0;
+        statsLock.unlock();
+        if (full) {
+            logEvent(LOG_BUTTON_DROPPED, event.type, peer.radioPeer);
+            continue;
+        }
+        peer.buttonQueue[(peer.buttonHead + peer.buttonCount++) & (BUTTON_EVENT_QUEUE_SIZE - 1)] = event;
+    }
+    serviceButtons();
+}
+
+void Communication::serviceButtons() {
+    for (int i = 0; i < peerCount; i++) {
+        Peer &peer = peers[i];
+        if (peer.buttonCount == 0 || peer.buttonInFlight) {
+            continue;
+        }
+
+        const button_event &event = peer.buttonQueue[peer.buttonHead];
+        button_frame frame = {event.type, peer.buttonSequence, (uint16_t) (event.timeUs / 1000),
+                              (uint8_t) std::min<int>(peer.buttonAttempts, UINT8_MAX)};
+        uint8_t buffer[BUTTON_FRAME_SIZE];
+        size_t length = encodeButtonFrame(frame, buffer, sizeof(buffer));
+        uint16_t sendIndex = peer.acceptedSends;
+        if (sendFrame(peer, buffer, length)) {
+            peer.buttonInFlight = true;
+            peer.buttonSendIndex = sendIndex;
+            peer.buttonSentUs = peer.sendTimes[sendIndex & (LINK_EVENT_RING_SIZE - 1)];
+        } else {
+            // Refused by the radio, counts as a failed attempt and is retried on the next tick
+            completeButton(peer, false, clock.micros());
+        }
+    }
+}
+
+void Communication::completeButton(Peer &peer, bool delivered, uint32_t now) {
+    peer.buttonInFlight = false;
+    if (delivered) {
+        statsLock.lock();
+        buttonStats.delivered++;
+        buttonLatency.record(now - peer.buttonQueue[peer.buttonHead].timeUs);
+        statsLock.unlock();
+    } else if (++peer.buttonAttempts < BUTTON_MAX_ATTEMPTS) {
+        statsLock.lock();
+        buttonStats.retries++;
+        statsLock.unlock();
+        return;
+    } else {
+        statsLock.lock();
+        buttonStats.dropped++;
+        statsLock.unlock();
+        logEvent(LOG_BUTTON_DROPPED, peer.buttonQueue[peer.buttonHead].type, peer.radioPeer);
+    }
+    peer.buttonHead = (peer.buttonHead + 1) & (BUTTON_EVENT_QUEUE_SIZE - 1);
+    peer.buttonCount--;
+    peer.buttonSequence++;
+    peer.buttonAttempts = 0;
+}
+
+button_stats Communication::getButtonStats() const {
+    statsLock.lock();
+    button_stats stats = buttonStats;
+    LatencyHistogram latency = buttonLatency;
+    statsLock.unlock();
+    stats.p50Us = latency.percentile(500);
+    stats.p99Us = latency.percentile(990);
+    stats.maxUs = latency.getMax();
+    return stats;
+}
+
+void Communication::serviceChannel(unsigned long now) {
+    uint8_t channel;
+    statsLock.lock();
+    bool switching = channels.update(now, (uint8_t) peerCount, channel);
+    statsLock.unlock();
+    if (switching) {
+        radio.setChannel(channel);
+        logEvent(LOG_CHANNEL_SWITCH, channel);
+    }
+    for (int i = 0; i < peerCount; i++) {
+        Peer &peer = peers[i];
+        channel_frame frame;
+        if (peer.channelInFlight || !channels.frameFor((uint8_t) i, now, frame)) {
+            continue;
+        }
+        uint8_t buffer[CHANNEL_FRAME_SIZE];
+        size_t length = encodeChannelFrame(frame, buffer, sizeof(buffer));
+        uint16_t sendIndex = peer.acceptedSends;
+        if (sendFrame(peer, buffer, length)) {
+            peer.channelInFlight = true;
+            peer.channelSendIndex = sendIndex;
+            peer.channelSentUs = peer.sendTimes[sendIndex & (LINK_EVENT_RING_SIZE - 1)];
+            peer.channelFrame = frame;
+        }
+    }
+}
+
+void Communication::expireSends(Peer &peer, uint32_t now) {
+    std::atomic<uint16_t> &reported = completions[peer.radioPeer];
+    uint16_t next = reported.load(std::memory_order_relaxed);
+    int16_t outstanding = (int16_t) (peer.acceptedSends - next);
+    if (outstanding < 0) {
+        // The late completion of a frame given up on, the count goes back in step
+        reported.fetch_add((uint16_t) outstanding, std::memory_order_relaxed);
+    } else if (outstanding > 0 &&
+               now - peer.sendTimes[(uint16_t) (peer.acceptedSends - 1) & (LINK_EVENT_RING_SIZE - 1)] >=
+               LINK_SEND_TIMEOUT_US) {
+        // Even the newest frame should be reported by now: the callbacks of some never came, and the
+        // completions since then were counted against earlier frames. A callback counted meanwhile
+        // makes the exchange fail, the next pass tries again.
+        reported.compare_exchange_strong(next, peer.acceptedSends, std::memory_order_relaxed);
+    }
+
+    // Also covers a completion reported but dropped with the ring full
+    if (peer.buttonInFlight && now - peer.buttonSentUs >= LINK_SEND_TIMEOUT_US) {
+        completeButton(peer, false, now);
+    }
+    if (peer.channelInFlight && now - peer.channelSentUs >= LINK_SEND_TIMEOUT_US) {
+        peer.channelInFlight = false;
+    }
+}
+
+bool Communication::hasPendingSends() const {
+    for (int i = 0; i < peerCount; i++) {
+        if (completions[peers[i].radioPeer].load(std::memory_order_relaxed) != peers[i].acceptedSends) {
+            return true;
+        }
+    }
+    return completions[broadcastPeer.radioPeer].load(std::memory_order_relaxed) != broadcastPeer.acceptedSends;
+}
+
+void Communication::surveyChannels(uint32_t dwell) {
+    for (uint8_t channel = CHANNEL_FIRST; channel <= CHANNEL_LAST; channel++) {
+        channel_survey survey;
+        if (radio.survey(channel, dwell, survey)) {
+            channels.recordSurvey(survey);
+        }
+    }
+}
+
+void Communication::setChannelHopping(bool enabled) {
+    channels.setEnabled(enabled);
+}
+
+channel_stats Communication::getChannelStats() const {
+    statsLock.lock();
+    channel_stats stats = channels.getStats();
+    statsLock.unlock();
+    return stats;
+}
+
+void Communication::rollRttWindow(unsigned long now) {
+    for (int i = 0; i < peerCount; i++) {
+        Peer &peer = peers[i];
+        peer.lastRtt = {peer.windowProbes, peer.rtt.getCount(), peer.rtt.percentile(500), peer.rtt.percentile(990),
+                        peer.rtt.getMax()};
+        peer.rtt.reset();
+        peer.windowProbes = 0;
+    }
+    rttWindowStart = now;
+}
+
+void Communication::setProbeInterval(uint32_t interval) {
+    probeInterval = interval;
+}
+
+rtt_stats Communication::getRttStats() const {
+    if (target != TARGET_ALL) {
+        return peers[target].lastRtt;
+    }
+    rtt_stats worst = {};
+    for (int i = 0; i < peerCount; i++) {
+        if (peers[i].lastRtt.echoes > 0 && (worst.echoes == 0 || peers[i].lastRtt.p99Us > worst.p99Us)) {
+            worst = peers[i].lastRtt;
+        }
+    }
+    return worst;
+}
+
+rtt_stats Communication::getRttStats(int peer) const {
+    return peers[peer].lastRtt;
+}
+
+void Communication::setHistoryDepth(uint8_t depth) {
+    historyDepth = std::min<uint8_t>(depth, HISTORY_MAX_SAMPLES - 1);
+}
+
+void Communication::setBroadcast(bool enabled) {
+    broadcast = enabled && localKey == nullptr;
+}
+
+void Communication::setEncryption(const uint8_t *primaryKey, const uint8_t *localKey) {
+    this->primaryKey = primaryKey;
+    this->localKey = localKey;
+    broadcast = broadcast && localKey == nullptr;
+}
+
+void Communication::setFrameAuthentication(const uint8_t *key, uint16_t epoch) {
+    signer.begin(key, epoch, false);
+    for (FrameVerifier &verifier : verifiers) {
+        verifier.begin(key, true);
+    }
+    frameAuthentication = true;
+}
+
+void Communication::setTarget(int target) {
+    this->target = target >= 0 && target < peerCount ? target : TARGET_ALL;
+}
+
+int Communication::getTarget() const {
+    return target;
+}
+
+void Communication::selectNextTarget() {
+    setTarget(target + 1);
+}
+
+int Communication::getPeerCount() const {
+    return peerCount;
+}
+
+void Communication::setSendPolicy(SendPolicy *policy) {
+    sendPolicy = policy != nullptr ? policy : &defaultPolicy;
+}
+
+uint32_t Communication::getPacketsPerSecond() const {
+    return packetsPerSecond;
+}
+
+uint32_t Communication::getFramesSent() const {
+    return framesSent;
+}
+
+unsigned long Communication::getFirstFrameTime() const {
+    return firstFrameTime;
+}
+
 int Communication::getSignalStrength() const {
-    return signalStrength;
+    unsigned long now = clock.millis();
+    if (target != TARGET_ALL) {
+        return peers[target].linkMonitor.getLevel(now);
+    }
+    if (broadcast) {
+        // Broadcasts are not acknowledged, the bars only reflect local send failures
+        return broadcastPeer.linkMonitor.getLevel(now);
+    }
+    int weakest = peerCount > 0 ? MAX_SIGNAL_STRENGTH : 0;
+    for (int i = 0; i < peerCount; i++) {
+        weakest = std::min(weakest, (int) peers[i].linkMonitor.getLevel(now));
+    }
+    return weakest;
+}
+
+link_stats Communication::getLinkStats(int peer) const {
+    const Peer &entry = peers[peer];
+    link_stats stats = entry.linkMonitor.getStats(clock.millis());
+    stats.sendErrors = entry.sendErrors;
+    stats.eventsDropped = linkEvents.getDropped();
+    stats.rejected = verifiers[entry.radioPeer].getRejected();
+    return stats;
 }
 
 bool Communication::isConnected() const {
+    if (target != TARGET_ALL) {
+        return peers[target].connected;
+    }
+    if (broadcast) {
+        return broadcastPeer.connected;
+    }
+    bool connected = peerCount > 0;
+    for (int i = 0; i < peerCount; i++) {
+        connected = connected && peers[i].connected;
+    }
     return connected;
 }
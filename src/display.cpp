@@ -1,211 +1,455 @@
 #include "display.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Direction indicator triangles in joystickSprite coordinates, in the bit order of directionMask()
+struct Triangle {
+    int16_t x0, y0, x1, y1, x2, y2;
+};
+
+const Triangle DIRECTION_TRIANGLES[] = {
+        {120, 10, 115, 20, 125, 20}, // Forward
+        {120, 74, 115, 64, 125, 64}, // Backward
+        {70, 42, 80, 37, 80, 47},    // Left
+        {170, 42, 160, 37, 160, 47}, // Right
+        {90, 20, 95, 15, 100, 25},   // Forward-Left
+        {150, 20, 145, 15, 140, 25}, // Forward-Right
+        {90, 64, 95, 69, 100, 59},   // Backward-Left
+        {150, 64, 145, 69, 140, 59}, // Backward-Right
+};
+const int NUM_DIRECTION_TRIANGLES = sizeof(DIRECTION_TRIANGLES) / sizeof(DIRECTION_TRIANGLES[0]);
+
+// Area covered by the speed value (size 2 digits followed by " %")
+const int16_t SPEED_VALUE_X = 180;
+const int16_t SPEED_VALUE_Y = 50;
+const int16_t SPEED_VALUE_W = DISPLAY_WIDTH - SPEED_VALUE_X;
+const int16_t SPEED_VALUE_H = 16;
+
+// Footer text positions, right after the "MODE: " and "CAR: " labels
+const int16_t FOOTER_MODE_X = 10 + 6 * 6;
+const int16_t FOOTER_TARGET_X = 140 + 5 * 6;
+const int16_t FOOTER_TEXT_Y = 8;
+
+const char *const SPEED_DIGITS = "-0123456789";
+const char *const SPEED_UNIT = " %";
+const char *const FOOTER_CHARS = " ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789/-";
+const char *const HEADER_CHARS = " RTMS0123456789./-";
+
+// Round trip readout, right of the signal bars
+const int16_t HEADER_RTT_X = 124;
+const int16_t HEADER_TEXT_Y = 8;
 
-Display::Display() :
-    tft(),
-    headerSprite(&tft),
-    joystickSprite(&tft),
-    footerSprite(&tft),
-    lastUpdateTime(0)
+}
+
+Display::Display(Framebuffer &framebuffer, Clock &clock) :
+    framebuffer(framebuffer),
+    clock(clock),
+    headerSprite(nullptr),
+    joystickSprite(nullptr),
+    footerSprite(nullptr),
+    headerLayer(nullptr),
+    joystickLayer(nullptr),
+    footerLayer(nullptr),
+    speedDigits(),
+    speedUnit(),
+    footerText(),
+    headerText(),
+    running(false),
+#ifndef NATIVE_BUILD
+    renderTaskHandle(nullptr),
+#endif
+    stateLock(),
+    pendingState{},
+    statePending(false),
+    backlight(BACKLIGHT_FULL),
+    backlightApplied(BACKLIGHT_FULL),
+    frameValid(false),
+    lastState{},
+    stats{},
+    pixelsPushed(0),
+    pushTimeUs(0),
+    lastStatsTime(0)
 {
-    // Constructor body - no need to assign sprites here anymore
 }
 
 
 void Display::begin() {
-    // Initialize TFT
-    tft.init();
-    tft.setRotation(1); // Landscape
-    tft.fillScreen(TFT_BLACK);
+#ifdef NATIVE_BUILD
+    startup();
+#else
+    // Screen init and the boot animation run in the display task, so setup() returns right away
+    xTaskCreatePinnedToCore(renderTask, "display", DISPLAY_TASK_STACK_SIZE, this,
+                            DISPLAY_TASK_PRIORITY, &renderTaskHandle, DISPLAY_TASK_CORE);
+#endif
+}
+
+void Display::startup() {
+    framebuffer.begin();
 
     // Create sprites
-    headerSprite.createSprite(DISPLAY_WIDTH, HEADER_HEIGHT);
-    joystickSprite.createSprite(DISPLAY_WIDTH, JOYSTICK_AREA_HEIGHT);
-    footerSprite.createSprite(DISPLAY_WIDTH, FOOTER_HEIGHT);
+    headerSprite = framebuffer.createCanvas(DISPLAY_WIDTH, HEADER_HEIGHT);
+    joystickSprite = framebuffer.createCanvas(DISPLAY_WIDTH, JOYSTICK_AREA_HEIGHT);
+    footerSprite = framebuffer.createCanvas(DISPLAY_WIDTH, FOOTER_HEIGHT);
+    buildStaticLayers();
 
     // Draw initial screen
     drawBootScreen();
-    delay(2000);
+#if !FAST_BOOT
+    clock.delay(2000);
+#endif
+
+    // States published from here on are rendered
+    running = true;
 }
 
 void Display::drawBootScreen() {
-    tft.fillScreen(TFT_BLACK);
-    tft.setTextColor(COLOR_GREEN);
+    // The boot text fits in the joystick area, header and footer stay black
+    headerSprite->fillSprite(PEN_BLACK);
+    footerSprite->fillSprite(PEN_BLACK);
+    framebuffer.startFrame();
+    pushRegion(*headerSprite, 0, {0, 0, DISPLAY_WIDTH, HEADER_HEIGHT});
+    pushRegion(*footerSprite, HEADER_HEIGHT + JOYSTICK_AREA_HEIGHT, {0, 0, DISPLAY_WIDTH, FOOTER_HEIGHT});
+    framebuffer.endFrame();
+
+    joystickSprite->setTextColor(PEN_GREEN);
 
     for (int i = 0; i < 10; i++) {
-        tft.fillScreen(TFT_BLACK);
-        tft.setCursor(10, 30);
-        tft.setTextSize(1);
-        tft.println("NAZGHUL INDUSTRIES.");
-        tft.setCursor(10, 50);
-        tft.println("REMOTE CONTROL SYSTEM");
-        tft.setCursor(10, 70);
-        tft.println("INITIALIZING...");
-        tft.setCursor(10, 90);
-        tft.print("PROGRESS: [");
+        joystickSprite->fillSprite(PEN_BLACK);
+        joystickSprite->setCursor(10, 30 - HEADER_HEIGHT);
+        joystickSprite->setTextSize(1);
+        joystickSprite->println("NAZGHUL INDUSTRIES.");
+        joystickSprite->setCursor(10, 50 - HEADER_HEIGHT);
+        joystickSprite->println("REMOTE CONTROL SYSTEM");
+        joystickSprite->setCursor(10, 70 - HEADER_HEIGHT);
+        joystickSprite->println("INITIALIZING...");
+        joystickSprite->setCursor(10, 90 - HEADER_HEIGHT);
+        joystickSprite->print("PROGRESS: [");
         for (int j = 0; j < i; j++) {
-            tft.print("=");
+            joystickSprite->print("=");
         }
         for (int j = i; j < 10; j++) {
-            tft.print(" ");
+            joystickSprite->print(" ");
         }
-        tft.println("]");
-        delay(100);
+        joystickSprite->println("]");
+        pushBootFrame();
+        clock.delay(100);
     }
 
-    tft.fillScreen(TFT_BLACK);
-    tft.setCursor(20, 60);
-    tft.setTextSize(2);
-    tft.println("SYSTEM READY");
-    delay(500);
+    joystickSprite->fillSprite(PEN_BLACK);
+    joystickSprite->setCursor(20, 60 - HEADER_HEIGHT);
+    joystickSprite->setTextSize(2);
+    joystickSprite->println("SYSTEM READY");
+    pushBootFrame();
+    clock.delay(500);
 }
 
-void Display::update(const struct_message &joystickData, int signalStrength, int speed, const String &mode) {
-    if (millis() - lastUpdateTime > DISPLAY_UPDATE_INTERVAL) {
-        drawHeader(signalStrength);
-        drawJoystickVisual(joystickData, speed);
-        drawFooter(mode);
-        lastUpdateTime = millis();
-    }
+void Display::pushBootFrame() {
+    framebuffer.startFrame();
+    pushRegion(*joystickSprite, HEADER_HEIGHT, {0, 0, DISPLAY_WIDTH, JOYSTICK_AREA_HEIGHT});
+    framebuffer.endFrame();
 }
 
-void Display::drawHeader(int signalStrength) {
-    headerSprite.fillSprite(COLOR_DARK);
-    headerSprite.setTextColor(COLOR_TEXT);
-
-    // Draw signal strength
-    headerSprite.setCursor(5, 8);
-    headerSprite.setTextSize(1);
-    headerSprite.print("SIGNAL:");
-
-    for (int i = 0; i < MAX_SIGNAL_STRENGTH; i++) {
-        if (i < signalStrength) {
-            headerSprite.fillRect(SIGNAL_BAR_X_START + (i * SIGNAL_BAR_SPACING),
-                                  15 - (i * 2),
-                                  SIGNAL_BAR_WIDTH,
-                                  3 + (i * 2),
-                                  COLOR_GREEN);
-        } else {
-            headerSprite.drawRect(SIGNAL_BAR_X_START + (i * SIGNAL_BAR_SPACING),
-                                  15 - (i * 2),
-                                  SIGNAL_BAR_WIDTH,
-                                  3 + (i * 2),
-                                  COLOR_GREEN);
-        }
+void Display::update(const struct_message &joystickData, int signalStrength, int speed, const char *mode,
+                     const char *target, const char *rtt) {
+    if (!running) {
+        return;
     }
 
-    // Draw separator line
-    headerSprite.drawLine(0, HEADER_HEIGHT - 1, DISPLAY_WIDTH, HEADER_HEIGHT - 1, COLOR_GREEN);
-
-    // Push to screen
-    headerSprite.pushSprite(0, 0);
+    stateLock.lock();
+    if (statePending) {
+        stats.framesDropped++;
+    }
+    pendingState.joystickData = joystickData;
+    pendingState.signalStrength = signalStrength;
+    pendingState.speed = speed;
+    strncpy(pendingState.mode, mode, DISPLAY_MODE_MAX_LEN - 1);
+    pendingState.mode[DISPLAY_MODE_MAX_LEN - 1] = '\0';
+    strncpy(pendingState.target, target, DISPLAY_TARGET_MAX_LEN - 1);
+    pendingState.target[DISPLAY_TARGET_MAX_LEN - 1] = '\0';
+    strncpy(pendingState.rtt, rtt, DISPLAY_RTT_MAX_LEN - 1);
+    pendingState.rtt[DISPLAY_RTT_MAX_LEN - 1] = '\0';
+    statePending = true;
+    stateLock.unlock();
+
+#ifdef NATIVE_BUILD
+    renderPending();
+#else
+    xTaskNotifyGive(renderTaskHandle);
+#endif
 }
 
-void Display::drawJoystickVisual(const struct_message &joystickData, int speed) {
-    joystickSprite.fillSprite(TFT_BLACK);
+void Display::setBacklight(uint8_t level) {
+    stateLock.lock();
+    bool changed = level != backlight;
+    backlight = level;
+    stateLock.unlock();
+    if (!changed || !running) {
+        return;
+    }
 
-    // Calculate joystick position
-    int joyX = JOYSTICK_CENTER_X + (joystickData.x / JOYSTICK_SCALE);
-    int joyY = JOYSTICK_CENTER_Y - (joystickData.y / JOYSTICK_SCALE);
+#ifdef NATIVE_BUILD
+    renderPending();
+#else
+    xTaskNotifyGive(renderTaskHandle);
+#endif
+}
 
-    // Draw crosshair background
-    joystickSprite.drawLine(JOYSTICK_CENTER_X, 10, JOYSTICK_CENTER_X, 74, COLOR_DARK);
-    joystickSprite.drawLine(70, JOYSTICK_CENTER_Y, 170, JOYSTICK_CENTER_Y, COLOR_DARK);
+display_stats Display::getStats() const {
+    stateLock.lock();
+    display_stats copy = stats;
+    stateLock.unlock();
+    return copy;
+}
 
-    // Draw direction indicators based on joystick position
-    // Forward
-    if (joystickData.y > JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(120, 10, 115, 20, 125, 20, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(120, 10, 115, 20, 125, 20, COLOR_DARK);
+#ifndef NATIVE_BUILD
+void Display::renderTask(void *param) {
+    Display *display = static_cast<Display *>(param);
+    display->startup();
+    for (;;) {
+        // Wake on a new state, or once a second to roll the pixel counter over
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        display->renderPending();
     }
-
-    // Backward
-    if (joystickData.y < -JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(120, 74, 115, 64, 125, 64, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(120, 74, 115, 64, 125, 64, COLOR_DARK);
+}
+#endif
+
+void Display::renderPending() {
+    State state;
+    bool hasState = false;
+    stateLock.lock();
+    if (statePending) {
+        state = pendingState;
+        statePending = false;
+        hasState = true;
     }
+    uint8_t level = backlight;
+    stateLock.unlock();
 
-    // Left
-    if (joystickData.x < -JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(70, 42, 80, 37, 80, 47, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(70, 42, 80, 37, 80, 47, COLOR_DARK);
+    if (level != backlightApplied) {
+        framebuffer.setBacklight(level);
+        backlightApplied = level;
+    }
+    // The dark panel keeps the last frame, the next state after it lights up brings it up to date
+    if (hasState && level > 0) {
+        renderFrame(state);
     }
 
-    // Right
-    if (joystickData.x > JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(170, 42, 160, 37, 160, 47, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(170, 42, 160, 37, 160, 47, COLOR_DARK);
+    if (clock.millis() - lastStatsTime >= 1000) {
+        stateLock.lock();
+        stats.pixelsPerSecond = pixelsPushed;
+        stateLock.unlock();
+        pixelsPushed = 0;
+        lastStatsTime = clock.millis();
     }
+}
 
-    // Draw diagonal indicators
-    // Forward-Left
-    if (joystickData.x < -JOYSTICK_DEADZONE && joystickData.y > JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(90, 20, 95, 15, 100, 25, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(90, 20, 95, 15, 100, 25, COLOR_DARK);
+void Display::renderFrame(const State &state) {
+    uint32_t frameStart = clock.micros();
+    pushTimeUs = 0;
+
+    framebuffer.startFrame();
+
+    // Only redraw the sprites whose inputs changed since the last frame
+    if (!frameValid || state.signalStrength != lastState.signalStrength || strcmp(state.rtt, lastState.rtt) != 0) {
+        drawHeader(state.signalStrength, state.rtt);
+    }
+    drawJoystickVisual(state.joystickData, state.speed);
+    if (!frameValid || strcmp(state.mode, lastState.mode) != 0 || strcmp(state.target, lastState.target) != 0) {
+        drawFooter(state.mode, state.target);
     }
 
-    // Forward-Right
-    if (joystickData.x > JOYSTICK_DEADZONE && joystickData.y > JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(150, 20, 145, 15, 140, 25, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(150, 20, 145, 15, 140, 25, COLOR_DARK);
+    uint32_t waitStart = clock.micros();
+    framebuffer.endFrame();
+    pushTimeUs += clock.micros() - waitStart;
+
+    frameValid = true;
+    lastState = state;
+
+    uint32_t frameTimeUs = clock.micros() - frameStart;
+    stateLock.lock();
+    stats.framesRendered++;
+    stats.pushTimeUs = pushTimeUs;
+    stats.renderTimeUs = frameTimeUs - pushTimeUs;
+    stateLock.unlock();
+}
+
+void Display::buildStaticLayers() {
+    // Header: label, bar outlines and separator
+    headerLayer = framebuffer.createCanvas(DISPLAY_WIDTH, HEADER_HEIGHT);
+    headerLayer->fillSprite(PEN_DARK);
+    headerLayer->setTextColor(PEN_TEXT);
+    headerLayer->setCursor(5, HEADER_TEXT_Y);
+    headerLayer->setTextSize(1);
+    headerLayer->print("SIGNAL:");
+    for (int i = 0; i < MAX_SIGNAL_STRENGTH; i++) {
+        headerLayer->drawRect(SIGNAL_BAR_X_START + (i * SIGNAL_BAR_SPACING),
+                              15 - (i * 2),
+                              SIGNAL_BAR_WIDTH,
+                              3 + (i * 2),
+                              PEN_GREEN);
+    }
+    headerLayer->drawLine(0, HEADER_HEIGHT - 1, DISPLAY_WIDTH, HEADER_HEIGHT - 1, PEN_GREEN);
+
+    // Joystick area: crosshair, idle direction indicators, center circles and speed label
+    joystickLayer = framebuffer.createCanvas(DISPLAY_WIDTH, JOYSTICK_AREA_HEIGHT);
+    joystickLayer->fillSprite(PEN_BLACK);
+    joystickLayer->drawLine(JOYSTICK_CENTER_X, 10, JOYSTICK_CENTER_X, 74, PEN_DARK);
+    joystickLayer->drawLine(70, JOYSTICK_CENTER_Y, 170, JOYSTICK_CENTER_Y, PEN_DARK);
+    for (int i = 0; i < NUM_DIRECTION_TRIANGLES; i++) {
+        const Triangle &t = DIRECTION_TRIANGLES[i];
+        joystickLayer->drawTriangle(t.x0, t.y0, t.x1, t.y1, t.x2, t.y2, PEN_DARK);
     }
+    joystickLayer->drawCircle(JOYSTICK_CENTER_X, JOYSTICK_CENTER_Y, JOYSTICK_CIRCLE_RADIUS, PEN_BLUE);
+    joystickLayer->drawCircle(JOYSTICK_CENTER_X, JOYSTICK_CENTER_Y, JOYSTICK_DOT_RADIUS, PEN_BLUE);
+    joystickLayer->setTextColor(PEN_TEXT);
+    joystickLayer->setCursor(180, 35);
+    joystickLayer->setTextSize(1);
+    joystickLayer->print("SPEED:");
+
+    // Footer: separator and labels
+    footerLayer = framebuffer.createCanvas(DISPLAY_WIDTH, FOOTER_HEIGHT);
+    footerLayer->fillSprite(PEN_DARK);
+    footerLayer->setTextColor(PEN_TEXT);
+    footerLayer->drawLine(0, 0, DISPLAY_WIDTH, 0, PEN_GREEN);
+    footerLayer->setTextSize(1);
+    footerLayer->setCursor(10, FOOTER_TEXT_Y);
+    footerLayer->print("MODE: ");
+    footerLayer->setCursor(140, FOOTER_TEXT_Y);
+    footerLayer->print("CAR: ");
+
+    speedDigits.build(framebuffer, SPEED_DIGITS, 2, PEN_TEXT, PEN_BLACK);
+    speedUnit.build(framebuffer, SPEED_UNIT, 1, PEN_TEXT, PEN_BLACK);
+    footerText.build(framebuffer, FOOTER_CHARS, 1, PEN_GREEN, PEN_DARK);
+    headerText.build(framebuffer, HEADER_CHARS, 1, PEN_TEXT, PEN_DARK);
+}
 
-    // Backward-Left
-    if (joystickData.x < -JOYSTICK_DEADZONE && joystickData.y < -JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(90, 64, 95, 69, 100, 59, COLOR_GREEN);
-    } else {
-        joystickSprite.drawTriangle(90, 64, 95, 69, 100, 59, COLOR_DARK);
+void Display::drawHeader(int signalStrength, const char *rtt) {
+    // Label, outlines and separator come from the layer, only the lit bars and the readout are drawn
+    const Region header = {0, 0, DISPLAY_WIDTH, HEADER_HEIGHT};
+    blitCanvas(*headerSprite, *headerLayer, 0, 0, DISPLAY_WIDTH, HEADER_HEIGHT, 0, 0, header);
+    headerText.draw(*headerSprite, rtt, HEADER_RTT_X, HEADER_TEXT_Y, header);
+    for (int i = 0; i < signalStrength && i < MAX_SIGNAL_STRENGTH; i++) {
+        headerSprite->fillRect(SIGNAL_BAR_X_START + (i * SIGNAL_BAR_SPACING),
+                               15 - (i * 2),
+                               SIGNAL_BAR_WIDTH,
+                               3 + (i * 2),
+                               PEN_GREEN);
     }
 
-    // Backward-Right
-    if (joystickData.x > JOYSTICK_DEADZONE && joystickData.y < -JOYSTICK_DEADZONE) {
-        joystickSprite.fillTriangle(150, 64, 145, 69, 140, 59, COLOR_GREEN);
+    // Push to screen
+    pushRegion(*headerSprite, 0, header);
+}
+
+void Display::drawJoystickVisual(const struct_message &joystickData, int speed) {
+    if (!frameValid) {
+        repaintJoystickRegion({0, 0, DISPLAY_WIDTH, JOYSTICK_AREA_HEIGHT}, joystickData, speed);
     } else {
-        joystickSprite.drawTriangle(150, 64, 145, 69, 140, 59, COLOR_DARK);
+        // Pointer: erase the old position and draw the new one
+        Region oldPointer = pointerRegion(lastState.joystickData);
+        Region newPointer = pointerRegion(joystickData);
+        if (oldPointer.x != newPointer.x || oldPointer.y != newPointer.y) {
+            repaintJoystickRegion(oldPointer, joystickData, speed);
+            repaintJoystickRegion(newPointer, joystickData, speed);
+        }
+
+        // Direction indicators that toggled
+        uint8_t changed = directionMask(joystickData) ^ directionMask(lastState.joystickData);
+        for (int i = 0; i < NUM_DIRECTION_TRIANGLES; i++) {
+            if (changed & (1 << i)) {
+                const Triangle &t = DIRECTION_TRIANGLES[i];
+                int16_t minX = std::min(t.x0, std::min(t.x1, t.x2));
+                int16_t minY = std::min(t.y0, std::min(t.y1, t.y2));
+                int16_t maxX = std::max(t.x0, std::max(t.x1, t.x2));
+                int16_t maxY = std::max(t.y0, std::max(t.y1, t.y2));
+                repaintJoystickRegion({minX, minY, (int16_t) (maxX - minX + 1), (int16_t) (maxY - minY + 1)},
+                                      joystickData, speed);
+            }
+        }
+
+        // Speed value
+        if (speed != lastState.speed) {
+            repaintJoystickRegion({SPEED_VALUE_X, SPEED_VALUE_Y, SPEED_VALUE_W, SPEED_VALUE_H}, joystickData, speed);
+        }
     }
+}
 
-    // Draw center point
-    joystickSprite.drawCircle(JOYSTICK_CENTER_X, JOYSTICK_CENTER_Y, JOYSTICK_CIRCLE_RADIUS, COLOR_BLUE);
-    joystickSprite.drawCircle(JOYSTICK_CENTER_X, JOYSTICK_CENTER_Y, JOYSTICK_DOT_RADIUS, COLOR_BLUE);
+void Display::repaintJoystickRegion(const Region &region, const struct_message &joystickData, int speed) {
+    renderJoystickScene(region, joystickData, speed);
+    pushRegion(*joystickSprite, HEADER_HEIGHT, region);
+}
 
-    // Draw joystick position
-    joystickSprite.fillCircle(joyX, joyY, JOYSTICK_POINTER_SIZE, COLOR_GREEN);
-    joystickSprite.drawCircle(joyX, joyY, JOYSTICK_POINTER_SIZE, COLOR_TEXT);
-
-    // Draw speed indicator
-    joystickSprite.setTextColor(COLOR_TEXT);
-    joystickSprite.setCursor(180, 35);
-    joystickSprite.setTextSize(1);
-    joystickSprite.print("SPEED:");
-    joystickSprite.setCursor(180, 50);
-    joystickSprite.setTextSize(2);
-    joystickSprite.print(speed);
-    joystickSprite.setTextSize(1);
-    joystickSprite.print(" %");
+void Display::pushRegion(Canvas &canvas, int16_t screenY, const Region &region) {
+    uint32_t start = clock.micros();
+    framebuffer.pushRegion(canvas, region.x, region.y, region.w, region.h, region.x, screenY + region.y);
+    pushTimeUs += clock.micros() - start;
+    pixelsPushed += region.w * region.h;
+}
 
-    // Push to screen
-    joystickSprite.pushSprite(0, HEADER_HEIGHT);
+void Display::renderJoystickScene(const Region &region, const struct_message &joystickData, int speed) {
+    // Static background, then the dynamic parts clipped to the region
+    blitCanvas(*joystickSprite, *joystickLayer, region.x, region.y, region.w, region.h, region.x, region.y, region);
+    joystickSprite->setViewport(region.x, region.y, region.w, region.h, false);
+
+    // Calculate joystick position
+    int joyX = JOYSTICK_CENTER_X + (joystickData.x / JOYSTICK_SCALE);
+    int joyY = JOYSTICK_CENTER_Y - (joystickData.y / JOYSTICK_SCALE);
+
+    // Draw direction indicators based on joystick position, idle ones are in the layer. The fill does
+    // not cover every pixel of the cached outline, so the outline is erased first.
+    uint8_t mask = directionMask(joystickData);
+    for (int i = 0; i < NUM_DIRECTION_TRIANGLES; i++) {
+        const Triangle &t = DIRECTION_TRIANGLES[i];
+        if (mask & (1 << i)) {
+            joystickSprite->drawTriangle(t.x0, t.y0, t.x1, t.y1, t.x2, t.y2, PEN_BLACK);
+            joystickSprite->fillTriangle(t.x0, t.y0, t.x1, t.y1, t.x2, t.y2, PEN_GREEN);
+        }
+    }
+
+    // Draw joystick position
+    joystickSprite->fillCircle(joyX, joyY, JOYSTICK_POINTER_SIZE, PEN_GREEN);
+    joystickSprite->drawCircle(joyX, joyY, JOYSTICK_POINTER_SIZE, PEN_TEXT);
+    joystickSprite->resetViewport();
+
+    // Draw speed value
+    char digits[8];
+    snprintf(digits, sizeof(digits), "%d", speed);
+    int16_t x = speedDigits.draw(*joystickSprite, digits, SPEED_VALUE_X, SPEED_VALUE_Y, region);
+    speedUnit.draw(*joystickSprite, SPEED_UNIT, x, SPEED_VALUE_Y, region);
 }
 
-void Display::drawFooter(const String &mode) {
-    footerSprite.fillSprite(COLOR_DARK);
-    footerSprite.setTextColor(COLOR_TEXT);
+uint8_t Display::directionMask(const struct_message &joystickData) {
+    bool forward = joystickData.y > JOYSTICK_DEADZONE;
+    bool backward = joystickData.y < -JOYSTICK_DEADZONE;
+    bool left = joystickData.x < -JOYSTICK_DEADZONE;
+    bool right = joystickData.x > JOYSTICK_DEADZONE;
+
+    return (forward << 0) |
+           (backward << 1) |
+           (left << 2) |
+           (right << 3) |
+           ((forward && left) << 4) |
+           ((forward && right) << 5) |
+           ((backward && left) << 6) |
+           ((backward && right) << 7);
+}
 
-    // Draw separator line
-    footerSprite.drawLine(0, 0, DISPLAY_WIDTH, 0, COLOR_GREEN);
+Display::Region Display::pointerRegion(const struct_message &joystickData) {
+    int joyX = JOYSTICK_CENTER_X + (joystickData.x / JOYSTICK_SCALE);
+    int joyY = JOYSTICK_CENTER_Y - (joystickData.y / JOYSTICK_SCALE);
+    return {(int16_t) (joyX - JOYSTICK_POINTER_SIZE), (int16_t) (joyY - JOYSTICK_POINTER_SIZE),
+            2 * JOYSTICK_POINTER_SIZE + 1, 2 * JOYSTICK_POINTER_SIZE + 1};
+}
 
-    // Draw mode
-    footerSprite.setCursor(10, 8);
-    footerSprite.setTextSize(1);
-    footerSprite.print("MODE: ");
-    footerSprite.setTextColor(COLOR_GREEN);
-    footerSprite.print(mode);
+void Display::drawFooter(const char *mode, const char *target) {
+    // Separator and labels come from the layer
+    const Region footer = {0, 0, DISPLAY_WIDTH, FOOTER_HEIGHT};
+    blitCanvas(*footerSprite, *footerLayer, 0, 0, DISPLAY_WIDTH, FOOTER_HEIGHT, 0, 0, footer);
+    footerText.draw(*footerSprite, mode, FOOTER_MODE_X, FOOTER_TEXT_Y, footer);
+    footerText.draw(*footerSprite, target, FOOTER_TARGET_X, FOOTER_TEXT_Y, footer);
 
     // Push to screen
-    footerSprite.pushSprite(0, HEADER_HEIGHT + JOYSTICK_AREA_HEIGHT);
+    pushRegion(*footerSprite, HEADER_HEIGHT + JOYSTICK_AREA_HEIGHT, footer);
 }
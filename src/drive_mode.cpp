@@ -0,0 +1,63 @@
+#include "drive_mode.h"
+#include "config.h"
+
+namespace {
+
+enum CurveShape {
+    CURVE_LINEAR,
+    CURVE_EXPO,   // (1 - k) * t + k * t^3, softer around the center
+    CURVE_S       // Smoothstep, soft at both ends
+};
+
+struct CurveTable {
+    int16_t values[CURVE_TABLE_SIZE];
+};
+
+constexpr float applyShape(CurveShape shape, float expo, float t) {
+    return shape == CURVE_EXPO ? (1.0f - expo) * t + expo * t * t * t
+         : shape == CURVE_S ? t * t * (3.0f - 2.0f * t)
+         : t;
+}
+
+// Deadzone is in output units, like JOYSTICK_DEADZONE; the curve restarts from 0 at its edge
+constexpr CurveTable makeCurve(CurveShape shape, float expo, int deadzone, int maxOutput) {
+    CurveTable table{};
+    const float deadzoneInput = (float) deadzone / JOYSTICK_MAX_RANGE;
+    for (int i = 0; i < CURVE_TABLE_SIZE; i++) {
+        int offset = i - CURVE_CENTER;
+        float magnitude = (float) (offset < 0 ? -offset : offset) / CURVE_CENTER;
+        float output = 0.0f;
+        if (magnitude > deadzoneInput) {
+            float t = (magnitude - deadzoneInput) / (1.0f - deadzoneInput);
+            output = applyShape(shape, expo, t > 1.0f ? 1.0f : t) * maxOutput;
+        }
+        int16_t rounded = (int16_t) (output + 0.5f);
+        table.values[i] = offset < 0 ? (int16_t) -rounded : rounded;
+    }
+    return table;
+}
+
+// Generated at compile time, stored in flash
+constexpr CurveTable RACE_CURVE = makeCurve(CURVE_LINEAR, 0.0f, JOYSTICK_DEADZONE, JOYSTICK_MAX_RANGE);
+constexpr CurveTable ECO_CURVE = makeCurve(CURVE_S, 0.0f, JOYSTICK_DEADZONE, JOYSTICK_MAX_RANGE * 6 / 10);
+constexpr CurveTable PRECISION_CURVE = makeCurve(CURVE_EXPO, 0.7f, JOYSTICK_DEADZONE, JOYSTICK_MAX_RANGE * 4 / 10);
+
+static_assert(RACE_CURVE.values[CURVE_CENTER] == 0, "Curves must be neutral at the center");
+static_assert(RACE_CURVE.values[0] == JOYSTICK_MIN_RANGE, "RACE must reach full reverse");
+
+const CurveTable *const CURVES[DRIVE_MODE_COUNT] = {&RACE_CURVE, &ECO_CURVE, &PRECISION_CURVE};
+const char *const NAMES[DRIVE_MODE_COUNT] = {"RACE", "ECO", "PRECISION"};
+
+}
+
+const int16_t *driveModeCurve(DriveMode mode) {
+    return CURVES[mode]->values;
+}
+
+const char *driveModeName(DriveMode mode) {
+    return NAMES[mode];
+}
+
+DriveMode nextDriveMode(DriveMode mode) {
+    return (DriveMode) ((mode + 1) % DRIVE_MODE_COUNT);
+}
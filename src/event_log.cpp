@@ -0,0 +1,120 @@
+#include "event_log.h"
+#include <algorithm>
+#include <cstring>
+#include "protocol.h"
+
+EventLog *EventLog::instance = nullptr;
+
+EventLog::EventLog(const Clock &clock) :
+        clock(clock),
+        ring(),
+        lastSentUs{},
+        suppressed{},
+        seen{},
+        records(0),
+        coalesced(0),
+        pending{},
+        pendingLength(0),
+        droppedReported(0),
+        sent(0),
+        bytes(0) {
+}
+
+EventLog::~EventLog() {
+    if (instance == this) {
+        instance = nullptr;
+    }
+}
+
+void EventLog::install() {
+    instance = this;
+}
+
+EventLog *EventLog::getInstance() {
+    return instance;
+}
+
+void EventLog::write(LogId id, const int32_t *args, uint8_t argc) {
+    if (id >= LOG_ID_COUNT) {
+        return;
+    }
+    uint32_t now = clock.micros();
+    records.fetch_add(1, std::memory_order_relaxed);
+
+    // Within the interval, or another writer just took it: only counted
+    uint32_t last = lastSentUs[id].load(std::memory_order_relaxed);
+    if ((seen[id].load(std::memory_order_acquire) && now - last < LOG_RATE_INTERVAL * 1000UL) ||
+        !lastSentUs[id].compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        suppressed[id].fetch_add(1, std::memory_order_relaxed);
+        coalesced.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    seen[id].store(true, std::memory_order_release);
+
+    log_record record = {now, id, std::min<uint8_t>(argc, LOG_MAX_ARGS),
+                         suppressed[id].exchange(0, std::memory_order_relaxed), {}};
+    std::copy(args, args + record.argc, record.args);
+    ring.push(record);
+}
+
+size_t EventLog::drain(uint8_t *buffer, size_t size) {
+    size_t length = 0;
+    while ((pendingLength > 0 || nextFrame()) && length + pendingLength <= size) {
+        memcpy(buffer + length, pending, pendingLength);
+        length += pendingLength;
+        pendingLength = 0;
+        sent++;
+    }
+    bytes += length;
+    return length;
+}
+
+bool EventLog::nextFrame() {
+    log_record record;
+    if (ring.pop(record)) {
+        pendingLength = encode(record, 0);
+        return true;
+    }
+
+    uint32_t now = clock.micros();
+    uint32_t dropped = ring.getDropped();
+    if (dropped != droppedReported) {
+        record = {now, LOG_RECORDS_DROPPED, 1, 0, {(int32_t) (dropped - droppedReported)}};
+        droppedReported = dropped;
+        pendingLength = encode(record, 0);
+        return true;
+    }
+
+    // Counts nothing sent since, once their interval is over
+    for (uint8_t id = 0; id < LOG_ID_COUNT; id++) {
+        if (suppressed[id].load(std::memory_order_relaxed) == 0 ||
+            now - lastSentUs[id].load(std::memory_order_relaxed) < LOG_RATE_INTERVAL * 1000UL) {
+            continue;
+        }
+        lastSentUs[id].store(now, std::memory_order_relaxed);
+        record = {now, id, 0, suppressed[id].exchange(0, std::memory_order_relaxed), {}};
+        pendingLength = encode(record, LOG_FLAG_SUMMARY);
+        return true;
+    }
+    return false;
+}
+
+size_t EventLog::encode(const log_record &record, uint8_t flags) {
+    uint8_t *p = pending;
+    p[0] = LOG_FRAME_MARK;
+    p[1] = record.id;
+    p[2] = (uint8_t) (record.argc | flags);
+    putU32(p + 3, record.timeUs);
+    size_t n = 7;
+    n += putVarint(p + n, record.repeated);
+    for (uint8_t i = 0; i < record.argc; i++) {
+        n += putVarint(p + n, zigzag(record.args[i]));
+    }
+    p[n] = crc8(p, n);
+    return n + 1;
+}
+
+log_stats EventLog::getStats() const {
+    return {records.load(std::memory_order_relaxed), sent, coalesced.load(std::memory_order_relaxed),
+            ring.getDropped(), bytes};
+}
@@ -0,0 +1,158 @@
+#include "frame_auth.h"
+#include <cstring>
+
+namespace {
+
+uint64_t getU64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+void sipRound(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) {
+    v0 += v1;
+    v1 = rotl(v1, 13);
+    v1 ^= v0;
+    v0 = rotl(v0, 32);
+    v2 += v3;
+    v3 = rotl(v3, 16);
+    v3 ^= v2;
+    v0 += v3;
+    v3 = rotl(v3, 21);
+    v3 ^= v0;
+    v2 += v1;
+    v1 = rotl(v1, 17);
+    v1 ^= v2;
+    v2 = rotl(v2, 32);
+}
+
+void putTrailerHeader(uint8_t *p, uint16_t epoch, uint32_t counter) {
+    p[0] = (uint8_t) epoch;
+    p[1] = (uint8_t) (epoch >> 8);
+    for (int i = 0; i < 4; i++) {
+        p[2 + i] = (uint8_t) (counter >> (8 * i));
+    }
+}
+
+}
+
+uint64_t sipHash24(const uint8_t *key, const uint8_t *data, size_t length) {
+    uint64_t k0 = getU64(key);
+    uint64_t k1 = getU64(key + 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+    const uint8_t *end = data + (length & ~(size_t) 7);
+    for (const uint8_t *p = data; p < end; p += 8) {
+        uint64_t m = getU64(p);
+        v3 ^= m;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    // Last block: the remaining bytes, and the length in the top byte
+    uint64_t last = (uint64_t) length << 56;
+    for (size_t i = 0; i < (length & 7); i++) {
+        last |= (uint64_t) end[i] << (8 * i);
+    }
+    v3 ^= last;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xFF;
+    for (int i = 0; i < 4; i++) {
+        sipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+FrameSigner::FrameSigner() :
+        key{},
+        epoch(0),
+        counter(0),
+        exhausted(false) {
+}
+
+void FrameSigner::begin(const uint8_t *key, uint16_t epoch, bool fromCar) {
+    memcpy(this->key, key, FRAME_AUTH_KEY_SIZE);
+    this->epoch = (uint16_t) ((epoch & FRAME_AUTH_EPOCH_MASK) | (fromCar ? FRAME_AUTH_FROM_CAR : 0));
+    counter = 0;
+    // No epoch: the counters of this boot could repeat those of another one
+    exhausted = (epoch & FRAME_AUTH_EPOCH_MASK) == 0;
+}
+
+size_t FrameSigner::sign(uint8_t *frame, size_t length, size_t size) {
+    if (exhausted || size < length + FRAME_AUTH_SIZE) {
+        return 0;
+    }
+    putTrailerHeader(frame + length, epoch, counter);
+    uint64_t tag = sipHash24(key, frame, length + 6);
+    for (int i = 0; i < FRAME_AUTH_TAG_SIZE; i++) {
+        frame[length + 6 + i] = (uint8_t) (tag >> (8 * i));
+    }
+    exhausted = ++counter == 0;
+    return length + FRAME_AUTH_SIZE;
+}
+
+FrameVerifier::FrameVerifier() :
+        key{},
+        fromCar(false),
+        started(false),
+        lastEpoch(0),
+        lastCounter(0),
+        accepted(0),
+        rejected(0) {
+}
+
+void FrameVerifier::begin(const uint8_t *key, bool fromCar) {
+    memcpy(this->key, key, FRAME_AUTH_KEY_SIZE);
+    this->fromCar = fromCar;
+    started = false;
+}
+
+size_t FrameVerifier::verify(const uint8_t *frame, size_t length) {
+    if (length <= FRAME_AUTH_SIZE) {
+        rejected++;
+        return 0;
+    }
+    size_t payload = length - FRAME_AUTH_SIZE;
+    const uint8_t *trailer = frame + payload;
+    uint16_t epoch = (uint16_t) (trailer[0] | (trailer[1] << 8));
+    uint32_t counter = trailer[2] | (trailer[3] << 8) | ((uint32_t) trailer[4] << 16) | ((uint32_t) trailer[5] << 24);
+
+    // Every byte of the tag is compared, whatever the first mismatch
+    uint64_t tag = sipHash24(key, frame, payload + 6);
+    uint8_t difference = 0;
+    for (int i = 0; i < FRAME_AUTH_TAG_SIZE; i++) {
+        difference |= trailer[6 + i] ^ (uint8_t) (tag >> (8 * i));
+    }
+
+    bool fresh = !started || epoch > lastEpoch || (epoch == lastEpoch && counter > lastCounter);
+    if (difference != 0 || ((epoch & FRAME_AUTH_FROM_CAR) != 0) != fromCar || !fresh) {
+        rejected++;
+        return 0;
+    }
+    started = true;
+    lastEpoch = epoch;
+    lastCounter = counter;
+    accepted++;
+    return payload;
+}
+
+uint32_t FrameVerifier::getAccepted() const {
+    return accepted;
+}
+
+uint32_t FrameVerifier::getRejected() const {
+    return rejected;
+}
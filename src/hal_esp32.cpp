@@ -0,0 +1,406 @@
+#include "hal_esp32.h"
+#include <algorithm>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include "frame_auth.h"
+#include "event_log.h"
+
+namespace {
+
+// Airtime of a received frame, preamble plus its length at the rate it was sent at
+uint32_t estimateAirtimeUs(const wifi_pkt_rx_ctrl_t &rx) {
+    // Half Mbit/s per legacy rate index: 1, 2, 5.5, 11 Mbit/s long and short preamble DSSS, then OFDM
+    static const uint8_t LEGACY_RATES[16] = {2, 4, 11, 22, 2, 4, 11, 22, 96, 48, 24, 12, 108, 72, 36, 18};
+    // HT MCS 0..7, 20 MHz, long guard interval
+    static const uint8_t HT_RATES[8] = {13, 26, 39, 52, 78, 104, 117, 130};
+    if (rx.sig_mode == 0) {
+        uint8_t rate = rx.rate & 0x0F;
+        return (rate < 8 ? 192 : 20) + rx.sig_len * 16 / LEGACY_RATES[rate];
+    }
+    return 36 + rx.sig_len * 16 / HT_RATES[rx.mcs & 0x07];
+}
+
+}
+
+uint32_t EspClock::millis() const {
+    return ::millis();
+}
+
+uint32_t EspClock::micros() const {
+    return ::micros();
+}
+
+void EspClock::delay(uint32_t ms) {
+    ::delay(ms);
+}
+
+bool EspPowerControl::setCpuFrequency(uint32_t mhz) {
+    return setCpuFrequencyMhz(mhz);
+}
+
+bool EspPowerControl::lightSleep(uint32_t us) {
+    // The pin's edge interrupt cannot wake the chip, a low level can; the interrupt stays off until the
+    // level wake-up is undone, or it would fire for as long as the button is held
+    gpio_num_t pin = (gpio_num_t) SW_PIN;
+    gpio_intr_disable(pin);
+    gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    esp_sleep_enable_timer_wakeup(us);
+    esp_light_sleep_start();
+    bool button = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+    gpio_wakeup_disable(pin);
+    gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+    gpio_intr_enable(pin);
+    return button;
+}
+
+bool NvsCalibrationStore::load(joystick_calibration &calibration) {
+    if (!preferences.begin(CALIBRATION_NVS_NAMESPACE, true)) {
+        return false;
+    }
+    // Entries written by another layout of the struct are ignored
+    bool valid = preferences.getUChar("version", 0) == CALIBRATION_NVS_VERSION &&
+                 preferences.getBytes("data", &calibration, sizeof(calibration)) == sizeof(calibration);
+    preferences.end();
+    return valid;
+}
+
+bool NvsCalibrationStore::save(const joystick_calibration &calibration) {
+    if (!preferences.begin(CALIBRATION_NVS_NAMESPACE, false)) {
+        return false;
+    }
+    bool saved = preferences.putBytes("data", &calibration, sizeof(calibration)) == sizeof(calibration) &&
+                 preferences.putUChar("version", CALIBRATION_NVS_VERSION) == 1;
+    preferences.end();
+    return saved;
+}
+
+uint16_t NvsBootCounter::increment() {
+    if (!preferences.begin(AUTH_EPOCH_NVS_NAMESPACE, false)) {
+        return 0;
+    }
+    // Does not wrap: the cars would reject every frame of an epoch below the last one they accepted
+    uint16_t boots = preferences.getUShort("boots", 0);
+    if (boots >= FRAME_AUTH_EPOCH_MASK) {
+        preferences.end();
+        return 0;
+    }
+    uint16_t count = (uint16_t) (boots + 1);
+    bool saved = preferences.putUShort("boots", count) == sizeof(count);
+    preferences.end();
+    return saved ? count : 0;
+}
+
+LittleFsRecordingStorage::LittleFsRecordingStorage(const char *path) : path(path) {
+}
+
+bool LittleFsRecordingStorage::begin() {
+    return LittleFS.begin(true);
+}
+
+bool LittleFsRecordingStorage::openWrite() {
+    file.close();
+    file = LittleFS.open(path, FILE_WRITE);
+    return (bool) file;
+}
+
+bool LittleFsRecordingStorage::openRead() {
+    file.close();
+    if (!LittleFS.exists(path)) {
+        return false;
+    }
+    file = LittleFS.open(path, FILE_READ);
+    return (bool) file;
+}
+
+bool LittleFsRecordingStorage::write(const uint8_t *data, size_t length) {
+    if (!file || file.write(data, length) != length) {
+        return false;
+    }
+    // Commits the file size, a power off then loses at most the blocks not written yet
+    file.flush();
+    return true;
+}
+
+size_t LittleFsRecordingStorage::read(uint8_t *data, size_t size) {
+    return file ? file.read(data, size) : 0;
+}
+
+void LittleFsRecordingStorage::close() {
+    file.close();
+}
+
+EspNowRadio *EspNowRadio::instance = nullptr;
+
+EspNowRadio::EspNowRadio() :
+        peerAddresses{},
+        peerCount(0),
+        surveying(false),
+        surveyFrames(0),
+        surveyAirtimeUs(0),
+        surveyNoiseSum(0),
+        sendCallback(nullptr),
+        rssiCallback(nullptr),
+        receiveCallback(nullptr),
+        callbackContext(nullptr) {
+    instance = this;
+}
+
+bool EspNowRadio::begin() {
+    // Initialize WiFi. Modem sleep follows the beacons of an access point, ESP-NOW has none: the
+    // receiver stays on for the acks and the replies of the cars.
+    WiFi.mode(WIFI_STA);
+    esp_wifi_set_ps(WIFI_PS_NONE);
+
+    // Initialize ESP-NOW
+    if (esp_now_init() != ESP_OK) {
+        logEvent(LOG_RADIO_INIT_FAILED);
+        return false;
+    }
+
+    esp_now_register_send_cb(onSendCallback);
+    esp_now_register_recv_cb(onReceiveCallback);
+
+    // Listen to management frames (ESP-NOW uses action frames) to get the RSSI of the peers
+    wifi_promiscuous_filter_t filter = {};
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(onPromiscuousCallback);
+    esp_wifi_set_promiscuous(true);
+
+    logEvent(LOG_RADIO_READY);
+    return true;
+}
+
+bool EspNowRadio::setPrimaryKey(const uint8_t *key) {
+    return esp_now_set_pmk(key) == ESP_OK;
+}
+
+int EspNowRadio::addPeer(const uint8_t *address, const uint8_t *localKey) {
+    if (peerCount >= RADIO_MAX_PEERS) {
+        return -1;
+    }
+
+    // Encrypted peers are limited by ESP_NOW_MAX_ENCRYPT_PEER_NUM, above COMS_MAX_PEERS
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, address, ESP_NOW_ETH_ALEN);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = localKey != nullptr;
+    if (localKey != nullptr) {
+        memcpy(peerInfo.lmk, localKey, ESP_NOW_KEY_LEN);
+    }
+    if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+        logEvent(LOG_PEER_ADD_FAILED);
+        return -1;
+    }
+
+    memcpy(peerAddresses[peerCount], address, ESP_NOW_ETH_ALEN);
+    return peerCount++;
+}
+
+bool EspNowRadio::send(uint8_t peer, const uint8_t *data, size_t length) {
+    return peer < peerCount && esp_now_send(peerAddresses[peer], data, length) == ESP_OK;
+}
+
+bool EspNowRadio::setChannel(uint8_t channel) {
+    return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) == ESP_OK;
+}
+
+bool EspNowRadio::survey(uint8_t channel, uint32_t dwell, channel_survey &result) {
+    uint8_t current;
+    wifi_second_chan_t secondary;
+    if (esp_wifi_get_channel(&current, &secondary) != ESP_OK) {
+        return false;
+    }
+
+    // Every frame type while surveying, management frames only for the RSSI of the peers otherwise
+    wifi_promiscuous_filter_t filter = {};
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_ALL;
+    esp_wifi_set_promiscuous_filter(&filter);
+    surveyFrames = 0;
+    surveyAirtimeUs = 0;
+    surveyNoiseSum = 0;
+    bool switched = setChannel(channel);
+    uint32_t start = ::micros();
+    surveying = true;
+    ::delay(dwell);
+    surveying = false;
+    uint32_t elapsedUs = ::micros() - start;
+    setChannel(current);
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+    esp_wifi_set_promiscuous_filter(&filter);
+
+    uint32_t frames = surveyFrames;
+    result.channel = channel;
+    result.frames = (uint16_t) std::min<uint32_t>(frames, UINT16_MAX);
+    uint64_t busy = elapsedUs > 0 ? (uint64_t) surveyAirtimeUs * 100 / elapsedUs : 0;
+    result.busyPercent = (uint8_t) std::min<uint64_t>(busy, 100);
+    result.noiseFloor = (int8_t) (frames > 0 ? surveyNoiseSum / (int32_t) frames : 0);
+    return switched;
+}
+
+void EspNowRadio::setCallbacks(SendCallback onSent, RssiCallback onRssi, ReceiveCallback onReceive,
+                               void *context) {
+    sendCallback = onSent;
+    rssiCallback = onRssi;
+    receiveCallback = onReceive;
+    callbackContext = context;
+}
+
+int EspNowRadio::findPeer(const uint8_t *address) const {
+    for (int i = 0; i < peerCount; i++) {
+        if (memcmp(peerAddresses[i], address, ESP_NOW_ETH_ALEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void EspNowRadio::onSendCallback(const uint8_t *mac_addr, esp_now_send_status_t status) {
+    if (!instance || !instance->sendCallback) {
+        return;
+    }
+    int peer = instance->findPeer(mac_addr);
+    if (peer >= 0) {
+        instance->sendCallback(instance->callbackContext, (uint8_t) peer, status == ESP_NOW_SEND_SUCCESS);
+    }
+}
+
+void EspNowRadio::onReceiveCallback(const uint8_t *mac_addr, const uint8_t *data, int length) {
+    if (!instance || !instance->receiveCallback || length <= 0) {
+        return;
+    }
+    int peer = instance->findPeer(mac_addr);
+    if (peer >= 0) {
+        instance->receiveCallback(instance->callbackContext, (uint8_t) peer, data, (size_t) length);
+    }
+}
+
+void EspNowRadio::onPromiscuousCallback(void *buf, wifi_promiscuous_pkt_type_t type) {
+    if (!instance) {
+        return;
+    }
+    const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *) buf;
+    if (instance->surveying) {
+        instance->surveyFrames++;
+        instance->surveyAirtimeUs += estimateAirtimeUs(packet->rx_ctrl);
+        instance->surveyNoiseSum += packet->rx_ctrl.noise_floor;
+        return;
+    }
+    if (!instance->rssiCallback || type != WIFI_PKT_MGMT) {
+        return;
+    }
+
+    // 802.11 header: transmitter address (addr2) starts at byte 10
+    if (packet->rx_ctrl.sig_len < 16) {
+        return;
+    }
+    int peer = instance->findPeer(packet->payload + 10);
+    if (peer >= 0) {
+        instance->rssiCallback(instance->callbackContext, (uint8_t) peer, (int8_t) packet->rx_ctrl.rssi);
+    }
+}
+
+TftFramebuffer::TftFramebuffer() :
+        tft(),
+        backlight(BACKLIGHT_FULL),
+        dmaBuffer{nullptr, nullptr},
+        dmaBufferIndex(0),
+        palette(),
+        canvasBytes(0) {
+    uint16_t colors[] = DISPLAY_PALETTE;
+    for (uint16_t &color : colors) {
+        color = (color >> 8) | (color << 8);
+    }
+    buildCanvasPalette(colors, sizeof(colors) / sizeof(colors[0]), palette);
+}
+
+void TftFramebuffer::begin() {
+    // Initialize TFT
+    tft.init();
+    tft.setRotation(1); // Landscape
+    tft.fillScreen(TFT_BLACK);
+    ledcSetup(BACKLIGHT_PWM_CHANNEL, 5000, 8);
+    ledcAttachPin(BACKLIGHT_PIN, BACKLIGHT_PWM_CHANNEL);
+    ledcWrite(BACKLIGHT_PWM_CHANNEL, backlight);
+
+    // DMA staging buffers must live in DMA capable internal RAM
+    for (int i = 0; i < 2; i++) {
+        dmaBuffer[i] = (uint16_t *) heap_caps_malloc(DISPLAY_WIDTH * DISPLAY_DMA_STRIP_ROWS * sizeof(uint16_t),
+                                                     MALLOC_CAP_DMA);
+    }
+    if (dmaBuffer[0] == nullptr || dmaBuffer[1] == nullptr) {
+        // pushRegion() falls back to blocking sprite pushes
+        heap_caps_free(dmaBuffer[0]);
+        heap_caps_free(dmaBuffer[1]);
+        dmaBuffer[0] = nullptr;
+        dmaBuffer[1] = nullptr;
+        logEvent(LOG_DISPLAY_DMA_FAILED);
+        return;
+    }
+    tft.initDMA();
+}
+
+Canvas *TftFramebuffer::createCanvas(int16_t width, int16_t height) {
+    TFT_eSprite *sprite = new TFT_eSprite(&tft);
+    sprite->setColorDepth(DISPLAY_COLOR_DEPTH);
+    sprite->createSprite(width, height);
+#if DISPLAY_COLOR_DEPTH == 4
+    // Only used by readPixel() and pushSprite(), pushRegion() expands with its own table
+    const uint16_t colors[] = DISPLAY_PALETTE;
+    sprite->createPalette(colors, sizeof(colors) / sizeof(colors[0]));
+#endif
+    canvasBytes += width * height * DISPLAY_COLOR_DEPTH / 8;
+    return sprite;
+}
+
+size_t TftFramebuffer::getCanvasBytes() const {
+    return canvasBytes;
+}
+
+void TftFramebuffer::startFrame() {
+    tft.startWrite();
+}
+
+void TftFramebuffer::pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t x, int16_t y) {
+    if (dmaBuffer[0] == nullptr) {
+        canvas.pushSprite(x, y, sx, sy, w, h);
+        return;
+    }
+    // Copy the window into a contiguous RGB565 strip, then queue it; pushImageDMA waits for the
+    // previous strip, so copying (and the caller's rendering) overlaps the transfer
+    for (int16_t row = 0; row < h; row += DISPLAY_DMA_STRIP_ROWS) {
+        int16_t rows = min((int16_t) DISPLAY_DMA_STRIP_ROWS, (int16_t) (h - row));
+        uint16_t *strip = dmaBuffer[dmaBufferIndex];
+        for (int16_t r = 0; r < rows; r++) {
+            expandCanvasRow(canvas, sx, sy + row + r, w, palette, strip + r * w);
+        }
+        tft.pushImageDMA(x, y + row, w, rows, strip);
+        dmaBufferIndex ^= 1;
+    }
+}
+
+void TftFramebuffer::endFrame() {
+    tft.dmaWait();
+    tft.endWrite();
+}
+
+void TftFramebuffer::setBacklight(uint8_t level) {
+    if (level == backlight) {
+        return;
+    }
+    if (level == 0) {
+        ledcWrite(BACKLIGHT_PWM_CHANNEL, 0);
+        tft.writecommand(TFT_SLPIN);
+    } else {
+        if (backlight == 0) {
+            // The panel takes 5 ms to accept commands again, its picture is back at once
+            tft.writecommand(TFT_SLPOUT);
+            ::delay(5);
+        }
+        ledcWrite(BACKLIGHT_PWM_CHANNEL, level);
+    }
+    backlight = level;
+}
@@ -0,0 +1,71 @@
+#include "history_receiver.h"
+
+HistoryReceiver::HistoryReceiver() :
+        started(false),
+        nextSequence(0),
+        received(0),
+        recovered(0),
+        lost(0),
+        corrupt(0),
+        restarts(0) {
+}
+
+int HistoryReceiver::receive(const uint8_t *buffer, size_t length, control_frame *out) {
+    history_frame frame;
+    if (decodeHistoryFrame(buffer, length, frame) != DECODE_OK) {
+        corrupt++;
+        return 0;
+    }
+
+    uint16_t newest = frame.samples[0].sequence;
+    if (!started) {
+        // Whatever came before the first frame heard is of no use anymore
+        started = true;
+        nextSequence = newest;
+    }
+
+    // Sequence numbers wrap, anything at or behind the last delivered one is stale. Further back than
+    // any history reaches, the sender restarted its count: start over from this frame.
+    int32_t missing = (int16_t) (newest - nextSequence);
+    if (missing < -HISTORY_MAX_SAMPLES) {
+        restarts++;
+        nextSequence = newest;
+        missing = 0;
+    } else if (missing < 0) {
+        return 0;
+    }
+    if (missing >= frame.count) {
+        lost += missing - (frame.count - 1);
+        missing = frame.count - 1;
+    }
+
+    // samples[missing] is the oldest one not delivered yet
+    int written = 0;
+    for (int i = missing; i >= 0; i--) {
+        out[written++] = frame.samples[i];
+    }
+    recovered += missing;
+    received++;
+    nextSequence = newest + 1;
+    return written;
+}
+
+uint32_t HistoryReceiver::getReceived() const {
+    return received;
+}
+
+uint32_t HistoryReceiver::getRecovered() const {
+    return recovered;
+}
+
+uint32_t HistoryReceiver::getLost() const {
+    return lost;
+}
+
+uint32_t HistoryReceiver::getCorrupt() const {
+    return corrupt;
+}
+
+uint32_t HistoryReceiver::getRestarts() const {
+    return restarts;
+}
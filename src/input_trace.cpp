@@ -0,0 +1,312 @@
+#include "input_trace.h"
+#include <cstring>
+#include "protocol.h"
+
+static_assert((INPUT_TRACE_BLOCKS & (INPUT_TRACE_BLOCKS - 1)) == 0, "INPUT_TRACE_BLOCKS must be a power of two");
+static_assert(INPUT_TRACE_BLOCK_SIZE <= 0xFFFF + INPUT_TRACE_BLOCK_HEADER, "Block length must fit in 16 bits");
+static_assert(DRIVE_MODE_COUNT <= 4, "The drive mode is stored in 2 bits");
+
+namespace {
+
+const uint8_t TRACE_MAGIC[4] = {'J', 'R', 'E', 'C'};
+
+bool atRest(const struct_message &data) {
+    return data.x == 0 && data.y == 0 && !data.button;
+}
+
+bool sameInput(const input_sample &a, const input_sample &b) {
+    return a.data.x == b.data.x && a.data.y == b.data.y && a.data.button == b.data.button && a.mode == b.mode;
+}
+
+}
+
+InputRecorder::InputRecorder(RecordingStorage &storage) :
+        storage(storage),
+        started(false),
+        startTime(0),
+        blockOpen(false),
+        blockTime(0),
+        last{},
+        previous{},
+        blocks{},
+        head(0),
+        tail(0),
+        opened(false),
+        failed(false),
+        samples(0),
+        bytesWritten(0),
+        dropped(0) {
+}
+
+void InputRecorder::record(uint32_t timeMs, const struct_message &data, DriveMode mode, bool doublePress) {
+    if (!started.load(std::memory_order_relaxed)) {
+        if (atRest(data) && !doublePress) {
+            return;
+        }
+        started.store(true, std::memory_order_relaxed);
+        startTime = timeMs;
+    }
+
+    input_sample sample = {timeMs - startTime, data, mode, doublePress};
+
+    // A block waits at most INPUT_TRACE_FLUSH_INTERVAL, even while the stick does not move
+    if (blockOpen && sample.timeMs - blockTime >= INPUT_TRACE_FLUSH_INTERVAL) {
+        commitBlock();
+    }
+    if (samples.load(std::memory_order_relaxed) > 0 && sameInput(sample, last) && !doublePress) {
+        return;
+    }
+    if (blockOpen && blocks[head.load(std::memory_order_relaxed) & (INPUT_TRACE_BLOCKS - 1)].length +
+                     INPUT_TRACE_SAMPLE_MAX_SIZE > INPUT_TRACE_BLOCK_SIZE) {
+        commitBlock();
+    }
+    if (!blockOpen && !openBlock(sample.timeMs)) {
+        // The writer is behind; keep comparing against the last stored sample so this one is retried
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Block &block = blocks[head.load(std::memory_order_relaxed) & (INPUT_TRACE_BLOCKS - 1)];
+    uint8_t *p = block.data + block.length;
+    uint32_t flags = (sample.data.button ? 0x1 : 0) | (doublePress ? 0x2 : 0) | ((uint32_t) (mode & 0x3) << 2);
+    size_t n = putVarint(p, ((sample.timeMs - previous.timeMs) << 4) | flags);
+    n += putVarint(p + n, zigzag(sample.data.x - previous.data.x));
+    n += putVarint(p + n, zigzag(sample.data.y - previous.data.y));
+    block.length += n;
+    block.samples++;
+    previous = sample;
+    last = sample;
+    samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool InputRecorder::openBlock(uint32_t time) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= INPUT_TRACE_BLOCKS) {
+        return false;
+    }
+    Block &block = blocks[h & (INPUT_TRACE_BLOCKS - 1)];
+    block.length = INPUT_TRACE_BLOCK_HEADER;
+    block.samples = 0;
+    blockOpen = true;
+    blockTime = time;
+    previous = {time, {0, 0, false}, DRIVE_MODE_RACE, false};
+    return true;
+}
+
+void InputRecorder::commitBlock() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    Block &block = blocks[h & (INPUT_TRACE_BLOCKS - 1)];
+    putU16(block.data, (uint16_t) (block.length - INPUT_TRACE_BLOCK_HEADER));
+    putU32(block.data + 2, blockTime);
+    blockOpen = false;
+    head.store(h + 1, std::memory_order_release);
+}
+
+void InputRecorder::flush() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    while (t != head.load(std::memory_order_acquire)) {
+        const Block &block = blocks[t & (INPUT_TRACE_BLOCKS - 1)];
+
+        // The previous recording is only replaced once the first block is ready
+        if (!opened && !failed) {
+            uint8_t header[INPUT_TRACE_HEADER_SIZE];
+            memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+            header[4] = INPUT_TRACE_VERSION;
+            opened = storage.openWrite() && storage.write(header, sizeof(header));
+            failed = !opened;
+            if (opened) {
+                bytesWritten.fetch_add(sizeof(header), std::memory_order_relaxed);
+            }
+        }
+
+        uint32_t written = bytesWritten.load(std::memory_order_relaxed);
+        if (failed || written + block.length > INPUT_TRACE_MAX_SIZE || !storage.write(block.data, block.length)) {
+            dropped.fetch_add(block.samples, std::memory_order_relaxed);
+        } else {
+            bytesWritten.store(written + block.length, std::memory_order_relaxed);
+        }
+        tail.store(++t, std::memory_order_release);
+    }
+}
+
+bool InputRecorder::isStarted() const {
+    return started.load(std::memory_order_relaxed);
+}
+
+uint32_t InputRecorder::getSamples() const {
+    return samples.load(std::memory_order_relaxed);
+}
+
+uint32_t InputRecorder::getBytesWritten() const {
+    return bytesWritten.load(std::memory_order_relaxed);
+}
+
+uint32_t InputRecorder::getDropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+InputPlayer::InputPlayer(RecordingStorage &storage) :
+        storage(storage),
+        blocks{},
+        head(0),
+        tail(0),
+        exhausted(true),
+        block(nullptr),
+        position(0),
+        ended(true),
+        failed(false),
+        hasNext(false),
+        current{0, {0, 0, false}, DEFAULT_DRIVE_MODE, false},
+        next{},
+        samples(0),
+        underruns(0),
+        corrupt(0) {
+}
+
+bool InputPlayer::begin() {
+    uint8_t header[INPUT_TRACE_HEADER_SIZE];
+    if (!storage.openRead() || storage.read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header[4] != INPUT_TRACE_VERSION) {
+        return false;
+    }
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    exhausted.store(false, std::memory_order_relaxed);
+    block = nullptr;
+    position = 0;
+    ended = false;
+    failed = false;
+    prefetch();
+    hasNext = decodeNext();
+    return true;
+}
+
+void InputPlayer::prefetch() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    while (!exhausted.load(std::memory_order_relaxed) &&
+           h - tail.load(std::memory_order_acquire) < INPUT_TRACE_BLOCKS) {
+        Block &slot = blocks[h & (INPUT_TRACE_BLOCKS - 1)];
+        uint8_t header[INPUT_TRACE_BLOCK_HEADER];
+        size_t got = storage.read(header, sizeof(header));
+        uint16_t length = got == sizeof(header) ? getU16(header) : 0;
+        if (length == 0 || length > INPUT_TRACE_BLOCK_SIZE - INPUT_TRACE_BLOCK_HEADER ||
+            storage.read(slot.data, length) != length) {
+            // The end of the recording, or a block cut short
+            if (got != 0) {
+                corrupt.fetch_add(1, std::memory_order_relaxed);
+            }
+            storage.close();
+            exhausted.store(true, std::memory_order_release);
+            return;
+        }
+        slot.length = length;
+        slot.time = getU32(header + 2);
+        head.store(++h, std::memory_order_release);
+    }
+}
+
+bool InputPlayer::loadBlock() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (block != nullptr) {
+        // Done with it, the reader may refill the slot
+        tail.store(++t, std::memory_order_release);
+        block = nullptr;
+    }
+    if (t == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    block = &blocks[t & (INPUT_TRACE_BLOCKS - 1)];
+    position = 0;
+    next = {block->time, {0, 0, false}, DRIVE_MODE_RACE, false};
+    return true;
+}
+
+void InputPlayer::fail() {
+    corrupt.fetch_add(1, std::memory_order_relaxed);
+    failed = true;
+}
+
+bool InputPlayer::decodeNext() {
+    if ((block == nullptr || position == block->length) && !loadBlock()) {
+        return false;
+    }
+
+    const uint8_t *p = block->data + position;
+    const uint8_t *end = block->data + block->length;
+    uint32_t timeAndFlags;
+    uint32_t dx;
+    uint32_t dy;
+    size_t used;
+    if ((used = getVarint(p, end, timeAndFlags)) == 0) {
+        fail();
+        return false;
+    }
+    p += used;
+    if ((used = getVarint(p, end, dx)) == 0) {
+        fail();
+        return false;
+    }
+    p += used;
+    if ((used = getVarint(p, end, dy)) == 0) {
+        fail();
+        return false;
+    }
+    p += used;
+    position = p - block->data;
+
+    uint8_t flags = timeAndFlags & 0x0F;
+    next.timeMs += timeAndFlags >> 4;
+    next.data.x += unzigzag(dx);
+    next.data.y += unzigzag(dy);
+    next.data.button = flags & 0x1;
+    next.doublePress = flags & 0x2;
+    uint8_t mode = (flags >> 2) & 0x3;
+    next.mode = mode < DRIVE_MODE_COUNT ? (DriveMode) mode : DEFAULT_DRIVE_MODE;
+    return true;
+}
+
+bool InputPlayer::read(uint32_t timeMs, input_sample &sample) {
+    current.doublePress = false;
+    if (!hasNext && !ended && !failed) {
+        // The reader was behind at the last call
+        hasNext = decodeNext();
+    }
+    while (hasNext && next.timeMs <= timeMs) {
+        bool doublePress = current.doublePress || next.doublePress;
+        current = next;
+        current.doublePress = doublePress;
+        samples++;
+        hasNext = decodeNext();
+    }
+
+    // Checked after the ring, the reader sets it once its last block is in
+    bool over = failed || (exhausted.load(std::memory_order_acquire) && !hasNext &&
+                           tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire));
+    if (!hasNext && !ended && !over) {
+        underruns++;
+    }
+    if (!hasNext && !ended && over) {
+        // Release the stick after the last sample rather than keep driving on it
+        ended = true;
+        sample = current;
+        return true;
+    }
+    if (ended) {
+        current.data = {0, 0, false};
+        current.doublePress = false;
+    }
+    sample = current;
+    return !ended;
+}
+
+uint32_t InputPlayer::getSamples() const {
+    return samples;
+}
+
+uint32_t InputPlayer::getCorrupt() const {
+    return corrupt.load(std::memory_order_relaxed);
+}
+
+uint32_t InputPlayer::getUnderruns() const {
+    return underruns;
+}
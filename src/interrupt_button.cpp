@@ -0,0 +1,67 @@
+#include "interrupt_button.h"
+
+InterruptButton *InterruptButton::instance = nullptr;
+
+InterruptButton::InterruptButton() :
+        debounceTimer(nullptr),
+        edges(),
+        pressed(false),
+        masked(false) {
+    instance = this;
+}
+
+bool InterruptButton::begin() {
+    pinMode(SW_PIN, INPUT_PULLUP);
+    pressed = !digitalRead(SW_PIN);
+
+    // 1 us ticks, one-shot alarm re-armed by every reported edge
+    debounceTimer = timerBegin(BUTTON_TIMER, 80, true);
+    if (debounceTimer == nullptr) {
+        return false;
+    }
+    timerAttachInterrupt(debounceTimer, onDebounceTimer, false); // Level: edge timer interrupts are not supported
+    timerAlarmWrite(debounceTimer, BUTTON_DEBOUNCE_US, false);
+
+    // Both interrupts are allocated on this core and do not nest, so the ring has a single producer
+    attachInterrupt(digitalPinToInterrupt(SW_PIN), onEdge, CHANGE);
+    return true;
+}
+
+bool InterruptButton::readEdge(button_edge &edge) {
+    return edges.pop(edge);
+}
+
+bool InterruptButton::isPressed() const {
+    return pressed;
+}
+
+void InterruptButton::resync() {
+    // Through the timer interrupt, which keeps the ring single producer
+    timerWrite(debounceTimer, BUTTON_DEBOUNCE_US - 1);
+    timerAlarmEnable(debounceTimer);
+}
+
+void IRAM_ATTR InterruptButton::report(bool level) {
+    pressed = level;
+    edges.push({(uint32_t) micros(), level});
+    masked = true;
+    timerWrite(debounceTimer, 0);
+    timerAlarmEnable(debounceTimer);
+}
+
+void IRAM_ATTR InterruptButton::onEdge() {
+    // Bounces after a reported edge are left to the timer
+    bool level = !digitalRead(SW_PIN);
+    if (!instance->masked && level != instance->pressed) {
+        instance->report(level);
+    }
+}
+
+void IRAM_ATTR InterruptButton::onDebounceTimer() {
+    // The contact has settled; a level that differs from the last report changed while masked
+    instance->masked = false;
+    bool level = !digitalRead(SW_PIN);
+    if (level != instance->pressed) {
+        instance->report(level);
+    }
+}
@@ -1,67 +1,196 @@
 #include "joystick.h"
+#include <algorithm>
+#include <cstdlib>
 
-Joystick::Joystick() :
+Joystick::Joystick(JoystickInput &input, ButtonInput &button, Clock &clock, CalibrationStore &store) :
+        input(input),
+        button(button),
+        clock(clock),
+        store(store),
         xCenter(JOYSTICK_RAW_MAX / 2),
         yCenter(JOYSTICK_RAW_MAX / 2),
         xMin(JOYSTICK_RAW_MIN),
         xMax(JOYSTICK_RAW_MAX),
         yMin(JOYSTICK_RAW_MIN),
         yMax(JOYSTICK_RAW_MAX),
-        speed(0) {
+        speed(0),
+        xScaleLow(0),
+        xScaleHigh(0),
+        yScaleLow(0),
+        yScaleHigh(0),
+        mode(DEFAULT_DRIVE_MODE),
+        buttonDown(false),
+        pressTimeUs(0),
+        modeSwitched(false),
+        releasePending(false),
+        lastReleaseTimeUs(0),
+        doublePresses(0),
+        buttonEvents(),
+        restStartTime(0),
+        driftX(0),
+        driftY(0),
+        calibrationLock(),
+        pendingCalibration{},
+        calibrationPending(false) {
+    updateScales();
     data.x = 0;
     data.y = 0;
     data.button = false;
 }
 
 void Joystick::begin() {
-    pinMode(SW_PIN, INPUT_PULLUP);
-    calibrate();
+    input.begin();
+    button.begin();
+
+    // Give the sampler time to produce its first filtered values
+    clock.delay(JOYSTICK_SETTLE_TIME);
+    input.poll();
+
+    // Holding the button at power-on forces a new calibration
+    joystick_calibration stored;
+    if (FAST_BOOT && !button.isPressed() && store.load(stored)) {
+        setCalibration(stored);
+    } else {
+        calibrate();
+    }
 }
 
 void Joystick::calibrate() {
-    Serial.println("Starting joystick calibration...");
     int sum_x = 0;
     int sum_y = 0;
     for (int i = 0; i < NUM_CALIBRATIONS; ++i) {
-        sum_x += analogRead(VRX_PIN);
-        sum_y += analogRead(VRY_PIN);
-        delay(10);
+        clock.delay(10);
+        input.poll();
+        sum_x += input.getX();
+        sum_y += input.getY();
     }
     xCenter = sum_x / NUM_CALIBRATIONS;
     yCenter = sum_y / NUM_CALIBRATIONS;
+    updateScales();
+    store.save(getCalibration());
+}
 
-    Serial.println("Calibration complete.");
-    Serial.print("xCenter: ");
-    Serial.println(xCenter);
-    Serial.print("yCenter: ");
-    Serial.println(yCenter);
+void Joystick::updateScales() {
+    xScaleLow = scaleFor(xCenter - xMin);
+    xScaleHigh = scaleFor(xMax - xCenter);
+    yScaleLow = scaleFor(yCenter - yMin);
+    yScaleHigh = scaleFor(yMax - yCenter);
 }
 
-int Joystick::applyDeadzone(int value, int deadzone) {
-    return abs(value) < deadzone ? 0 : value;
+int32_t Joystick::scaleFor(int span) {
+    // Computed once per calibration so read() needs no division
+    return ((int32_t) CURVE_CENTER << CURVE_SCALE_SHIFT) / std::max(span, CURVE_MIN_SPAN);
 }
 
-int Joystick::mapJoystickToRange(int value, int valueMin, int valueMax, int valueCenter, int outMin, int outMax) {
-    if (value < valueCenter) {
-        return map(value, valueMin, valueCenter, outMin, 0);
-    } else {
-        return map(value, valueCenter, valueMax, 0, outMax);
+int Joystick::curveIndex(int raw, int center, int32_t scaleLow, int32_t scaleHigh) {
+    int offset = raw - center;
+    int32_t scale = offset < 0 ? scaleLow : scaleHigh;
+    int index = CURVE_CENTER + ((offset * scale) >> CURVE_SCALE_SHIFT);
+    return std::min(std::max(index, 0), CURVE_TABLE_SIZE - 1);
+}
+
+void Joystick::handleEdge(const button_edge &edge) {
+    if (edge.pressed == buttonDown) {
+        return;
+    }
+    if (edge.pressed) {
+        buttonDown = true;
+        pressTimeUs = edge.timeUs;
+        buttonEvents.push({BUTTON_EVENT_PRESS, edge.timeUs});
+        return;
+    }
+
+    // A hold released before this read still counts
+    checkLongPress(edge.timeUs);
+    buttonDown = false;
+    buttonEvents.push({BUTTON_EVENT_RELEASE, edge.timeUs});
+
+    // Two short presses released within TARGET_SWITCH_PRESS_TIME make a double press
+    if (!modeSwitched) {
+        if (releasePending && edge.timeUs - lastReleaseTimeUs <= TARGET_SWITCH_PRESS_TIME * 1000UL) {
+            doublePresses++;
+            releasePending = false;
+            buttonEvents.push({BUTTON_EVENT_DOUBLE_TAP, edge.timeUs});
+        } else {
+            releasePending = true;
+            lastReleaseTimeUs = edge.timeUs;
+        }
+    }
+    modeSwitched = false;
+}
+
+void Joystick::checkLongPress(uint32_t nowUs) {
+    // Holding the button for MODE_SWITCH_HOLD_TIME cycles through the drive modes
+    uint32_t holdUs = MODE_SWITCH_HOLD_TIME * 1000UL;
+    if (buttonDown && !modeSwitched && nowUs - pressTimeUs >= holdUs) {
+        mode = nextDriveMode(mode);
+        modeSwitched = true;
+        buttonEvents.push({BUTTON_EVENT_LONG_PRESS, pressTimeUs + holdUs});
+    }
+}
+
+void Joystick::trackDrift(int rawX, int rawY, bool pressed) {
+    unsigned long now = clock.millis();
+    if (data.x != 0 || data.y != 0 || pressed) {
+        restStartTime = now;
+        driftX = 0;
+        driftY = 0;
+        return;
+    }
+
+    // Average the rest offset; once it settles away from the center, move the center there
+    driftX += (((rawX - xCenter) << 4) - driftX) >> JOYSTICK_DRIFT_FILTER_SHIFT;
+    driftY += (((rawY - yCenter) << 4) - driftY) >> JOYSTICK_DRIFT_FILTER_SHIFT;
+    if (now - restStartTime < JOYSTICK_DRIFT_SETTLE_TIME) {
+        return;
+    }
+    if (abs(driftX) > (JOYSTICK_DRIFT_THRESHOLD << 4) || abs(driftY) > (JOYSTICK_DRIFT_THRESHOLD << 4)) {
+        xCenter += driftX >> 4;
+        yCenter += driftY >> 4;
+        updateScales();
+        driftX = 0;
+        driftY = 0;
+        restStartTime = now;
+
+        // A flash write takes milliseconds, the next ticks would wait behind it
+        calibrationLock.lock();
+        pendingCalibration = getCalibration();
+        calibrationPending = true;
+        calibrationLock.unlock();
+    }
+}
+
+void Joystick::saveCalibration() {
+    calibrationLock.lock();
+    bool pending = calibrationPending;
+    joystick_calibration calibration = pendingCalibration;
+    calibrationPending = false;
+    calibrationLock.unlock();
+    if (pending) {
+        store.save(calibration);
     }
 }
 
 void Joystick::read() {
-    int rawX = analogRead(VRX_PIN);
-    int rawY = analogRead(VRY_PIN);
+    input.poll();
+    int rawX = input.getX();
+    int rawY = input.getY();
 
-    int mappedX = mapJoystickToRange(rawX, xMin, xMax, xCenter, JOYSTICK_MIN_RANGE, JOYSTICK_MAX_RANGE);
-    int mappedY = -mapJoystickToRange(rawY, yMin, yMax, yCenter, JOYSTICK_MIN_RANGE, JOYSTICK_MAX_RANGE);
+    // Deadzone and response curve are baked into the table of the current mode
+    const int16_t *curve = driveModeCurve(mode);
+    data.x = curve[curveIndex(rawX, xCenter, xScaleLow, xScaleHigh)];
+    data.y = -curve[curveIndex(rawY, yCenter, yScaleLow, yScaleHigh)];
 
-    data.x = applyDeadzone(mappedX, JOYSTICK_DEADZONE);
-    data.y = applyDeadzone(mappedY, JOYSTICK_DEADZONE);
-    data.button = !digitalRead(SW_PIN);
+    // Edges carry their own time, so a tap between two reads is not lost
+    button_edge edge;
+    while (button.readEdge(edge)) {
+        handleEdge(edge);
+    }
+    checkLongPress(clock.micros());
+    trackDrift(rawX, rawY, buttonDown);
+    data.button = buttonDown;
 
-    // Calculate simulated speed based on joystick Y position
-    speed = map(abs(data.y), 0, JOYSTICK_MAX_RANGE, 0, 100);
+    speed = speedFor(data.y);
 }
 
 struct_message Joystick::getData() const {
@@ -71,3 +200,33 @@ struct_message Joystick::getData() const {
 int Joystick::getSpeed() const {
     return speed;
 }
+
+int Joystick::speedFor(int y) {
+    return abs(y) * 100 / JOYSTICK_MAX_RANGE;
+}
+
+uint32_t Joystick::getDoublePressCount() const {
+    return doublePresses;
+}
+
+bool Joystick::nextButtonEvent(button_event &event) {
+    return buttonEvents.pop(event);
+}
+
+DriveMode Joystick::getMode() const {
+    return mode;
+}
+
+joystick_calibration Joystick::getCalibration() const {
+    return {xCenter, yCenter, xMin, xMax, yMin, yMax};
+}
+
+void Joystick::setCalibration(const joystick_calibration &calibration) {
+    xCenter = calibration.xCenter;
+    yCenter = calibration.yCenter;
+    xMin = calibration.xMin;
+    xMax = calibration.xMax;
+    yMin = calibration.yMin;
+    yMax = calibration.yMax;
+    updateScales();
+}
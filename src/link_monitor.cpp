@@ -0,0 +1,105 @@
+#include "link_monitor.h"
+#include "config.h"
+
+LinkMonitor::LinkMonitor() :
+        window(0),
+        windowSize(0),
+        sent(0),
+        delivered(0),
+        failureBurst(0),
+        maxFailureBurst(0),
+        rssi(0),
+        lastRssiTime(0),
+        rssiHeard(false),
+        ackLatencyUs(0),
+        ackLatencyAvgUs(0),
+        ackLatencyMaxUs(0) {
+}
+
+void LinkMonitor::recordSend(bool success) {
+    window = (window << 1) | (success ? 1 : 0);
+    if (windowSize < LINK_WINDOW_SIZE) {
+        windowSize++;
+    }
+
+    sent++;
+    if (success) {
+        delivered++;
+        failureBurst = 0;
+    } else {
+        failureBurst++;
+        if (failureBurst > maxFailureBurst) {
+            maxFailureBurst = failureBurst;
+        }
+    }
+}
+
+void LinkMonitor::recordRssi(int8_t value, unsigned long now) {
+    rssi = value;
+    lastRssiTime = now;
+    rssiHeard = true;
+}
+
+void LinkMonitor::recordAckLatency(uint32_t latencyUs) {
+    ackLatencyUs = latencyUs;
+    ackLatencyAvgUs = ackLatencyAvgUs == 0 ? latencyUs : ackLatencyAvgUs - (ackLatencyAvgUs >> 3) + (latencyUs >> 3);
+    if (latencyUs > ackLatencyMaxUs) {
+        ackLatencyMaxUs = latencyUs;
+    }
+}
+
+uint8_t LinkMonitor::getDeliveryRatio() const {
+    if (windowSize == 0) {
+        return 0;
+    }
+    return (uint8_t) (windowDelivered() * 100 / windowSize);
+}
+
+uint8_t LinkMonitor::getLevel(unsigned long now) const {
+    // A burst of failures means the car is not getting commands, whatever the average says
+    if (windowSize == 0 || failureBurst >= LINK_FAILURE_BURST) {
+        return 0;
+    }
+
+    uint8_t ratio = getDeliveryRatio();
+    uint8_t level = ratio >= 95 ? 5 : ratio >= 85 ? 4 : ratio >= 70 ? 3 : ratio >= 50 ? 2 : ratio > 0 ? 1 : 0;
+
+    // RSSI drops before frames do, so it caps the level when we have a recent reading
+    if (rssiFresh(now)) {
+        uint8_t rssiLevel = rssi >= -60 ? 5 : rssi >= -70 ? 4 : rssi >= -78 ? 3 : rssi >= -85 ? 2 : 1;
+        if (rssiLevel < level) {
+            level = rssiLevel;
+        }
+    }
+    return level > MAX_SIGNAL_STRENGTH ? MAX_SIGNAL_STRENGTH : level;
+}
+
+link_stats LinkMonitor::getStats(unsigned long now) const {
+    link_stats stats;
+    stats.sent = sent;
+    stats.delivered = delivered;
+    stats.failed = sent - delivered;
+    stats.windowSize = windowSize;
+    stats.windowDelivered = windowDelivered();
+    stats.failureBurst = failureBurst;
+    stats.maxFailureBurst = maxFailureBurst;
+    stats.rssi = rssi;
+    stats.rssiValid = rssiFresh(now);
+    stats.level = getLevel(now);
+    stats.ackLatencyUs = ackLatencyUs;
+    stats.ackLatencyAvgUs = ackLatencyAvgUs;
+    stats.ackLatencyMaxUs = ackLatencyMaxUs;
+    stats.sendErrors = 0;
+    stats.eventsDropped = 0;
+    stats.rejected = 0;
+    return stats;
+}
+
+uint8_t LinkMonitor::windowDelivered() const {
+    uint32_t mask = windowSize >= 32 ? 0xFFFFFFFFu : ((1u << windowSize) - 1);
+    return (uint8_t) __builtin_popcount(window & mask);
+}
+
+bool LinkMonitor::rssiFresh(unsigned long now) const {
+    return rssiHeard && now - lastRssiTime < LINK_RSSI_MAX_AGE;
+}
@@ -0,0 +1,151 @@
+#include "loop_profiler.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char *const STAGE_NAMES[STAGE_COUNT] = {"read", "send", "display", "loop", "send_interval"};
+
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint32_t value) {
+    buckets[bucketFor(value)]++;
+    if (count == 0 || value < min) {
+        min = value;
+    }
+    if (value > max) {
+        max = value;
+    }
+    count++;
+}
+
+void LatencyHistogram::reset() {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    min = 0;
+    max = 0;
+}
+
+uint32_t LatencyHistogram::getCount() const {
+    return count;
+}
+
+uint32_t LatencyHistogram::getMin() const {
+    return min;
+}
+
+uint32_t LatencyHistogram::getMax() const {
+    return max;
+}
+
+uint32_t LatencyHistogram::percentile(uint16_t perMille) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint32_t target = (uint32_t) (((uint64_t) count * perMille + 999) / 1000);
+    uint32_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            uint32_t value = bucketMidpoint(i);
+            return value < min ? min : value > max ? max : value;
+        }
+    }
+    return max;
+}
+
+int LatencyHistogram::bucketFor(uint32_t value) {
+    if (value < 4) {
+        return (int) value;
+    }
+    int msb = 31 - __builtin_clz(value);
+    return (msb - 1) * 4 + (int) ((value >> (msb - 2)) & 3);
+}
+
+uint32_t LatencyHistogram::bucketMidpoint(int index) {
+    if (index < 4) {
+        return (uint32_t) index;
+    }
+    int msb = index / 4 + 1;
+    uint32_t low = (uint32_t) (4 + index % 4) << (msb - 2);
+    return low + ((1u << (msb - 2)) >> 1);
+}
+
+LoopProfiler::LoopProfiler() :
+        histogramLock(),
+        histograms(),
+        cyclesPerUs(0),
+        loopStart(0),
+        stageStart(0),
+        lastFramesSent(0),
+        lastSendUs(0),
+        sendSeen(false),
+        lastReportMs(0) {
+}
+
+void LoopProfiler::startLoop(uint32_t cyclesPerUs) {
+    this->cyclesPerUs.store(cyclesPerUs, std::memory_order_relaxed);
+    loopStart = readCycleCount();
+    stageStart = loopStart;
+}
+
+void LoopProfiler::endStage(LoopStage stage) {
+    uint32_t now = readCycleCount();
+    recordStage(stage, now - stageStart);
+    stageStart = now;
+}
+
+void LoopProfiler::recordStage(LoopStage stage, uint32_t cycles) {
+    uint32_t mhz = cyclesPerUs.load(std::memory_order_relaxed);
+    if (mhz == 0) {
+        return; // Before the first loop, the clock is not known yet
+    }
+    recordNs(stage, (uint64_t) cycles * 1000 / mhz);
+}
+
+void LoopProfiler::endLoop(uint32_t framesSent, uint32_t nowUs) {
+    recordStage(STAGE_LOOP, readCycleCount() - loopStart);
+
+    if (framesSent != lastFramesSent) {
+        if (sendSeen) {
+            recordNs(STAGE_SEND_INTERVAL, (uint64_t) (nowUs - lastSendUs) * 1000);
+        }
+        sendSeen = true;
+        lastSendUs = nowUs;
+        lastFramesSent = framesSent;
+    }
+}
+
+void LoopProfiler::recordNs(LoopStage stage, uint64_t ns) {
+    histogramLock.lock();
+    histograms[stage].record(ns > UINT32_MAX ? UINT32_MAX : (uint32_t) ns);
+    histogramLock.unlock();
+}
+
+bool LoopProfiler::reportDue(uint32_t nowMs) const {
+    return nowMs - lastReportMs >= LOOP_REPORT_INTERVAL;
+}
+
+void LoopProfiler::report(LineWriter write, uint32_t nowMs) {
+    char line[96];
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        // Snapshot under the lock, format outside of it
+        histogramLock.lock();
+        LatencyHistogram h = histograms[i];
+        histograms[i].reset();
+        histogramLock.unlock();
+        snprintf(line, sizeof(line), "L,%lu,%s,%lu,%lu,%lu,%lu,%lu",
+                 (unsigned long) nowMs, STAGE_NAMES[i], (unsigned long) h.getCount(),
+                 (unsigned long) (h.getMin() / 1000),
+                 (unsigned long) (h.percentile(500) / 1000),
+                 (unsigned long) (h.percentile(990) / 1000),
+                 (unsigned long) (h.getMax() / 1000));
+        write(line);
+    }
+    lastReportMs = nowMs;
+}
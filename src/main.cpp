@@ -1,44 +1,365 @@
 #include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
 #include "joystick.h"
 #include "display.h"
 #include "coms.h"
 #include "config.h"
+#include "hal_esp32.h"
+#include "adc_sampler.h"
+#include "interrupt_button.h"
+#include "scheduler.h"
+#include "input_trace.h"
+#include "power_manager.h"
+#include "event_log.h"
+#include "secrets.h" // Contains RECEIVER_MAC_ADDRESSES and the link keys
+#if LOOP_INSTRUMENTATION
+#include "loop_profiler.h"
+#endif
 
-Joystick joystick;
-Display display;
-Communication communication;
-String mode = DEFAULT_MODE;
+EspClock systemClock;
+EventLog eventLog(systemClock);
+AdcSampler joystickInput;
+InterruptButton joystickButton;
+EspNowRadio radio;
+TftFramebuffer framebuffer;
+NvsCalibrationStore calibrationStore;
+EspPowerControl powerControl;
+
+Joystick joystick(joystickInput, joystickButton, systemClock, calibrationStore);
+Display display(framebuffer, systemClock);
+Communication communication(radio, systemClock);
+// Swap for FixedRatePolicy(SEND_INTERVAL) or OnChangePolicy(...) to compare latency and airtime
+HybridPolicy sendPolicy(SEND_CHANGE_THRESHOLD, SEND_MIN_INTERVAL, SEND_INTERVAL, SEND_KEEPALIVE_INTERVAL);
+
+Scheduler scheduler(systemClock);
+PowerManager power(powerControl, systemClock);
+int controlTask = -1;
+
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+LittleFsRecordingStorage recordingStorage(INPUT_TRACE_PATH);
+InputRecorder recorder(recordingStorage);
+#elif INPUT_TRACE_MODE == INPUT_TRACE_REPLAY
+LittleFsRecordingStorage recordingStorage(INPUT_TRACE_PATH);
+InputPlayer player(recordingStorage);
+uint32_t replayStartTime = 0;
+#endif
+
+// Latest control state, published by the control task for the UI task
+typedef struct ui_snapshot {
+    struct_message joystickData;
+    int signalStrength;
+    int speed;
+    DriveMode mode;
+    int target;
+    rtt_stats rtt;
+    uint8_t backlight;
+} ui_snapshot;
+
+SpinLock uiLock;
+ui_snapshot uiState;
+uint32_t lastDoublePressCount = 0;
+bool firstFrameReported = false;
+bool displayMemoryReported = false;
+bool epochMissing = false;  // LINK_AUTH_MAC without a stored boot epoch
+
+#if LOOP_INSTRUMENTATION
+LoopProfiler loopProfiler;
+#endif
+
+void writeLine(const char *line) {
+    Serial.println(line);
+}
+
+// Tenths of a millisecond below 10 ms, whole milliseconds above
+void formatMs(char *text, size_t size, uint32_t us) {
+    if (us < 10000) {
+        snprintf(text, size, "%lu.%lu", (unsigned long) (us / 1000), (unsigned long) (us / 100 % 10));
+    } else {
+        snprintf(text, size, "%lu", (unsigned long) ((us + 500) / 1000));
+    }
+}
+
+// Sample the stick and hand the frame to the radio, CONTROL_PERIOD_US
+void controlTick(void *) {
+    uint32_t tickStart = micros();
+    bool buttonActivity = false;
+#if LOOP_INSTRUMENTATION
+    loopProfiler.startLoop(getCpuFrequencyMhz());
+#endif
+
+#if INPUT_TRACE_MODE == INPUT_TRACE_REPLAY
+    // The recording stands in for the stick, which is released once it is over
+    input_sample sample;
+    player.read(millis() - replayStartTime, sample);
+    struct_message data = sample.data;
+    DriveMode mode = sample.mode;
+    bool doublePress = sample.doublePress;
+    buttonActivity = data.button;
+#else
+    // Read joystick input
+    joystick.read();
+    struct_message data = joystick.getData();
+    DriveMode mode = joystick.getMode();
+    bool doublePress = joystick.getDoublePressCount() != lastDoublePressCount;
+    lastDoublePressCount = joystick.getDoublePressCount();
+
+    // Button events go out on their own, before the target can change with a double press
+    button_event buttonEvent;
+    while (joystick.nextButtonEvent(buttonEvent)) {
+        communication.sendButtonEvent(buttonEvent);
+        buttonActivity = true;
+    }
+#endif
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+    recorder.record(millis(), data, mode, doublePress);
+#endif
+#if LOOP_INSTRUMENTATION
+    loopProfiler.endStage(STAGE_READ);
+#endif
+
+    // A double press moves control to the next car
+    if (doublePress) {
+        communication.selectNextTarget();
+    }
+
+    // Send data to receiver
+    communication.send(data);
+#if LOOP_INSTRUMENTATION
+    loopProfiler.endStage(STAGE_SEND);
+    loopProfiler.endLoop(communication.getFramesSent(), micros());
+#endif
+
+    // A move or a button event keeps the controller awake, see power_manager.h
+    bool active = buttonActivity || abs(data.x) > POWER_ACTIVITY_THRESHOLD || abs(data.y) > POWER_ACTIVITY_THRESHOLD;
+    if (power.update(active, communication.getFramesSent())) {
+        scheduler.setPeriod(controlTask, power.getControlPeriodUs());
+    }
+
+    ui_snapshot snapshot = {data, communication.getSignalStrength(), Joystick::speedFor(data.y), mode,
+                            communication.getTarget(), communication.getRttStats(), power.getBacklight()};
+    uiLock.lock();
+    uiState = snapshot;
+    uiLock.unlock();
+
+    // In standby, sleep until shortly before the next tick; a press cuts it short. Not before the radio
+    // reported the frames of this tick, their completions would be lost with the radio off.
+    while (power.getState() == POWER_STANDBY && communication.hasPendingSends() &&
+           micros() - tickStart < POWER_SEND_WAIT_US) {
+        delay(1);
+    }
+    if (!communication.hasPendingSends() && power.sleepUntilNextTick(tickStart)) {
+        joystickButton.resync();
+        scheduler.setPeriod(controlTask, power.getControlPeriodUs());
+    }
+}
+
+// Publish the latest state to the display task, UI_PERIOD_US
+void uiTick(void *) {
+    uiLock.lock();
+    ui_snapshot snapshot = uiState;
+    uiLock.unlock();
+
+    // "ALL", or the 1-based car number out of the registered ones
+    char target[DISPLAY_TARGET_MAX_LEN];
+    if (epochMissing) {
+        snprintf(target, sizeof(target), "NO AUTH");
+    } else if (snapshot.target == Communication::TARGET_ALL) {
+        snprintf(target, sizeof(target), "ALL");
+    } else {
+        snprintf(target, sizeof(target), "%d/%d", snapshot.target + 1, communication.getPeerCount());
+    }
+
+    // Round trip p50/p99 of the last window, "-" until echoes come back
+    char rtt[DISPLAY_RTT_MAX_LEN] = "";
+    if (RTT_PROBE_INTERVAL > 0 && snapshot.rtt.echoes == 0) {
+        snprintf(rtt, sizeof(rtt), "RTT -");
+    } else if (RTT_PROBE_INTERVAL > 0) {
+        char p50[8];
+        char p99[8];
+        formatMs(p50, sizeof(p50), snapshot.rtt.p50Us);
+        formatMs(p99, sizeof(p99), snapshot.rtt.p99Us);
+        snprintf(rtt, sizeof(rtt), "RTT %s/%sMS", p50, p99);
+    }
+
+#if LOOP_INSTRUMENTATION
+    uint32_t start = readCycleCount();
+#endif
+    display.setBacklight(snapshot.backlight);
+    display.update(snapshot.joystickData, snapshot.signalStrength, snapshot.speed, driveModeName(snapshot.mode),
+                   target, rtt);
+#if LOOP_INSTRUMENTATION
+    loopProfiler.recordStage(STAGE_DISPLAY, readCycleCount() - start);
+#endif
+}
+
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+// Prints the recording as R,<hex> lines, see the README to turn them back into a file
+void dumpRecording() {
+    if (recorder.isStarted()) {
+        Serial.println("R,busy: a new recording has started, reset and dump before moving the stick");
+        return;
+    }
+    if (!recordingStorage.openRead()) {
+        Serial.println("R,none");
+        return;
+    }
+    uint8_t chunk[32];
+    size_t length;
+    while ((length = recordingStorage.read(chunk, sizeof(chunk))) > 0) {
+        Serial.print("R,");
+        for (size_t i = 0; i < length; i++) {
+            Serial.printf("%02x", chunk[i]);
+        }
+        Serial.println();
+    }
+    recordingStorage.close();
+    Serial.println("R,end");
+}
+#endif
+
+// Sends what fits in the UART FIFO, the rest waits in the log for the next pass
+void drainLog() {
+    uint8_t frames[LOG_DRAIN_BYTES];
+    size_t room = std::min<size_t>(std::max(Serial.availableForWrite(), 0), sizeof(frames));
+    size_t length = eventLog.drain(frames, room);
+    if (length > 0) {
+        Serial.write(frames, length);
+    }
+}
 
 void setup() {
     Serial.begin(115200);
+    // Drained from loop() once setup() is done, decode with tools/decode_log.py
+    eventLog.install();
 
-    // Initialize display
-    display.begin();
-
-    // Initialize joystick
+    // Bring up the control path first, its first tick puts a frame on air
     joystick.begin();
+    joystick_calibration calibration = joystick.getCalibration();
+    logEvent(LOG_CALIBRATION, calibration.xCenter, calibration.yCenter);
 
     // Initialize communication
+    communication.setSendPolicy(&sendPolicy);
+    communication.setBroadcast(COMS_BROADCAST);
+#if LINK_AUTH == LINK_AUTH_CCMP
+    communication.setEncryption(ESPNOW_PMK, ESPNOW_LMK);
+#elif LINK_AUTH == LINK_AUTH_MAC
+    NvsBootCounter bootCounter;
+    // Without a stored epoch nothing is signed, the footer shows NO AUTH
+    uint16_t epoch = bootCounter.increment();
+    if (epoch == 0) {
+        logEvent(LOG_EPOCH_NOT_SAVED);
+        epochMissing = true;
+    }
+    communication.setFrameAuthentication(FRAME_MAC_KEY, epoch);
+#endif
     if (!communication.begin()) {
-        Serial.println("Communication initialization failed");
+        logEvent(LOG_COMS_INIT_FAILED);
         // Could display error message here
     }
+    for (const uint8_t *address : RECEIVER_MAC_ADDRESSES) {
+        if (communication.addPeer(address) < 0) {
+            logEvent(LOG_TOO_MANY_RECEIVERS);
+        }
+    }
+#if CHANNEL_SURVEY_DWELL > 0
+    // At power-on only: after a brownout or a crash the cars are being driven and wait for frames
+    if (esp_reset_reason() == ESP_RST_POWERON) {
+        communication.surveyChannels(CHANNEL_SURVEY_DWELL);
+    }
+#endif
+    communication.setChannelHopping(CHANNEL_HOPPING);
+
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+    if (!recordingStorage.begin()) {
+        logEvent(LOG_RECORDING_UNAVAILABLE);
+    }
+#elif INPUT_TRACE_MODE == INPUT_TRACE_REPLAY
+    if (!recordingStorage.begin() || !player.begin()) {
+        logEvent(LOG_NO_RECORDING);
+    }
+    replayStartTime = millis();
+#endif
 
-    Serial.println("Controller initialized");
+    power.setEnabled(POWER_MANAGEMENT);
+    power.begin();
+
+    controlTask = scheduler.addTask("control", controlTick, nullptr, CONTROL_PERIOD_US, CONTROL_TASK_PRIORITY);
+    scheduler.addTask("ui", uiTick, nullptr, UI_PERIOD_US, UI_TASK_PRIORITY);
+    scheduler.begin();
+
+    // Screen init and boot animation continue in the display task
+    display.begin();
+
+    logEvent(LOG_CONTROLLER_READY);
 }
 
 void loop() {
-    // Read joystick input
-    joystick.read();
+    // Control and UI run from the scheduler; this lowest priority task only prints the log and reports
+    delay(REPORT_CHECK_INTERVAL);
+    drainLog();
 
-    // Send data to receiver
-    communication.send(joystick.getData());
-
-    // Update display
-    display.update(
-            joystick.getData(),
-            communication.getSignalStrength(),
-            joystick.getSpeed(),
-            mode
-    );
+    if (!firstFrameReported && communication.getFramesSent() > 0) {
+        logEvent(LOG_FIRST_FRAME, communication.getFirstFrameTime());
+        firstFrameReported = true;
+    }
+
+    // Sprite memory, once the display task has created them
+    display_stats displayStats = display.getStats();
+    if (!displayMemoryReported && displayStats.framesRendered > 0) {
+        logEvent(LOG_DISPLAY_MEMORY, DISPLAY_COLOR_DEPTH, framebuffer.getCanvasBytes(),
+                 heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+        displayMemoryReported = true;
+    }
+
+    if (scheduler.reportDue(millis())) {
+        scheduler.report(writeLine, millis());
+        // D,<uptime ms>,<frames>,<dropped>,<last render us>,<last push us>,<pixels per second>
+        Serial.printf("D,%lu,%lu,%lu,%lu,%lu,%lu\n", millis(), (unsigned long) displayStats.framesRendered,
+                      (unsigned long) displayStats.framesDropped, (unsigned long) displayStats.renderTimeUs,
+                      (unsigned long) displayStats.pushTimeUs, (unsigned long) displayStats.pixelsPerSecond);
+        // B,<uptime ms>,<events>,<delivered>,<retries>,<dropped>,<edge to ack p50 us>,<p99 us>,<max us>
+        button_stats buttonStats = communication.getButtonStats();
+        Serial.printf("B,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", millis(), (unsigned long) buttonStats.events,
+                      (unsigned long) buttonStats.delivered, (unsigned long) buttonStats.retries,
+                      (unsigned long) buttonStats.dropped, (unsigned long) buttonStats.p50Us,
+                      (unsigned long) buttonStats.p99Us, (unsigned long) buttonStats.maxUs);
+        // C,<uptime ms>,<channel>,<hops>,<fallbacks>,<aborted>,<forced>
+        channel_stats channelStats = communication.getChannelStats();
+        Serial.printf("C,%lu,%u,%lu,%lu,%lu,%lu\n", millis(), (unsigned) channelStats.channel,
+                      (unsigned long) channelStats.hops, (unsigned long) channelStats.fallbacks,
+                      (unsigned long) channelStats.aborted, (unsigned long) channelStats.forced);
+        // P,<uptime ms>,<state>,<average uA>,<runtime min>,<sleeps>,<wakeups>
+        power_stats powerStats = power.getStats();
+        Serial.printf("P,%lu,%s,%lu,%lu,%lu,%lu\n", millis(), powerStateName(powerStats.state),
+                      (unsigned long) powerStats.averageCurrentUa, (unsigned long) powerStats.runtimeMinutes,
+                      (unsigned long) powerStats.sleeps, (unsigned long) powerStats.wakeups);
+        // E,<uptime ms>,<records>,<frames sent>,<coalesced>,<dropped>,<bytes>
+        log_stats logStats = eventLog.getStats();
+        Serial.printf("E,%lu,%lu,%lu,%lu,%lu,%lu\n", millis(), (unsigned long) logStats.records,
+                      (unsigned long) logStats.sent, (unsigned long) logStats.coalesced,
+                      (unsigned long) logStats.dropped, (unsigned long) logStats.bytes);
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+        // I,<uptime ms>,<samples recorded>,<bytes written>,<samples dropped>
+        Serial.printf("I,%lu,%lu,%lu,%lu\n", millis(), (unsigned long) recorder.getSamples(),
+                      (unsigned long) recorder.getBytesWritten(), (unsigned long) recorder.getDropped());
+#endif
+    }
+
+    // Flash reads and writes happen here, off the control task
+    joystick.saveCalibration();
+#if INPUT_TRACE_MODE == INPUT_TRACE_RECORD
+    recorder.flush();
+    if (Serial.available() > 0 && Serial.read() == 'd') {
+        dumpRecording();
+    }
+#elif INPUT_TRACE_MODE == INPUT_TRACE_REPLAY
+    player.prefetch();
+#endif
+
+#if LOOP_INSTRUMENTATION
+    if (loopProfiler.reportDue(millis())) {
+        loopProfiler.report(writeLine, millis());
+    }
+#endif
 }
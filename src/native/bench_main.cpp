@@ -0,0 +1,939 @@
+// Host benchmark: runs the control and UI ticks through the scheduler against the fakes and reports
+// the time each stage takes. Build and run with `pio run -e native -t exec`.
+//
+// Usage: program [scheduler wakeups] [control period us] [loss %] [ack latency us] [cars] [recording]
+//
+// A recording dumped from the device (see README) is replayed instead of the scripted one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+#include "fake_hal.h"
+#include "joystick.h"
+#include "display.h"
+#include "coms.h"
+#include "scheduler.h"
+#include "history_receiver.h"
+#include "input_trace.h"
+#include "power_manager.h"
+#include "event_log.h"
+
+namespace {
+
+const uint8_t BENCH_PEERS[][6] = {
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x01},
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x02},
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x03},
+        {0x02, 0x00, 0x00, 0x00, 0x00, 0x04},
+};
+
+// Link keys of the authentication measurement
+const uint8_t BENCH_PMK[16] = {
+        0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x00,
+};
+const uint8_t BENCH_LMK[16] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10,
+};
+const uint8_t BENCH_MAC_KEY[16] = {
+        0x0F, 0x1E, 0x2D, 0x3C, 0x4B, 0x5A, 0x69, 0x78, 0x87, 0x96, 0xA5, 0xB4, 0xC3, 0xD2, 0xE1, 0xF0,
+};
+
+// Idle, slow sweeps, fast zig-zags and a button hold that switches drive mode
+const input_keyframe BENCH_TRACE[] = {
+        {0, 2048, 2048, false},
+        {2000, 2048, 2048, false},
+        {4000, 2048, 4095, false},
+        {6000, 2048, 0, false},
+        {8000, 0, 2048, false},
+        {10000, 4095, 2048, false},
+        {10200, 0, 4095, false},
+        {10400, 4095, 0, false},
+        {10600, 0, 0, false},
+        {10800, 4095, 4095, false},
+        {11000, 2048, 2048, true},
+        {12000, 2048, 2048, false},
+        {15000, 2048, 2048, false},
+};
+
+struct Stage {
+    const char *name;
+    std::vector<uint32_t> samples;
+};
+
+// What the scheduled tasks touch, mirrors the globals of main.cpp
+struct BenchContext {
+    Joystick &joystick;
+    Communication &communication;
+    Display &display;
+    Stage read;
+    Stage send;
+    Stage update;
+    Stage control;
+};
+
+uint32_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Times the pushes of each frame, palette expansion included
+class TimedFramebuffer : public Framebuffer {
+public:
+    explicit TimedFramebuffer(Stage &stage) : stage(stage), frameNs(0) {}
+
+    void begin() override { screen.begin(); }
+
+    Canvas *createCanvas(int16_t width, int16_t height) override { return screen.createCanvas(width, height); }
+
+    size_t getCanvasBytes() const override { return screen.getCanvasBytes(); }
+
+    void startFrame() override { frameNs = 0; }
+
+    void pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t x, int16_t y) override {
+        auto start = std::chrono::steady_clock::now();
+        screen.pushRegion(canvas, sx, sy, w, h, x, y);
+        frameNs += elapsedNs(start);
+    }
+
+    void endFrame() override { stage.samples.push_back(frameNs); }
+
+    void setBacklight(uint8_t level) override { screen.setBacklight(level); }
+
+    MemoryFramebuffer screen;
+
+private:
+    Stage &stage;
+    uint32_t frameNs;
+};
+
+// Times each frame from radio.send to its completion, which comes back in send order per peer
+class AckTimedRadio : public Radio {
+public:
+    AckTimedRadio(SimulatedRadio &radio, const Clock &clock) :
+            radio(radio), clock(clock), onSent(nullptr), onRssi(nullptr), onReceive(nullptr), context(nullptr) {}
+
+    bool begin() override { return radio.begin(); }
+
+    bool setPrimaryKey(const uint8_t *key) override { return radio.setPrimaryKey(key); }
+
+    int addPeer(const uint8_t *address, const uint8_t *localKey) override { return radio.addPeer(address, localKey); }
+
+    bool send(uint8_t peer, const uint8_t *data, size_t length) override {
+        uint32_t now = clock.micros();
+        if (!radio.send(peer, data, length)) {
+            return false;
+        }
+        sendTimes[peer].push_back(now);
+        return true;
+    }
+
+    bool setChannel(uint8_t channel) override { return radio.setChannel(channel); }
+
+    bool survey(uint8_t channel, uint32_t dwell, channel_survey &result) override {
+        return radio.survey(channel, dwell, result);
+    }
+
+    void setCallbacks(SendCallback sent, RssiCallback rssi, ReceiveCallback receive, void *callbackContext) override {
+        onSent = sent;
+        onRssi = rssi;
+        onReceive = receive;
+        context = callbackContext;
+        radio.setCallbacks(forwardSent, forwardRssi, forwardReceive, this);
+    }
+
+    LatencyHistogram ackLatency;
+
+private:
+    SimulatedRadio &radio;
+    const Clock &clock;
+    SendCallback onSent;
+    RssiCallback onRssi;
+    ReceiveCallback onReceive;
+    void *context;
+    std::deque<uint32_t> sendTimes[RADIO_MAX_PEERS];
+
+    static void forwardSent(void *self, uint8_t peer, bool delivered) {
+        AckTimedRadio &timed = *static_cast<AckTimedRadio *>(self);
+        timed.ackLatency.record(timed.clock.micros() - timed.sendTimes[peer].front());
+        timed.sendTimes[peer].pop_front();
+        timed.onSent(timed.context, peer, delivered);
+    }
+
+    static void forwardRssi(void *self, uint8_t peer, int8_t rssi) {
+        AckTimedRadio &timed = *static_cast<AckTimedRadio *>(self);
+        timed.onRssi(timed.context, peer, rssi);
+    }
+
+    static void forwardReceive(void *self, uint8_t peer, const uint8_t *data, size_t length) {
+        AckTimedRadio &timed = *static_cast<AckTimedRadio *>(self);
+        timed.onReceive(timed.context, peer, data, length);
+    }
+};
+
+void report(Stage &stage) {
+    std::vector<uint32_t> &s = stage.samples;
+    std::sort(s.begin(), s.end());
+    uint64_t sum = 0;
+    for (uint32_t v : s) {
+        sum += v;
+    }
+    printf("%-10s %10llu %10u %10u %10u %10u\n", stage.name, (unsigned long long) (sum / s.size()),
+           s.front(), s[s.size() / 2], s[s.size() * 99 / 100], s.back());
+}
+
+void controlTick(void *context) {
+    BenchContext &bench = *static_cast<BenchContext *>(context);
+    auto tickStart = std::chrono::steady_clock::now();
+    auto start = tickStart;
+    bench.joystick.read();
+    bench.read.samples.push_back(elapsedNs(start));
+
+    start = std::chrono::steady_clock::now();
+    button_event event;
+    while (bench.joystick.nextButtonEvent(event)) {
+        bench.communication.sendButtonEvent(event);
+    }
+    bench.communication.send(bench.joystick.getData());
+    bench.send.samples.push_back(elapsedNs(start));
+    bench.control.samples.push_back(elapsedNs(tickStart));
+}
+
+void uiTick(void *context) {
+    BenchContext &bench = *static_cast<BenchContext *>(context);
+    auto start = std::chrono::steady_clock::now();
+    bench.display.update(bench.joystick.getData(), bench.communication.getSignalStrength(),
+                         bench.joystick.getSpeed(), driveModeName(bench.joystick.getMode()), "ALL", "");
+    bench.update.samples.push_back(elapsedNs(start));
+}
+
+// Car side of the input loss measurement: what was sent, and what the receiver rebuilt
+struct LossProbe {
+    HistoryReceiver receiver;
+    std::vector<control_frame> sent;  // Indexed by sequence number (no wrap in a run)
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t mismatches;
+};
+
+void onBenchFrame(void *context, uint8_t peer, const uint8_t *data, size_t length, bool delivered) {
+    LossProbe &probe = *static_cast<LossProbe *>(context);
+    history_frame frame;
+    if (peer != 1 || decodeHistoryFrame(data, length, frame) != DECODE_OK) {
+        return; // Radio peer 0 is the broadcast address
+    }
+    probe.sent.push_back(frame.samples[0]);
+    probe.frames++;
+    probe.bytes += length;
+    if (!delivered) {
+        return;
+    }
+
+    control_frame samples[HISTORY_MAX_SAMPLES];
+    int count = probe.receiver.receive(data, length, samples);
+    for (int i = 0; i < count; i++) {
+        const control_frame &truth = probe.sent[samples[i].sequence];
+        if (truth.x != samples[i].x || truth.y != samples[i].y || truth.timestamp != samples[i].timestamp ||
+            truth.buttons != samples[i].buttons) {
+            probe.mismatches++;
+        }
+    }
+}
+
+// Probes one car every 100 ms next to the control traffic, the simulated car echoes them. The radio
+// is serviced every 100 us, the granularity of the receive timestamps.
+void measureRtt(uint8_t lossPercent, uint32_t latencyUs) {
+    FakeClock clock;
+    SimulatedRadio radio(clock, lossPercent, latencyUs, 13);
+    Communication communication(radio, clock);
+    communication.begin();
+    communication.addPeer(BENCH_PEERS[0]);
+    communication.setProbeInterval(100);
+
+    const struct_message stick = {40, 120, false};
+    for (uint32_t us = 0; us < 2 * RTT_WINDOW * 1000UL; us += 100) {
+        clock.advanceMicros(100);
+        radio.service();
+        if (us % CONTROL_PERIOD_US == 0) {
+            communication.send(stick);
+        }
+    }
+
+    rtt_stats rtt = communication.getRttStats(0);
+    printf("round trip at %u%% loss, %u us ack latency (last %u ms window): %u probes, %u echoes, "
+           "p50 %u us, p99 %u us, max %u us\n", lossPercent, latencyUs, RTT_WINDOW, rtt.probes, rtt.echoes,
+           rtt.p50Us, rtt.p99Us, rtt.maxUs);
+}
+
+// Car side of the button measurement: presses carried by the stick stream, for comparison with the
+// button events
+struct ButtonProbe {
+    const Clock &clock;
+    uint32_t latencyUs;
+    uint32_t lastPressUs;   // Edge of the latest press event handed to Communication
+    bool lastDelivered;     // Button bit of the last delivered control frame
+    uint32_t streamPresses;
+    LatencyHistogram streamLatency;
+};
+
+void onButtonBenchFrame(void *context, uint8_t peer, const uint8_t *data, size_t length, bool delivered) {
+    ButtonProbe &probe = *static_cast<ButtonProbe *>(context);
+    control_frame frame;
+    if (peer != 1 || !delivered || decodeControlFrame(data, length, frame) != DECODE_OK) {
+        return;
+    }
+    bool pressed = (frame.buttons & BUTTON_MAIN) != 0;
+    if (pressed && !probe.lastDelivered) {
+        // The simulated ack comes back one latency after the send
+        probe.streamPresses++;
+        probe.streamLatency.record(probe.clock.micros() + probe.latencyUs - probe.lastPressUs);
+    }
+    probe.lastDelivered = pressed;
+}
+
+// Taps of 2 to 120 ms, a double tap and a long press with the stick centered, each event sent as it
+// comes. Reports the button events next to what the stick stream alone gets to the car.
+void measureButtonLatency(uint8_t lossPercent, uint32_t latencyUs) {
+    std::vector<input_keyframe> script = {{0, 2048, 2048, false}};
+    uint32_t t = 500;
+    for (uint32_t tapMs : {2, 3, 4, 8, 15, 40, 120}) {
+        script.push_back({t, 2048, 2048, true});
+        script.push_back({t + tapMs, 2048, 2048, false});
+        t += 503; // Drifts the taps against the control ticks
+    }
+    for (uint32_t tapMs : {0, 150}) {
+        script.push_back({t + tapMs, 2048, 2048, true});
+        script.push_back({t + tapMs + 60, 2048, 2048, false});
+    }
+    t += 700;
+    script.push_back({t, 2048, 2048, true});
+    script.push_back({t + 1000, 2048, 2048, false});
+    script.push_back({t + 1500, 2048, 2048, false});
+
+    FakeClock clock;
+    ScriptedJoystickInput input(clock, script.data(), script.size(), 0, 1);
+    SimulatedRadio radio(clock, lossPercent, latencyUs, 17);
+    MemoryCalibrationStore store;
+    Joystick joystick(input, input, clock, store);
+    Communication communication(radio, clock);
+    HybridPolicy sendPolicy(SEND_CHANGE_THRESHOLD, SEND_MIN_INTERVAL, SEND_INTERVAL, SEND_KEEPALIVE_INTERVAL);
+    ButtonProbe probe = {clock, latencyUs, 0, false, 0, LatencyHistogram()};
+    radio.setFrameHandler(onButtonBenchFrame, &probe);
+
+    joystick.begin();
+    communication.setSendPolicy(&sendPolicy);
+    communication.begin();
+    communication.addPeer(BENCH_PEERS[0]);
+
+    uint32_t presses = 0;
+    uint32_t loops = 20;
+    uint32_t durationUs = loops * script.back().timeMs * 1000;
+    for (uint32_t us = 0; us < durationUs; us += 100) {
+        clock.advanceMicros(100);
+        radio.service();
+        if (us % CONTROL_PERIOD_US != 0) {
+            continue;
+        }
+        joystick.read();
+        button_event event;
+        while (joystick.nextButtonEvent(event)) {
+            if (event.type == BUTTON_EVENT_PRESS) {
+                presses++;
+                probe.lastPressUs = event.timeUs;
+            }
+            communication.sendButtonEvent(event);
+        }
+        communication.send(joystick.getData());
+    }
+
+    button_stats buttons = communication.getButtonStats();
+    printf("button at %u%% loss, %u us ack latency: %u presses, %u double taps\n", lossPercent, latencyUs, presses,
+           joystick.getDoublePressCount());
+    printf("  events: %u queued, %u delivered, %u retries, %u dropped, edge to ack p50 %u us, p99 %u us, "
+           "max %u us\n", buttons.events, buttons.delivered, buttons.retries, buttons.dropped, buttons.p50Us,
+           buttons.p99Us, buttons.maxUs);
+    printf("  stick stream alone: %u presses delivered, edge to ack p50 %u us, p99 %u us, max %u us\n",
+           probe.streamPresses, probe.streamLatency.percentile(500), probe.streamLatency.percentile(990),
+           probe.streamLatency.getMax());
+}
+
+// One run of the authentication measurement
+struct AuthRun {
+    double framesPerSecond;     // Put on air
+    double bytesPerFrame;
+    uint32_t p50Us;             // radio.send to ack
+    uint32_t p99Us;
+    uint32_t sendNs;            // Mean host time of Communication::send per frame
+    uint32_t sendErrors;        // Frames the full radio queue refused
+    uint32_t rejected;          // By the simulated cars
+};
+
+// Feeds the stick to every car each sendInterval ms, through a 1 Mbit/s channel (the ESP-NOW default rate).
+// With attack, replayed and forged frames are sent to the first car once the stream is over.
+AuthRun runAuthentication(uint8_t mode, int cars, unsigned long sendInterval, bool attack, uint8_t lossPercent,
+                          uint32_t latencyUs) {
+    FakeClock clock;
+    SimulatedRadio radio(clock, lossPercent, latencyUs, 19);
+    AckTimedRadio timed(radio, clock);
+    Communication communication(timed, clock);
+    FixedRatePolicy sendPolicy(sendInterval);
+    radio.setAirRate(1000000);
+    communication.setSendPolicy(&sendPolicy);
+    if (mode == LINK_AUTH_CCMP) {
+        communication.setEncryption(BENCH_PMK, BENCH_LMK);
+    } else if (mode == LINK_AUTH_MAC) {
+        communication.setFrameAuthentication(BENCH_MAC_KEY, 1);
+        radio.setFrameKey(BENCH_MAC_KEY);
+    }
+    communication.begin();
+    for (int i = 0; i < cars; i++) {
+        communication.addPeer(BENCH_PEERS[i]);
+    }
+
+    const struct_message stick = {40, 120, false};
+    uint64_t sendNs = 0;
+    uint32_t durationUs = 5000000;
+    for (uint32_t us = 0; us < durationUs; us += 50) {
+        clock.advanceMicros(50);
+        radio.service();
+        if (us % 1000 == 0) {
+            auto start = std::chrono::steady_clock::now();
+            communication.send(stick);
+            sendNs += elapsedNs(start);
+        }
+    }
+
+    AuthRun run = {};
+    run.framesPerSecond = radio.getFramesSent() / (durationUs / 1e6);
+    run.bytesPerFrame = (double) radio.getBytesSent() / radio.getFramesSent();
+    run.p50Us = timed.ackLatency.percentile(500);
+    run.p99Us = timed.ackLatency.percentile(990);
+    run.sendNs = (uint32_t) (sendNs / radio.getFramesSent());
+    for (int i = 0; i < cars; i++) {
+        run.sendErrors += communication.getLinkStats(i).sendErrors;
+    }
+    run.rejected = radio.getFramesRejected();
+
+    if (attack && mode == LINK_AUTH_MAC) {
+        // Replays of the first frames and frames signed with another key, straight to the first car
+        FrameSigner replay;
+        FrameSigner forger;
+        const uint8_t otherKey[16] = {};
+        replay.begin(BENCH_MAC_KEY, 1, false);
+        forger.begin(otherKey, 2, false);
+        control_frame frame = {0, 0, 255, 255, 0};
+        uint32_t attacks = 0;
+        for (FrameSigner *signer : {&replay, &forger}) {
+            for (int i = 0; i < 10; i++) {
+                uint8_t buffer[CONTROL_FRAME_SIZE + FRAME_AUTH_SIZE];
+                size_t length = signer->sign(buffer, encodeControlFrame(frame, buffer, sizeof(buffer)), sizeof(buffer));
+                clock.advanceMicros(5000);
+                radio.service();
+                attacks += radio.send(1, buffer, length) ? 1 : 0;
+            }
+        }
+        printf("  replayed and forged frames: %u sent, %u rejected by the car (the others were lost on air)\n",
+               attacks, radio.getFramesRejected() - run.rejected);
+    }
+    return run;
+}
+
+// Plaintext against ESP-NOW CCMP and SipHash tags: send to ack latency of one car at the top rate of
+// the send policy, then the rate the channel sustains when four cars are offered a frame every ms
+void measureAuthentication(uint8_t lossPercent, uint32_t latencyUs) {
+    printf("link authentication at %u%% loss, %u us ack latency, 1 Mbit/s on air:\n", lossPercent, latencyUs);
+    printf("%-6s %10s %10s %10s %12s %14s %10s\n", "mode", "payload", "p50 (us)", "p99 (us)", "send (ns)",
+           "max frames/s", "rejected");
+    const char *names[] = {"plain", "ccmp", "mac"};
+    for (uint8_t mode : {LINK_AUTH_NONE, LINK_AUTH_CCMP, LINK_AUTH_MAC}) {
+        AuthRun nominal = runAuthentication(mode, 1, SEND_MIN_INTERVAL, true, lossPercent, latencyUs);
+        AuthRun saturated = runAuthentication(mode, COMS_MAX_PEERS, 1, false, lossPercent, latencyUs);
+        printf("%-6s %10.1f %10u %10u %12u %14.0f %10u\n", names[mode], nominal.bytesPerFrame, nominal.p50Us,
+               nominal.p99Us, nominal.sendNs, saturated.framesPerSecond, nominal.rejected + saturated.rejected);
+    }
+}
+
+// Car side of the channel hopping measurement: control frames each car got, and the longest silence
+struct HopProbe {
+    const Clock &clock;
+    uint32_t sent;
+    uint32_t accepted;
+    uint32_t lastAcceptedMs[RADIO_MAX_PEERS];
+    uint32_t longestGapMs;
+};
+
+void onHopBenchFrame(void *context, uint8_t peer, const uint8_t *data, size_t length, bool delivered) {
+    HopProbe &probe = *static_cast<HopProbe *>(context);
+    control_frame frame;
+    if (decodeControlFrame(data, length, frame) != DECODE_OK) {
+        return;
+    }
+    probe.sent++;
+    if (delivered) {
+        uint32_t now = probe.clock.millis();
+        probe.accepted++;
+        probe.longestGapMs = std::max(probe.longestGapMs, now - probe.lastAcceptedMs[peer]);
+        probe.lastAcceptedMs[peer] = now;
+    }
+}
+
+// Two cars on a crowded home channel, a quiet channel 6 that a jammer takes over at 8 s, and a fairly
+// busy channel 11. Streams the stick for 20 s with the survey alone, then with loss-triggered hopping.
+void measureChannelHopping(uint8_t lossPercent, uint32_t latencyUs) {
+    const uint32_t JAMMER_MS = 8000;
+    const channel_interference interference[] = {
+            {1, 0, UINT32_MAX, 10, 45, -80},
+            {6, JAMMER_MS, UINT32_MAX, 70, 80, -70},
+            {11, 0, UINT32_MAX, 0, 25, -88},
+    };
+    printf("channel hopping at %u%% loss, %u us ack latency, 2 cars, jammer on channel 6 from %u ms:\n",
+           lossPercent, latencyUs, JAMMER_MS);
+    printf("%-8s %8s %12s %12s %6s %10s %8s %8s %8s %12s\n", "hopping", "survey", "control (%)", "gap (ms)",
+           "hops", "fallbacks", "aborted", "forced", "channel", "to hop (ms)");
+    for (bool hopping : {false, true}) {
+        FakeClock clock;
+        SimulatedRadio radio(clock, lossPercent, latencyUs, 23);
+        Communication communication(radio, clock);
+        HopProbe probe = {clock, 0, 0, {}, 0};
+        radio.setInterference(interference, sizeof(interference) / sizeof(interference[0]));
+        radio.setFrameHandler(onHopBenchFrame, &probe);
+        communication.begin();
+        communication.addPeer(BENCH_PEERS[0]);
+        communication.addPeer(BENCH_PEERS[1]);
+        communication.surveyChannels(CHANNEL_SURVEY_DWELL);
+        communication.setChannelHopping(hopping);
+        uint8_t surveyed = 0;
+        bool jammed = false;    // On channel 6 when the jammer started
+        uint32_t hopMs = 0;
+
+        const struct_message stick = {40, 120, false};
+        for (uint32_t us = 0; us < 20000000; us += 100) {
+            clock.advanceMicros(100);
+            radio.service();
+            if (us % CONTROL_PERIOD_US != 0) {
+                continue;
+            }
+            communication.send(stick);
+            channel_stats stats = communication.getChannelStats();
+            if (surveyed == 0 && stats.hops > 0) {
+                surveyed = stats.channel;
+            }
+            if (clock.millis() == JAMMER_MS) {
+                jammed = stats.channel == 6;
+            }
+            if (jammed && hopMs == 0 && stats.channel != 6) {
+                hopMs = clock.millis() - JAMMER_MS;
+            }
+        }
+
+        channel_stats stats = communication.getChannelStats();
+        printf("%-8s %8u %12.1f %12u %6u %10u %8u %8u %8u %12s\n", hopping ? "on" : "off", surveyed,
+               100.0 * probe.accepted / probe.sent, probe.longestGapMs, stats.hops, stats.fallbacks, stats.aborted,
+               stats.forced, stats.channel, hopMs > 0 ? std::to_string(hopMs).c_str() : "-");
+    }
+}
+
+// 45 minutes of use: a drive, a break long enough for standby, a drive started with the button, the
+// controller left on the table, and a last drive started with the stick. Reports the modelled draw
+// with power management off and on, and how long each wake-up took to bring the control period back.
+void measurePower(uint8_t lossPercent, uint32_t latencyUs) {
+    const uint32_t BUTTON_WAKE_MS = 15 * 60000;
+    const uint32_t STICK_WAKE_MS = 40 * 60000;
+    const uint32_t END_MS = 45 * 60000;
+    printf("power over 45 min (drive 10, rest 5, drive 10, rest 15, drive 5), %u mAh battery:\n",
+           POWER_BATTERY_MAH);
+    printf("%-6s %8s %10s %8s %8s %8s %8s %8s %10s %12s %12s\n", "power", "avg (mA)", "runtime (h)", "active",
+           "idle", "dimmed", "blank", "standby", "frames", "button (ms)", "stick (ms)");
+    for (bool enabled : {false, true}) {
+        FakeClock clock;
+        SimulatedRadio radio(clock, lossPercent, latencyUs, 29);
+        Communication communication(radio, clock);
+        HybridPolicy sendPolicy(SEND_CHANGE_THRESHOLD, SEND_MIN_INTERVAL, SEND_INTERVAL, SEND_KEEPALIVE_INTERVAL);
+        FakePowerControl control(clock);
+        PowerManager power(control, clock);
+        communication.setSendPolicy(&sendPolicy);
+        communication.begin();
+        communication.addPeer(BENCH_PEERS[0]);
+        power.setEnabled(enabled);
+        power.begin();
+        control.pressButtonAt(BUTTON_WAKE_MS);
+        int64_t buttonWakeUs = -1;
+        int64_t stickWakeUs = -1;
+
+        while (clock.millis() < END_MS) {
+            uint32_t tickStart = clock.micros();
+            uint32_t minute = clock.millis() / 60000;
+            bool driving = minute < 10 || (minute >= 15 && minute < 25) || minute >= 40;
+            bool pressed = clock.millis() >= BUTTON_WAKE_MS && clock.millis() < BUTTON_WAKE_MS + 200;
+            // Sweeps left and right while driving
+            struct_message stick = {0, 0, pressed};
+            if (driving) {
+                stick = {(int) (clock.millis() / 4 % 400) - 200, 150, pressed};
+            }
+            communication.send(stick);
+            power.update(driving || pressed, communication.getFramesSent());
+            if (buttonWakeUs < 0 && clock.millis() >= BUTTON_WAKE_MS && power.getState() == POWER_ACTIVE) {
+                buttonWakeUs = clock.micros() - BUTTON_WAKE_MS * 1000;
+            }
+            if (stickWakeUs < 0 && clock.millis() >= STICK_WAKE_MS && power.getState() == POWER_ACTIVE) {
+                stickWakeUs = clock.micros() - STICK_WAKE_MS * 1000;
+            }
+            // As on the controller, the send callbacks come before a light sleep
+            while (power.getState() == POWER_STANDBY && communication.hasPendingSends() &&
+                   clock.micros() - tickStart < POWER_SEND_WAIT_US) {
+                clock.advanceMicros(100);
+                radio.service();
+            }
+            if (!communication.hasPendingSends()) {
+                power.sleepUntilNextTick(tickStart);
+            }
+
+            // Next tick one control period after this one started, the radio serviced on the way
+            uint32_t nextUs = tickStart + power.getControlPeriodUs();
+            while ((int32_t) (nextUs - clock.micros()) > 0) {
+                clock.advanceMicros(std::min<uint32_t>(nextUs - clock.micros(), 100));
+                radio.service();
+            }
+        }
+
+        power_stats stats = power.getStats();
+        uint32_t totalMs = 0;
+        for (uint32_t ms : stats.timeInStateMs) {
+            totalMs += ms;
+        }
+        printf("%-6s %8.1f %10.1f", enabled ? "on" : "off", stats.averageCurrentUa / 1000.0,
+               stats.runtimeMinutes / 60.0);
+        for (uint32_t ms : stats.timeInStateMs) {
+            printf(" %7.1f%%", 100.0 * ms / totalMs);
+        }
+        printf(" %10u %12.1f %12.1f\n", communication.getFramesSent(), buttonWakeUs / 1000.0, stickWakeUs / 1000.0);
+    }
+    printf("modelled draw per state (mA):");
+    for (int i = 0; i < POWER_STATE_COUNT; i++) {
+        PowerState state = (PowerState) i;
+        printf(" %s %.1f", powerStateName(state), PowerManager::stateCurrentUa(state) / 1000.0);
+    }
+    printf(", light sleep %d\n", POWER_CURRENT_SLEEP + POWER_CURRENT_BOARD);
+}
+
+// A 10 s fade with every send refused, to two cars, logged each control tick: the event log drained
+// LOG_DRAIN_BYTES per loop() pass against one "Send Failed" line per failure on a 115200 baud UART
+void measureLogging() {
+    const uint32_t DURATION_US = 10000000;
+    const double UART_BYTES_PER_SECOND = 115200 / 10.0;
+    const size_t TEXT_LINE = sizeof("Send Failed\r\n") - 1;
+    FakeClock clock;
+    EventLog log(clock);
+    log.install();
+    std::vector<uint32_t> callNs;
+    uint32_t failures = 0;
+    uint8_t frames[LOG_DRAIN_BYTES];
+
+    for (uint32_t us = 0; us < DURATION_US; us += CONTROL_PERIOD_US) {
+        clock.advanceMicros(CONTROL_PERIOD_US);
+        for (uint8_t peer = 0; peer < 2; peer++) {
+            auto start = std::chrono::steady_clock::now();
+            logEvent(LOG_SEND_FAILED, peer);
+            callNs.push_back(elapsedNs(start));
+            failures++;
+        }
+        if (us % (REPORT_CHECK_INTERVAL * 1000) == 0) {
+            log.drain(frames, sizeof(frames));
+        }
+    }
+    clock.advanceMicros(LOG_RATE_INTERVAL * 1000);
+    while (log.drain(frames, sizeof(frames)) > 0) {
+    }
+
+    std::sort(callNs.begin(), callNs.end());
+    log_stats stats = log.getStats();
+    double seconds = DURATION_US / 1e6;
+    printf("event log, %u refused sends over %.0f s (2 cars, every %u us):\n", failures, seconds, CONTROL_PERIOD_US);
+    printf("%-10s %8s %8s %10s %8s %8s %10s %10s %10s\n", "output", "records", "frames", "coalesced", "dropped",
+           "bytes", "UART (%)", "p50 (ns)", "p99 (ns)");
+    printf("%-10s %8u %8u %10u %8u %8u %10.2f %10u %10u\n", "event log", stats.records, stats.sent,
+           stats.coalesced, stats.dropped, stats.bytes, 100.0 * stats.bytes / (UART_BYTES_PER_SECOND * seconds),
+           callNs[callNs.size() / 2], callNs[callNs.size() * 99 / 100]);
+    printf("%-10s %8u %8u %10s %8s %8zu %10.2f %10s %10s\n", "println", failures, failures, "-", "-",
+           failures * TEXT_LINE, 100.0 * failures * TEXT_LINE / (UART_BYTES_PER_SECOND * seconds), "-", "-");
+}
+
+// Streams a moving stick at the fixed SEND_INTERVAL rate over a lossy link and reports the share of
+// samples the car never gets, with the given number of previous samples repeated in each frame
+void measureInputLoss(uint8_t lossPercent, uint8_t depth, uint32_t frames) {
+    FakeClock clock;
+    SimulatedRadio radio(clock, lossPercent, 0, 11);
+    Communication communication(radio, clock);
+    LossProbe probe = {};
+    radio.setFrameHandler(onBenchFrame, &probe);
+    communication.begin();
+    communication.addPeer(BENCH_PEERS[0]);
+    communication.setHistoryDepth(depth);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        clock.advanceMicros(SEND_INTERVAL * 1000);
+        radio.service();
+        struct_message data = {(int) (i * 7 % 511) - 255, (int) (i * 13 % 511) - 255, i % 50 < 5};
+        communication.send(data);
+    }
+
+    printf("%5u %12.3f %12.3f %10.1f %10u\n", depth, 100.0 * probe.receiver.getLost() / probe.frames,
+           100.0 * probe.receiver.getRecovered() / probe.frames, (double) probe.bytes / probe.frames, probe.mismatches);
+}
+
+// Records two loops of the scripted trace at the control period the way the device does: record()
+// from the control tick, flush() every REPORT_CHECK_INTERVAL. Returns the input of every tick from
+// the start of the recording on.
+std::vector<input_sample> recordTrace(MemoryRecordingStorage &storage) {
+    FakeClock clock;
+    size_t keyframes = sizeof(BENCH_TRACE) / sizeof(BENCH_TRACE[0]);
+    ScriptedJoystickInput input(clock, BENCH_TRACE, keyframes, 12, 42);
+    MemoryCalibrationStore store;
+    Joystick joystick(input, input, clock, store);
+    InputRecorder recorder(storage);
+    Stage record = {"record", {}};
+    Stage flush = {"flush", {}};
+    std::vector<input_sample> ticks;
+
+    joystick.begin();
+    uint32_t doublePresses = 0;
+    uint32_t durationUs = 2 * BENCH_TRACE[keyframes - 1].timeMs * 1000;
+    for (uint32_t us = 0; us < durationUs; us += CONTROL_PERIOD_US) {
+        clock.advanceMicros(CONTROL_PERIOD_US);
+        joystick.read();
+        bool doublePress = joystick.getDoublePressCount() != doublePresses;
+        doublePresses = joystick.getDoublePressCount();
+
+        auto start = std::chrono::steady_clock::now();
+        recorder.record(clock.millis(), joystick.getData(), joystick.getMode(), doublePress);
+        record.samples.push_back(elapsedNs(start));
+        if (recorder.isStarted()) {
+            ticks.push_back({clock.millis(), joystick.getData(), joystick.getMode(), doublePress});
+        }
+
+        if (us % (REPORT_CHECK_INTERVAL * 1000) == 0) {
+            start = std::chrono::steady_clock::now();
+            recorder.flush();
+            flush.samples.push_back(elapsedNs(start));
+        }
+    }
+    recorder.flush();
+
+    printf("recording: %u ticks, %u samples stored, %u bytes in %u writes (%.2f bytes per sample, %.0f bytes/s), "
+           "%u dropped\n", (unsigned) ticks.size(), recorder.getSamples(), recorder.getBytesWritten(),
+           storage.getWrites(), (double) recorder.getBytesWritten() / recorder.getSamples(),
+           recorder.getBytesWritten() * 1e6 / durationUs, recorder.getDropped());
+    printf("%-10s %10s %10s %10s %10s %10s\n", "stage (ns)", "mean", "min", "p50", "p99", "max");
+    report(record);
+    report(flush);
+    return ticks;
+}
+
+// Replays a recording through Communication and Display at the control and UI periods. With
+// expected, counts the ticks whose replayed input differs from what was recorded.
+void replayTrace(MemoryRecordingStorage &storage, const std::vector<input_sample> *expected, uint8_t lossPercent,
+                 uint32_t latencyUs) {
+    FakeClock clock;
+    SimulatedRadio radio(clock, lossPercent, latencyUs, 7);
+    MemoryFramebuffer framebuffer;
+    Display display(framebuffer, clock);
+    Communication communication(radio, clock);
+    HybridPolicy sendPolicy(SEND_CHANGE_THRESHOLD, SEND_MIN_INTERVAL, SEND_INTERVAL, SEND_KEEPALIVE_INTERVAL);
+    InputPlayer player(storage);
+    Stage send = {"send", {}};
+    Stage update = {"display", {}};
+
+    communication.setSendPolicy(&sendPolicy);
+    communication.begin();
+    communication.addPeer(BENCH_PEERS[0]);
+    display.begin();
+    if (!player.begin()) {
+        printf("replay: no valid recording\n");
+        return;
+    }
+
+    uint32_t startMs = clock.millis();
+    uint32_t ticks = 0;
+    uint32_t mismatches = 0;
+    input_sample sample;
+    while (player.read(clock.millis() - startMs, sample)) {
+        if (expected != nullptr && ticks < expected->size()) {
+            const input_sample &truth = (*expected)[ticks];
+            if (truth.data.x != sample.data.x || truth.data.y != sample.data.y ||
+                truth.data.button != sample.data.button || truth.mode != sample.mode ||
+                truth.doublePress != sample.doublePress) {
+                mismatches++;
+            }
+        }
+        if (sample.doublePress) {
+            communication.selectNextTarget();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        communication.send(sample.data);
+        send.samples.push_back(elapsedNs(start));
+        if (ticks % (UI_PERIOD_US / CONTROL_PERIOD_US) == 0) {
+            start = std::chrono::steady_clock::now();
+            display.update(sample.data, communication.getSignalStrength(), Joystick::speedFor(sample.data.y),
+                           driveModeName(sample.mode), "ALL", "");
+            update.samples.push_back(elapsedNs(start));
+        }
+
+        ticks++;
+        clock.advanceMicros(CONTROL_PERIOD_US);
+        radio.service();
+
+        // The storage reads of loop()
+        if (ticks % (REPORT_CHECK_INTERVAL * 1000 / CONTROL_PERIOD_US) == 0) {
+            player.prefetch();
+        }
+    }
+
+    printf("replay: %u ticks (%.1f s), %u samples, %u corrupt blocks, %u underruns, %u frames sent, "
+           "%u display frames", ticks, ticks * CONTROL_PERIOD_US / 1e6, player.getSamples(), player.getCorrupt(),
+           player.getUnderruns(), radio.getFramesSent(), display.getStats().framesRendered);
+    if (expected != nullptr) {
+        printf(", %u ticks differ from the recorded input", mismatches);
+    }
+    printf("\n%-10s %10s %10s %10s %10s %10s\n", "stage (ns)", "mean", "min", "p50", "p99", "max");
+    report(send);
+    report(update);
+}
+
+bool loadRecording(const char *path, MemoryRecordingStorage &storage) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> contents;
+    uint8_t chunk[4096];
+    size_t length;
+    while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.insert(contents.end(), chunk, chunk + length);
+    }
+    fclose(file);
+    storage.load(contents.data(), contents.size());
+    return true;
+}
+
+// Simulated ms from power-on to the first frame on air; setup() starts the display after that
+uint32_t bootToFirstFrame(CalibrationStore &store) {
+    FakeClock clock;
+    ScriptedJoystickInput input(clock, BENCH_TRACE, sizeof(BENCH_TRACE) / sizeof(BENCH_TRACE[0]), 12, 42);
+    SimulatedRadio radio(clock, 0, 0, 1);
+    Joystick joystick(input, input, clock, store);
+    Communication communication(radio, clock);
+
+    joystick.begin();
+    communication.begin();
+    communication.addPeer(BENCH_PEERS[0]);
+    joystick.read();
+    communication.send(joystick.getData());
+    return communication.getFirstFrameTime();
+}
+
+}
+
+// The unit tests bring their own main()
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t controlPeriodUs = argc > 2 ? strtoul(argv[2], nullptr, 10) : CONTROL_PERIOD_US;
+    uint8_t lossPercent = argc > 3 ? (uint8_t) strtoul(argv[3], nullptr, 10) : 5;
+    uint32_t latencyUs = argc > 4 ? strtoul(argv[4], nullptr, 10) : 800;
+    int cars = argc > 5 ? std::min(std::max(atoi(argv[5]), 1), COMS_MAX_PEERS) : 1;
+
+    FakeClock clock;
+    ScriptedJoystickInput input(clock, BENCH_TRACE, sizeof(BENCH_TRACE) / sizeof(BENCH_TRACE[0]), 12, 42);
+    SimulatedRadio radio(clock, lossPercent, latencyUs, 7);
+    Stage push = {"push", {}};
+    TimedFramebuffer framebuffer(push);
+    MemoryCalibrationStore store;
+
+    // The first boot has nothing stored and calibrates, the second one reuses it
+    uint32_t coldBootMs = bootToFirstFrame(store);
+    uint32_t warmBootMs = bootToFirstFrame(store);
+
+    Joystick joystick(input, input, clock, store);
+    Display display(framebuffer, clock);
+    Communication communication(radio, clock);
+    HybridPolicy sendPolicy(SEND_CHANGE_THRESHOLD, SEND_MIN_INTERVAL, SEND_INTERVAL, SEND_KEEPALIVE_INTERVAL);
+    Scheduler scheduler(clock);
+    BenchContext bench = {joystick, communication, display, {"read", {}}, {"send", {}}, {"display", {}},
+                          {"control", {}}};
+
+    joystick.begin();
+    communication.setSendPolicy(&sendPolicy);
+    communication.begin();
+    for (int i = 0; i < cars; i++) {
+        communication.addPeer(BENCH_PEERS[i]);
+    }
+    int controlTask = scheduler.addTask("control", controlTick, &bench, controlPeriodUs, CONTROL_TASK_PRIORITY);
+    int uiTask = scheduler.addTask("ui", uiTick, &bench, UI_PERIOD_US, UI_TASK_PRIORITY);
+    scheduler.begin();
+    display.begin();
+
+    for (Stage *stage : {&bench.read, &bench.send, &bench.update, &bench.control}) {
+        stage->samples.reserve(iterations);
+    }
+    push.samples.clear(); // Boot screen frames
+
+    // Jump from one release to the next, like the device idling between ticks
+    uint32_t startUs = clock.micros();
+    uint32_t untilNext = scheduler.runDue();
+    for (uint32_t i = 0; i < iterations; i++) {
+        clock.advanceMicros(untilNext);
+        radio.service();
+        untilNext = scheduler.runDue();
+    }
+
+    double seconds = (clock.micros() - startUs) / 1e6;
+    display_stats displayStats = display.getStats();
+    link_stats linkStats = communication.getLinkStats(0);
+
+    printf("%u wakeups, %u us control period (%.1f s simulated), %u%% loss, %u us ack latency, %d cars\n",
+           iterations, controlPeriodUs, seconds, lossPercent, latencyUs, cars);
+    printf("boot to first frame: %u ms cold, %u ms with stored calibration\n", coldBootMs, warmBootMs);
+    printf("%-10s %10s %10s %10s %10s %10s\n", "stage (ns)", "mean", "min", "p50", "p99", "max");
+    for (Stage *stage : {&bench.read, &bench.send, &bench.update, &bench.control, &push}) {
+        report(*stage);
+    }
+    printf("ticks: %u control, %u ui\n", scheduler.getStats(controlTask).runs, scheduler.getStats(uiTask).runs);
+    printf("radio: %u frames (%.1f/s), %u bytes, %u delivered, level %u\n",
+           radio.getFramesSent(), radio.getFramesSent() / seconds, radio.getBytesSent(),
+           radio.getFramesDelivered(), linkStats.level);
+    printf("display: %u frames, %u dropped, %llu pixels pushed (%.0f/s), %u-bit sprites in %u bytes\n",
+           displayStats.framesRendered, displayStats.framesDropped,
+           (unsigned long long) framebuffer.screen.getPixelsPushed(), framebuffer.screen.getPixelsPushed() / seconds,
+           DISPLAY_COLOR_DEPTH, (unsigned) framebuffer.getCanvasBytes());
+
+    measureRtt(lossPercent, latencyUs);
+    measureButtonLatency(lossPercent, latencyUs);
+    measureAuthentication(lossPercent, latencyUs);
+    measureChannelHopping(lossPercent, latencyUs);
+    measurePower(lossPercent, latencyUs);
+    measureLogging();
+
+    MemoryRecordingStorage recording;
+    if (argc > 6) {
+        if (!loadRecording(argv[6], recording)) {
+            printf("cannot read %s\n", argv[6]);
+            return 1;
+        }
+        replayTrace(recording, nullptr, lossPercent, latencyUs);
+    } else {
+        std::vector<input_sample> recorded = recordTrace(recording);
+        replayTrace(recording, &recorded, lossPercent, latencyUs);
+    }
+
+    printf("input loss at %u%% frame loss (%u frames, %u ms apart):\n", lossPercent, 20000, SEND_INTERVAL);
+    printf("%5s %12s %12s %10s %10s\n", "depth", "lost (%)", "rebuilt (%)", "bytes", "mismatch");
+    for (uint8_t depth : {0, 1, 2, 4, 8}) {
+        measureInputLoss(lossPercent, depth, 20000);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,556 @@
+#include "fake_hal.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// ESP-NOW frames go on air as 802.11 action frames behind a long DSSS preamble
+const uint32_t AIR_PREAMBLE_US = 192;
+const size_t AIR_FRAME_OVERHEAD = 43;   // MAC header, action and vendor element headers, FCS
+const size_t AIR_CCMP_OVERHEAD = 16;    // CCMP header and MIC
+
+uint32_t nextRandom(uint32_t &state) {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+}
+
+FakeClock::FakeClock() :
+        nowUs(0) {
+}
+
+uint32_t FakeClock::millis() const {
+    return (uint32_t) (nowUs / 1000);
+}
+
+uint32_t FakeClock::micros() const {
+    return (uint32_t) nowUs;
+}
+
+void FakeClock::delay(uint32_t ms) {
+    nowUs += (uint64_t) ms * 1000;
+}
+
+void FakeClock::advanceMicros(uint32_t us) {
+    nowUs += us;
+}
+
+ScriptedJoystickInput::ScriptedJoystickInput(const Clock &clock, const input_keyframe *keyframes, size_t count,
+                                             int noise, uint32_t seed) :
+        clock(clock),
+        keyframes(keyframes),
+        count(count),
+        noise(noise),
+        random(seed ? seed : 1),
+        x(JOYSTICK_RAW_MAX / 2),
+        y(JOYSTICK_RAW_MAX / 2),
+        edgeTimeMs(0),
+        edgeLevel(keyframes[0].pressed) {
+}
+
+bool ScriptedJoystickInput::begin() {
+    return count > 0;
+}
+
+void ScriptedJoystickInput::poll() {
+    uint32_t duration = keyframes[count - 1].timeMs;
+    uint32_t t = duration > 0 ? clock.millis() % duration : 0;
+
+    size_t next = nextKeyframe(t);
+    const input_keyframe &a = keyframes[next - 1];
+    const input_keyframe &b = keyframes[count > 1 ? next : 0];
+    int32_t span = (int32_t) (b.timeMs - a.timeMs);
+    int32_t at = (int32_t) (t - a.timeMs);
+    if (span <= 0) {
+        x = a.x;
+        y = a.y;
+    } else {
+        x = a.x + (b.x - a.x) * at / span;
+        y = a.y + (b.y - a.y) * at / span;
+    }
+
+    x = std::min(std::max(x + nextNoise(), JOYSTICK_RAW_MIN), JOYSTICK_RAW_MAX);
+    y = std::min(std::max(y + nextNoise(), JOYSTICK_RAW_MIN), JOYSTICK_RAW_MAX);
+}
+
+int ScriptedJoystickInput::getX() const {
+    return x;
+}
+
+int ScriptedJoystickInput::getY() const {
+    return y;
+}
+
+bool ScriptedJoystickInput::nextLevel(uint32_t timeMs, uint32_t &changeMs) const {
+    uint32_t duration = keyframes[count - 1].timeMs;
+    if (duration == 0) {
+        changeMs = UINT32_MAX;
+        return keyframes[0].pressed;
+    }
+    uint32_t t = timeMs % duration;
+    size_t next = nextKeyframe(t);
+    // The last keyframe wraps to the first one
+    changeMs = timeMs - t + keyframes[next].timeMs;
+    return keyframes[next < count - 1 ? next : 0].pressed;
+}
+
+bool ScriptedJoystickInput::readEdge(button_edge &edge) {
+    uint32_t now = clock.millis();
+    uint32_t changeMs;
+    while (edgeTimeMs < now) {
+        bool level = nextLevel(edgeTimeMs, changeMs);
+        if (changeMs > now) {
+            edgeTimeMs = now;
+            break;
+        }
+        edgeTimeMs = changeMs;
+        if (level != edgeLevel) {
+            edgeLevel = level;
+            edge = {changeMs * 1000, level};
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ScriptedJoystickInput::isPressed() const {
+    uint32_t duration = keyframes[count - 1].timeMs;
+    uint32_t t = duration > 0 ? clock.millis() % duration : 0;
+    return keyframes[nextKeyframe(t) - 1].pressed;
+}
+
+size_t ScriptedJoystickInput::nextKeyframe(uint32_t t) const {
+    size_t next = 1;
+    while (next < count - 1 && keyframes[next].timeMs <= t) {
+        next++;
+    }
+    return next;
+}
+
+int ScriptedJoystickInput::nextNoise() {
+    if (noise <= 0) {
+        return 0;
+    }
+    return (int) (nextRandom(random) % (2 * noise + 1)) - noise;
+}
+
+MemoryCalibrationStore::MemoryCalibrationStore() :
+        stored{},
+        valid(false),
+        saves(0) {
+}
+
+bool MemoryCalibrationStore::load(joystick_calibration &calibration) {
+    if (valid) {
+        calibration = stored;
+    }
+    return valid;
+}
+
+bool MemoryCalibrationStore::save(const joystick_calibration &calibration) {
+    stored = calibration;
+    valid = true;
+    saves++;
+    return true;
+}
+
+uint32_t MemoryCalibrationStore::getSaves() const {
+    return saves;
+}
+
+MemoryRecordingStorage::MemoryRecordingStorage() :
+        exists(false),
+        writing(false),
+        readPosition(0),
+        writes(0) {
+}
+
+bool MemoryRecordingStorage::begin() {
+    return true;
+}
+
+bool MemoryRecordingStorage::openWrite() {
+    contents.clear();
+    exists = true;
+    writing = true;
+    return true;
+}
+
+bool MemoryRecordingStorage::openRead() {
+    writing = false;
+    readPosition = 0;
+    return exists;
+}
+
+bool MemoryRecordingStorage::write(const uint8_t *data, size_t length) {
+    if (!writing) {
+        return false;
+    }
+    contents.insert(contents.end(), data, data + length);
+    writes++;
+    return true;
+}
+
+size_t MemoryRecordingStorage::read(uint8_t *data, size_t size) {
+    if (writing) {
+        return 0;
+    }
+    size_t n = std::min(size, contents.size() - readPosition);
+    std::copy(contents.begin() + readPosition, contents.begin() + readPosition + n, data);
+    readPosition += n;
+    return n;
+}
+
+void MemoryRecordingStorage::close() {
+    writing = false;
+}
+
+void MemoryRecordingStorage::load(const uint8_t *data, size_t length) {
+    contents.assign(data, data + length);
+    exists = true;
+    writing = false;
+}
+
+const std::vector<uint8_t> &MemoryRecordingStorage::getContents() const {
+    return contents;
+}
+
+uint32_t MemoryRecordingStorage::getWrites() const {
+    return writes;
+}
+
+SimulatedRadio::SimulatedRadio(const Clock &clock, uint8_t lossPercent, uint32_t latencyUs, uint32_t seed) :
+        clock(clock),
+        lossPercent(lossPercent),
+        latencyUs(latencyUs),
+        random(seed ? seed : 1),
+        sendCallback(nullptr),
+        rssiCallback(nullptr),
+        receiveCallback(nullptr),
+        callbackContext(nullptr),
+        frameHandler(nullptr),
+        frameHandlerContext(nullptr),
+        broadcastPeer{},
+        encryptedPeer{},
+        peerCount(0),
+        airRate(0),
+        channelFreeUs(0),
+        txChannel(CHANNEL_HOME),
+        channels(false),
+        interference(nullptr),
+        interferenceCount(0),
+        carChannels(),
+        frameKey(false),
+        carVerifiers(),
+        carSigners(),
+        queue{},
+        queueHead(0),
+        queueCount(0),
+        echoes{},
+        echoCount(0),
+        framesSent(0),
+        framesDelivered(0),
+        bytesSent(0) {
+}
+
+bool SimulatedRadio::begin() {
+    return true;
+}
+
+bool SimulatedRadio::setPrimaryKey(const uint8_t *) {
+    return true;
+}
+
+int SimulatedRadio::addPeer(const uint8_t *address, const uint8_t *localKey) {
+    static const uint8_t BROADCAST[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    bool broadcast = memcmp(address, BROADCAST, sizeof(BROADCAST)) == 0;
+    if (peerCount >= RADIO_MAX_PEERS || (broadcast && localKey != nullptr)) {
+        return -1;
+    }
+    broadcastPeer[peerCount] = broadcast;
+    encryptedPeer[peerCount] = localKey != nullptr;
+    return peerCount++;
+}
+
+bool SimulatedRadio::send(uint8_t peer, const uint8_t *data, size_t length) {
+    if (peer >= peerCount || queueCount == QUEUE_SIZE || length > 250) {
+        return false;
+    }
+
+    uint32_t now = clock.micros();
+    int loss = lossPercent;
+    bool reachable = true;
+    if (channels) {
+        loss += interferenceOn(txChannel, now / 1000, &channel_interference::lossPercent);
+        reachable = broadcastPeer[peer] || carChannels[peer].getChannel() == txChannel;
+    }
+    bool delivered = (int) (nextRandom(random) % 100) >= loss && reachable;
+    uint32_t dueUs = now + latencyUs;
+    if (airRate > 0) {
+        size_t bytes = AIR_FRAME_OVERHEAD + length + (encryptedPeer[peer] ? AIR_CCMP_OVERHEAD : 0);
+        uint32_t startUs = (int32_t) (channelFreeUs - now) > 0 ? channelFreeUs : now;
+        dueUs = startUs + AIR_PREAMBLE_US + (uint32_t) (bytes * 8 * 1000000ULL / airRate) + latencyUs;
+        channelFreeUs = dueUs;
+    }
+    queue[(queueHead + queueCount) % QUEUE_SIZE] = {dueUs, peer, delivered};
+    queueCount++;
+
+    // What the car makes of the frame, without the trailer when it checks one
+    bool accepted = delivered;
+    size_t payloadLength = length;
+    if (frameKey) {
+        size_t verified = delivered ? carVerifiers[peer].verify(data, length) : 0;
+        accepted = verified > 0;
+        payloadLength = verified > 0 ? verified : length - std::min<size_t>(length, FRAME_AUTH_SIZE);
+    }
+
+    // The car echoes probes it got, the echo itself can be lost on the way back
+    Echo echo;
+    if (accepted && !broadcastPeer[peer] && echoCount < QUEUE_SIZE && payloadLength == PROBE_FRAME_SIZE) {
+        memcpy(echo.data, data, payloadLength);
+        bool echoed = echoProbeFrame(echo.data, payloadLength);
+        echo.length = frameKey ? carSigners[peer].sign(echo.data, payloadLength, sizeof(echo.data)) : payloadLength;
+        uint32_t jitterUs = nextRandom(random) % (latencyUs + 1);
+        if (echoed && nextRandom(random) % 100 >= lossPercent) {
+            echo.dueUs = dueUs + latencyUs + jitterUs;
+            echo.peer = peer;
+            echoes[echoCount++] = echo;
+        }
+    }
+
+    if (channels && accepted && !broadcastPeer[peer]) {
+        carChannels[peer].receive(data, payloadLength, now / 1000);
+    }
+    if (frameHandler) {
+        frameHandler(frameHandlerContext, peer, data, payloadLength, accepted);
+    }
+    framesSent++;
+    bytesSent += length;
+    return true;
+}
+
+bool SimulatedRadio::setChannel(uint8_t channel) {
+    txChannel = channel;
+    return true;
+}
+
+bool SimulatedRadio::survey(uint8_t channel, uint32_t dwell, channel_survey &result) {
+    uint32_t now = clock.millis();
+    int busy = channels ? interferenceOn(channel, now, &channel_interference::busyPercent) : 0;
+    int8_t noise = INT8_MIN;
+    for (size_t i = 0; channels && i < interferenceCount; i++) {
+        const channel_interference &source = interference[i];
+        if (std::abs(source.channel - channel) < 5 && now >= source.startMs && now < source.endMs) {
+            noise = std::max(noise, source.noiseFloor);
+        }
+    }
+    // About one frame heard per ms of busy time
+    result.channel = channel;
+    result.frames = (uint16_t) (busy * dwell / 100);
+    result.busyPercent = (uint8_t) busy;
+    result.noiseFloor = result.frames > 0 ? noise : 0;
+    return true;
+}
+
+void SimulatedRadio::setInterference(const channel_interference *list, size_t count) {
+    interference = list;
+    interferenceCount = count;
+    channels = true;
+}
+
+uint8_t SimulatedRadio::getCarChannel(uint8_t peer) const {
+    return channels ? carChannels[peer].getChannel() : txChannel;
+}
+
+int SimulatedRadio::interferenceOn(uint8_t channel, uint32_t now, uint8_t channel_interference::*field) const {
+    int total = 0;
+    for (size_t i = 0; i < interferenceCount; i++) {
+        const channel_interference &source = interference[i];
+        int distance = std::abs(source.channel - channel);
+        if (distance < 5 && now >= source.startMs && now < source.endMs) {
+            total += source.*field * (5 - distance) / 5;
+        }
+    }
+    return std::min(total, 100);
+}
+
+void SimulatedRadio::setCallbacks(SendCallback onSent, RssiCallback onRssi, ReceiveCallback onReceive,
+                                  void *context) {
+    sendCallback = onSent;
+    rssiCallback = onRssi;
+    receiveCallback = onReceive;
+    callbackContext = context;
+}
+
+void SimulatedRadio::setFrameHandler(FrameHandler handler, void *context) {
+    frameHandler = handler;
+    frameHandlerContext = context;
+}
+
+void SimulatedRadio::service() {
+    uint32_t now = clock.micros();
+    for (int i = 0; channels && i < peerCount; i++) {
+        if (!broadcastPeer[i]) {
+            carChannels[i].update(now / 1000);
+        }
+    }
+    while (queueCount > 0 && (int32_t) (now - queue[queueHead].dueUs) >= 0) {
+        Pending pending = queue[queueHead];
+        queueHead = (queueHead + 1) % QUEUE_SIZE;
+        queueCount--;
+        if (pending.delivered) {
+            framesDelivered++;
+        }
+        // Like ESP-NOW, a broadcast completes as delivered since nobody acknowledges it
+        if (sendCallback) {
+            sendCallback(callbackContext, pending.peer, pending.delivered || broadcastPeer[pending.peer]);
+        }
+    }
+
+    // Echoes jitter, so they can come back out of order
+    for (int i = 0; i < echoCount;) {
+        if ((int32_t) (now - echoes[i].dueUs) < 0) {
+            i++;
+            continue;
+        }
+        Echo echo = echoes[i];
+        echoes[i] = echoes[--echoCount];
+        if (receiveCallback) {
+            receiveCallback(callbackContext, echo.peer, echo.data, echo.length);
+        }
+    }
+}
+
+void SimulatedRadio::setAirRate(uint32_t bitsPerSecond) {
+    airRate = bitsPerSecond;
+}
+
+void SimulatedRadio::setFrameKey(const uint8_t *key) {
+    for (int i = 0; i < RADIO_MAX_PEERS; i++) {
+        carVerifiers[i].begin(key, false);
+        carSigners[i].begin(key, 1, true);
+    }
+    frameKey = true;
+}
+
+uint32_t SimulatedRadio::getFramesRejected() const {
+    uint32_t rejected = 0;
+    for (const FrameVerifier &verifier : carVerifiers) {
+        rejected += verifier.getRejected();
+    }
+    return rejected;
+}
+
+uint32_t SimulatedRadio::getFramesSent() const {
+    return framesSent;
+}
+
+uint32_t SimulatedRadio::getFramesDelivered() const {
+    return framesDelivered;
+}
+
+uint32_t SimulatedRadio::getBytesSent() const {
+    return bytesSent;
+}
+
+MemoryFramebuffer::MemoryFramebuffer() :
+        screen(DISPLAY_WIDTH * DISPLAY_HEIGHT, 0),
+        palette(),
+        canvasBytes(0),
+        pixelsPushed(0),
+        backlight(BACKLIGHT_FULL) {
+    const uint16_t colors[] = DISPLAY_PALETTE;
+    buildCanvasPalette(colors, sizeof(colors) / sizeof(colors[0]), palette);
+}
+
+void MemoryFramebuffer::begin() {
+    std::fill(screen.begin(), screen.end(), 0);
+}
+
+Canvas *MemoryFramebuffer::createCanvas(int16_t width, int16_t height) {
+    const uint16_t colors[] = DISPLAY_PALETTE;
+    canvases.emplace_back(new MemoryCanvas(width, height, DISPLAY_COLOR_DEPTH));
+    canvases.back()->createPalette(colors, sizeof(colors) / sizeof(colors[0]));
+    canvasBytes += width * height * DISPLAY_COLOR_DEPTH / 8;
+    return canvases.back().get();
+}
+
+size_t MemoryFramebuffer::getCanvasBytes() const {
+    return canvasBytes;
+}
+
+void MemoryFramebuffer::startFrame() {
+}
+
+void MemoryFramebuffer::pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t x,
+                                   int16_t y) {
+    for (int16_t row = 0; row < h; row++) {
+        if (y + row < 0 || y + row >= DISPLAY_HEIGHT) {
+            continue;
+        }
+        expandCanvasRow(canvas, sx, sy + row, w, palette, &screen[(y + row) * DISPLAY_WIDTH + x]);
+    }
+    pixelsPushed += (uint64_t) w * h;
+}
+
+void MemoryFramebuffer::endFrame() {
+}
+
+void MemoryFramebuffer::setBacklight(uint8_t level) {
+    backlight = level;
+}
+
+const uint16_t *MemoryFramebuffer::getScreen() const {
+    return screen.data();
+}
+
+uint64_t MemoryFramebuffer::getPixelsPushed() const {
+    return pixelsPushed;
+}
+
+uint8_t MemoryFramebuffer::getBacklight() const {
+    return backlight;
+}
+
+FakePowerControl::FakePowerControl(FakeClock &clock) :
+        clock(clock),
+        cpuMhz(POWER_ACTIVE_CPU_MHZ),
+        frequencyChanges(0),
+        pressPending(false),
+        pressMs(0) {
+}
+
+bool FakePowerControl::setCpuFrequency(uint32_t mhz) {
+    frequencyChanges += mhz != cpuMhz ? 1 : 0;
+    cpuMhz = mhz;
+    return true;
+}
+
+bool FakePowerControl::lightSleep(uint32_t us) {
+    int32_t untilPress = (int32_t) (pressMs * 1000 - clock.micros());
+    if (pressPending && untilPress >= 0 && (uint32_t) untilPress < us) {
+        pressPending = false;
+        clock.advanceMicros(untilPress);
+        return true;
+    }
+    clock.advanceMicros(us);
+    return false;
+}
+
+void FakePowerControl::pressButtonAt(uint32_t timeMs) {
+    pressPending = true;
+    pressMs = timeMs;
+}
+
+uint32_t FakePowerControl::getCpuFrequency() const {
+    return cpuMhz;
+}
+
+uint32_t FakePowerControl::getFrequencyChanges() const {
+    return frequencyChanges;
+}
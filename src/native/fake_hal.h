@@ -0,0 +1,303 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "hal.h"
+#include "canvas_cache.h"
+#include "protocol.h"
+#include "frame_auth.h"
+#include "channel_follower.h"
+#include "config.h"
+
+// Deterministic clock, time only moves when the caller advances it (or through delay())
+class FakeClock : public Clock {
+public:
+    FakeClock();
+
+    uint32_t millis() const override;
+
+    uint32_t micros() const override;
+
+    void delay(uint32_t ms) override;
+
+    void advanceMicros(uint32_t us);
+
+private:
+    uint64_t nowUs;
+};
+
+// Joystick trace as keyframes, linearly interpolated, with optional seeded noise on the axes. The
+// button changes level exactly at the keyframes, and its edges carry that time.
+typedef struct input_keyframe {
+    uint32_t timeMs;
+    int x;          // Raw ADC units
+    int y;
+    bool pressed;
+} input_keyframe;
+
+class ScriptedJoystickInput : public JoystickInput, public ButtonInput {
+public:
+    // The script loops once its last keyframe is reached
+    ScriptedJoystickInput(const Clock &clock, const input_keyframe *keyframes, size_t count, int noise,
+                          uint32_t seed);
+
+    bool begin() override;
+
+    void poll() override;
+
+    int getX() const override;
+
+    int getY() const override;
+
+    bool readEdge(button_edge &edge) override;
+
+    bool isPressed() const override;
+
+private:
+    const Clock &clock;
+    const input_keyframe *keyframes;
+    size_t count;
+    int noise;
+    uint32_t random;
+    int x;
+    int y;
+    uint32_t edgeTimeMs;    // Edges are reported up to this time
+    bool edgeLevel;
+
+    int nextNoise();
+
+    // Index of the first keyframe after t, t within one loop of the script
+    size_t nextKeyframe(uint32_t t) const;
+
+    // Level from the time the first keyframe after timeMs is reached, and that time
+    bool nextLevel(uint32_t timeMs, uint32_t &changeMs) const;
+};
+
+// Calibration kept in RAM, empty until the first save; stands in for NVS across simulated boots
+class MemoryCalibrationStore : public CalibrationStore {
+public:
+    MemoryCalibrationStore();
+
+    bool load(joystick_calibration &calibration) override;
+
+    bool save(const joystick_calibration &calibration) override;
+
+    uint32_t getSaves() const;
+
+private:
+    joystick_calibration stored;
+    bool valid;
+    uint32_t saves;
+};
+
+// Recording held in RAM; load() and getContents() move it from and to a file on the host
+class MemoryRecordingStorage : public RecordingStorage {
+public:
+    MemoryRecordingStorage();
+
+    bool begin() override;
+
+    bool openWrite() override;
+
+    bool openRead() override;
+
+    bool write(const uint8_t *data, size_t length) override;
+
+    size_t read(uint8_t *data, size_t size) override;
+
+    void close() override;
+
+    void load(const uint8_t *data, size_t length);
+
+    const std::vector<uint8_t> &getContents() const;
+
+    uint32_t getWrites() const;
+
+private:
+    std::vector<uint8_t> contents;
+    bool exists;
+    bool writing;
+    size_t readPosition;
+    uint32_t writes;
+};
+
+// Interference centred on a channel while the clock is in [startMs, endMs). It fades over the four
+// channels on each side, like a 22 MHz wide transmitter, and adds up with the other sources.
+typedef struct channel_interference {
+    uint8_t channel;
+    uint32_t startMs;
+    uint32_t endMs;
+    uint8_t lossPercent;    // On top of the radio's loss rate
+    uint8_t busyPercent;    // What a survey of the channel reports
+    int8_t noiseFloor;      // dBm
+} channel_interference;
+
+// Radio with a fixed ack latency and a seeded loss rate, per frame whatever the peer. Completions are
+// delivered by service(), which stands in for the WiFi task and must be called as time advances.
+// Unicast peers echo probe frames like the car firmware does: the echo comes back two latencies plus
+// up to one latency of jitter after the probe, and each direction is lost at the loss rate.
+class SimulatedRadio : public Radio {
+public:
+    SimulatedRadio(const Clock &clock, uint8_t lossPercent, uint32_t latencyUs, uint32_t seed);
+
+    bool begin() override;
+
+    bool setPrimaryKey(const uint8_t *key) override;
+
+    // Frames of a peer with a local key carry the CCMP header and MIC on air
+    int addPeer(const uint8_t *address, const uint8_t *localKey) override;
+
+    bool send(uint8_t peer, const uint8_t *data, size_t length) override;
+
+    bool setChannel(uint8_t channel) override;
+
+    // Reports the interference active at the current time, and takes none
+    bool survey(uint8_t channel, uint32_t dwell, channel_survey &result) override;
+
+    void setCallbacks(SendCallback onSent, RssiCallback onRssi, ReceiveCallback onReceive,
+                      void *context) override;
+
+    // From this call on, each unicast peer runs a ChannelFollower like the car firmware and only gets the
+    // frames sent on its channel, and the list (not copied) adds loss on the channels it covers. Before
+    // it, channels play no part.
+    void setInterference(const channel_interference *list, size_t count);
+
+    // Channel the peer's car listens on
+    uint8_t getCarChannel(uint8_t peer) const;
+
+    // Sees every accepted frame with its fate, e.g. to feed a simulated receiver
+    typedef void (*FrameHandler)(void *context, uint8_t peer, const uint8_t *data, size_t length, bool delivered);
+
+    void setFrameHandler(FrameHandler handler, void *context);
+
+    // 0, the default, completes every frame after the fixed latency. Otherwise frames go on air one at a
+    // time at this rate in bit/s, ESP-NOW framing included, and each one completes its airtime plus the
+    // latency after the previous one, which caps the frame rate.
+    void setAirRate(uint32_t bitsPerSecond);
+
+    // Makes the peers check frames like the car does with LINK_AUTH_MAC: the frame handler gets the frame
+    // without its trailer, rejected frames count as lost for it (the radio still acknowledged them), and
+    // echoes are signed
+    void setFrameKey(const uint8_t *key);
+
+    // Delivered frames the peers rejected with a frame key
+    uint32_t getFramesRejected() const;
+
+    void service();
+
+    uint32_t getFramesSent() const;
+
+    uint32_t getFramesDelivered() const;
+
+    uint32_t getBytesSent() const;
+
+private:
+    struct Pending {
+        uint32_t dueUs;
+        uint8_t peer;
+        bool delivered;
+    };
+
+    struct Echo {
+        uint32_t dueUs;
+        uint8_t peer;
+        uint8_t data[PROBE_FRAME_SIZE + FRAME_AUTH_SIZE];
+        size_t length;
+    };
+
+    static const int QUEUE_SIZE = 8; // ESP-NOW accepts a handful of frames in flight
+
+    // Sum of the interference active on channel at now, field picks loss or busy time, capped at 100
+    int interferenceOn(uint8_t channel, uint32_t now, uint8_t channel_interference::*field) const;
+
+    const Clock &clock;
+    uint8_t lossPercent;
+    uint32_t latencyUs;
+    uint32_t random;
+    SendCallback sendCallback;
+    RssiCallback rssiCallback;
+    ReceiveCallback receiveCallback;
+    void *callbackContext;
+    FrameHandler frameHandler;
+    void *frameHandlerContext;
+    bool broadcastPeer[RADIO_MAX_PEERS];
+    bool encryptedPeer[RADIO_MAX_PEERS];
+    int peerCount;
+    uint32_t airRate;
+    uint32_t channelFreeUs;     // End of the last frame's exchange on air
+    uint8_t txChannel;
+    bool channels;
+    const channel_interference *interference;
+    size_t interferenceCount;
+    ChannelFollower carChannels[RADIO_MAX_PEERS];
+    bool frameKey;
+    FrameVerifier carVerifiers[RADIO_MAX_PEERS];
+    FrameSigner carSigners[RADIO_MAX_PEERS];
+    Pending queue[QUEUE_SIZE];
+    int queueHead;
+    int queueCount;
+    Echo echoes[QUEUE_SIZE];
+    int echoCount;
+    uint32_t framesSent;
+    uint32_t framesDelivered;
+    uint32_t bytesSent;
+};
+
+// Screen held in RAM
+class MemoryFramebuffer : public Framebuffer {
+public:
+    MemoryFramebuffer();
+
+    void begin() override;
+
+    Canvas *createCanvas(int16_t width, int16_t height) override;
+
+    size_t getCanvasBytes() const override;
+
+    void startFrame() override;
+
+    void pushRegion(Canvas &canvas, int16_t sx, int16_t sy, int16_t w, int16_t h, int16_t x, int16_t y) override;
+
+    void endFrame() override;
+
+    void setBacklight(uint8_t level) override;
+
+    const uint16_t *getScreen() const;
+
+    uint8_t getBacklight() const;
+
+    uint64_t getPixelsPushed() const;
+
+private:
+    std::vector<uint16_t> screen;
+    std::vector<std::unique_ptr<Canvas>> canvases;
+    canvas_palette palette;
+    size_t canvasBytes;
+    uint64_t pixelsPushed;
+    uint8_t backlight;
+};
+
+// Records the CPU clock; a light sleep moves the clock forward, to the button press when one was set
+// within it
+class FakePowerControl : public PowerControl {
+public:
+    explicit FakePowerControl(FakeClock &clock);
+
+    bool setCpuFrequency(uint32_t mhz) override;
+
+    bool lightSleep(uint32_t us) override;
+
+    // A press at timeMs wakes the sleep it falls in
+    void pressButtonAt(uint32_t timeMs);
+
+    uint32_t getCpuFrequency() const;
+
+    uint32_t getFrequencyChanges() const;
+
+private:
+    FakeClock &clock;
+    uint32_t cpuMhz;
+    uint32_t frequencyChanges;
+    bool pressPending;
+    uint32_t pressMs;
+};
@@ -0,0 +1,265 @@
+#include "memory_canvas.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+MemoryCanvas::MemoryCanvas(int16_t width, int16_t height, int8_t colorDepth) :
+        canvasWidth(width),
+        canvasHeight(height),
+        colorDepth(colorDepth),
+        pixels(width * height * colorDepth / 8, 0),
+        palette{},
+        clipX0(0), clipY0(0), clipX1(width), clipY1(height),
+        datumX(0), datumY(0),
+        textColor(0xFFFF),
+        textSize(1),
+        cursorX(0),
+        cursorY(0) {
+}
+
+int16_t MemoryCanvas::width() const {
+    return canvasWidth;
+}
+
+int16_t MemoryCanvas::height() const {
+    return canvasHeight;
+}
+
+int8_t MemoryCanvas::getColorDepth() const {
+    return colorDepth;
+}
+
+void *MemoryCanvas::getPointer() {
+    return pixels.data();
+}
+
+void MemoryCanvas::createPalette(const uint16_t *colors, uint8_t count) {
+    memcpy(palette, colors, std::min<uint8_t>(count, 16) * sizeof(uint16_t));
+}
+
+uint16_t MemoryCanvas::readPixel(int32_t x, int32_t y) const {
+    if (x < 0 || y < 0 || x >= canvasWidth || y >= canvasHeight) {
+        return 0;
+    }
+    if (colorDepth == 4) {
+        uint8_t pair = pixels[(y * canvasWidth + x) >> 1];
+        return palette[x & 1 ? pair & 0x0F : pair >> 4];
+    }
+    return reinterpret_cast<const uint16_t *>(pixels.data())[y * canvasWidth + x];
+}
+
+void MemoryCanvas::fillSprite(uint32_t color) {
+    fillRect(clipX0 - datumX, clipY0 - datumY, clipX1 - clipX0, clipY1 - clipY0, color);
+}
+
+void MemoryCanvas::drawPixel(int32_t x, int32_t y, uint32_t color) {
+    x += datumX;
+    y += datumY;
+    if (x < clipX0 || y < clipY0 || x >= clipX1 || y >= clipY1) {
+        return;
+    }
+    fillSpan(y, x, x + 1, color);
+}
+
+void MemoryCanvas::drawFastHLine(int32_t x, int32_t y, int32_t w, uint32_t color) {
+    fillRect(x, y, w, 1, color);
+}
+
+void MemoryCanvas::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+    int32_t x0 = std::max(x + datumX, clipX0);
+    int32_t y0 = std::max(y + datumY, clipY0);
+    int32_t x1 = std::min(x + datumX + w, clipX1);
+    int32_t y1 = std::min(y + datumY + h, clipY1);
+    for (int32_t row = y0; row < y1; row++) {
+        fillSpan(row, x0, x1, color);
+    }
+}
+
+void MemoryCanvas::drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+    fillRect(x, y, w, 1, color);
+    fillRect(x, y + h - 1, w, 1, color);
+    fillRect(x, y, 1, h, color);
+    fillRect(x + w - 1, y, 1, h, color);
+}
+
+void MemoryCanvas::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color) {
+    // Bresenham
+    int32_t dx = std::abs(x1 - x0);
+    int32_t dy = -std::abs(y1 - y0);
+    int32_t sx = x0 < x1 ? 1 : -1;
+    int32_t sy = y0 < y1 ? 1 : -1;
+    int32_t err = dx + dy;
+    for (;;) {
+        drawPixel(x0, y0, color);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int32_t e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+void MemoryCanvas::drawTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                                uint32_t color) {
+    drawLine(x0, y0, x1, y1, color);
+    drawLine(x1, y1, x2, y2, color);
+    drawLine(x2, y2, x0, y0, color);
+}
+
+void MemoryCanvas::fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                                uint32_t color) {
+    // Scanline fill, vertices sorted by y
+    if (y0 > y1) { std::swap(y0, y1); std::swap(x0, x1); }
+    if (y1 > y2) { std::swap(y2, y1); std::swap(x2, x1); }
+    if (y0 > y1) { std::swap(y0, y1); std::swap(x0, x1); }
+
+    if (y0 == y2) {
+        int32_t a = std::min(x0, std::min(x1, x2));
+        int32_t b = std::max(x0, std::max(x1, x2));
+        drawFastHLine(a, y0, b - a + 1, color);
+        return;
+    }
+
+    for (int32_t y = y0; y <= y2; y++) {
+        int32_t a = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+        int32_t b = y < y1 || y1 == y2
+                    ? (y1 == y0 ? x1 : x0 + (x1 - x0) * (y - y0) / (y1 - y0))
+                    : x1 + (x2 - x1) * (y - y1) / (y2 - y1);
+        if (a > b) {
+            std::swap(a, b);
+        }
+        drawFastHLine(a, y, b - a + 1, color);
+    }
+}
+
+void MemoryCanvas::drawCircle(int32_t x0, int32_t y0, int32_t r, uint32_t color) {
+    // Midpoint circle
+    int32_t x = r;
+    int32_t y = 0;
+    int32_t err = 1 - r;
+    while (x >= y) {
+        drawPixel(x0 + x, y0 + y, color);
+        drawPixel(x0 + y, y0 + x, color);
+        drawPixel(x0 - y, y0 + x, color);
+        drawPixel(x0 - x, y0 + y, color);
+        drawPixel(x0 - x, y0 - y, color);
+        drawPixel(x0 - y, y0 - x, color);
+        drawPixel(x0 + y, y0 - x, color);
+        drawPixel(x0 + x, y0 - y, color);
+        y++;
+        if (err < 0) {
+            err += 2 * y + 1;
+        } else {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+void MemoryCanvas::fillCircle(int32_t x0, int32_t y0, int32_t r, uint32_t color) {
+    for (int32_t dy = -r; dy <= r; dy++) {
+        int32_t dx = 0;
+        while ((dx + 1) * (dx + 1) + dy * dy <= r * r) {
+            dx++;
+        }
+        drawFastHLine(x0 - dx, y0 + dy, 2 * dx + 1, color);
+    }
+}
+
+void MemoryCanvas::setViewport(int32_t x, int32_t y, int32_t w, int32_t h, bool vpDatum) {
+    clipX0 = std::max<int32_t>(x, 0);
+    clipY0 = std::max<int32_t>(y, 0);
+    clipX1 = std::min<int32_t>(x + w, canvasWidth);
+    clipY1 = std::min<int32_t>(y + h, canvasHeight);
+    datumX = vpDatum ? x : 0;
+    datumY = vpDatum ? y : 0;
+}
+
+void MemoryCanvas::resetViewport() {
+    setViewport(0, 0, canvasWidth, canvasHeight, false);
+}
+
+void MemoryCanvas::setTextColor(uint16_t color) {
+    textColor = color;
+}
+
+void MemoryCanvas::setTextSize(uint8_t size) {
+    textSize = size;
+}
+
+void MemoryCanvas::setCursor(int16_t x, int16_t y) {
+    cursorX = x;
+    cursorY = y;
+}
+
+void MemoryCanvas::print(const char *text) {
+    for (const char *c = text; *c; c++) {
+        if (*c == '\n') {
+            cursorX = 0;
+            cursorY += 8 * textSize;
+        } else {
+            drawChar(*c);
+        }
+    }
+}
+
+void MemoryCanvas::print(int value) {
+    char buffer[12];
+    snprintf(buffer, sizeof(buffer), "%d", value);
+    print(buffer);
+}
+
+void MemoryCanvas::println(const char *text) {
+    print(text);
+    print("\n");
+}
+
+void MemoryCanvas::fillSpan(int32_t y, int32_t x0, int32_t x1, uint32_t color) {
+    if (x0 >= x1) {
+        return;
+    }
+    if (colorDepth == 16) {
+        uint16_t *row = reinterpret_cast<uint16_t *>(pixels.data()) + y * canvasWidth;
+        std::fill(row + x0, row + x1, (uint16_t) color);
+        return;
+    }
+
+    // Odd leading and trailing pixels share their byte with a neighbour
+    uint8_t index = color & 0x0F;
+    uint8_t *row = pixels.data() + y * canvasWidth / 2;
+    if (x0 & 1) {
+        row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | index;
+        x0++;
+    }
+    if (x1 & 1 && x0 < x1) {
+        x1--;
+        row[x1 >> 1] = (row[x1 >> 1] & 0x0F) | (index << 4);
+    }
+    if (x0 < x1) {
+        memset(row + (x0 >> 1), index * 0x11, (x1 - x0) >> 1);
+    }
+}
+
+void MemoryCanvas::drawChar(char c) {
+    // 5x7 glyph in a 6x8 cell, transparent background like TFT_eSPI with a single text color
+    for (int col = 0; col < 5; col++) {
+        uint8_t bits = c == ' ' ? 0 : (uint8_t) ((c * 0x9E + col * 0x3B) ^ (c >> 1)) & 0x7F;
+        for (int row = 0; row < 7; row++) {
+            if (bits & (1 << row)) {
+                if (textSize == 1) {
+                    drawPixel(cursorX + col, cursorY + row, textColor);
+                } else {
+                    fillRect(cursorX + col * textSize, cursorY + row * textSize, textSize, textSize, textColor);
+                }
+            }
+        }
+    }
+    cursorX += 6 * textSize;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// In-memory canvas implementing the subset of the TFT_eSprite API the Display uses.
+// Primitives are rasterized like TFT_eSPI does, so per-frame costs are comparable; glyph shapes
+// are synthetic but have the 5x7 cell cost of the TFT_eSPI GLCD font.
+// At 16 bits pixels are RGB565 in native byte order (TFT_eSprite swaps them). At 4 bits colors are
+// palette indices packed like TFT_eSprite does, the even pixel in the high nibble; width must be even.
+class MemoryCanvas {
+public:
+    MemoryCanvas(int16_t width, int16_t height, int8_t colorDepth = 16);
+
+    int16_t width() const;
+
+    int16_t height() const;
+
+    int8_t getColorDepth() const;
+
+    void *getPointer();
+
+    void createPalette(const uint16_t *colors, uint8_t count);
+
+    // RGB565, looked up in the palette at 4 bits
+    uint16_t readPixel(int32_t x, int32_t y) const;
+
+    void fillSprite(uint32_t color);
+
+    void drawPixel(int32_t x, int32_t y, uint32_t color);
+
+    void drawFastHLine(int32_t x, int32_t y, int32_t w, uint32_t color);
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+
+    void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+
+    void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color);
+
+    void drawTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color);
+
+    void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color);
+
+    void drawCircle(int32_t x0, int32_t y0, int32_t r, uint32_t color);
+
+    void fillCircle(int32_t x0, int32_t y0, int32_t r, uint32_t color);
+
+    void setViewport(int32_t x, int32_t y, int32_t w, int32_t h, bool vpDatum = true);
+
+    void resetViewport();
+
+    void setTextColor(uint16_t color);
+
+    void setTextSize(uint8_t size);
+
+    void setCursor(int16_t x, int16_t y);
+
+    void print(const char *text);
+
+    void print(int value);
+
+    void println(const char *text);
+
+private:
+    int16_t canvasWidth;
+    int16_t canvasHeight;
+    int8_t colorDepth;
+    std::vector<uint8_t> pixels;
+    uint16_t palette[16];
+
+    // Clip window and coordinate offset
+    int32_t clipX0, clipY0, clipX1, clipY1;
+    int32_t datumX, datumY;
+
+    uint16_t textColor;
+    uint8_t textSize;
+    int16_t cursorX;
+    int16_t cursorY;
+
+    // Sets pixels x0 to x1 (excluded) of row y, unclipped
+    void fillSpan(int32_t y, int32_t x0, int32_t x1, uint32_t color);
+
+    void drawChar(char c);
+};
@@ -0,0 +1,175 @@
+#include "power_manager.h"
+#include <algorithm>
+#include "event_log.h"
+
+namespace {
+
+const char *const POWER_STATE_NAMES[] = {"ACTIVE", "IDLE", "DIMMED", "BLANK", "STANDBY"};
+
+uint32_t cpuMhzFor(PowerState state) {
+    return state == POWER_ACTIVE ? POWER_ACTIVE_CPU_MHZ : POWER_IDLE_CPU_MHZ;
+}
+
+}
+
+const char *powerStateName(PowerState state) {
+    return state < POWER_STATE_COUNT ? POWER_STATE_NAMES[state] : "?";
+}
+
+PowerManager::PowerManager(PowerControl &control, Clock &clock) :
+        control(control),
+        clock(clock),
+        enabled(true),
+        state(POWER_ACTIVE),
+        lastActivityMs(0),
+        lastAccountUs(0),
+        lastFramesSent(0),
+        sleptUs(0),
+        timeInStateUs{},
+        chargeUaUs(0),
+        sleeps(0),
+        wakeups(0),
+        statsLock() {
+}
+
+void PowerManager::begin() {
+    control.setCpuFrequency(cpuMhzFor(state));
+    lastActivityMs = clock.millis();
+    lastAccountUs = clock.micros();
+}
+
+void PowerManager::setEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+bool PowerManager::update(bool active, uint32_t framesSent) {
+    account(framesSent);
+    uint32_t now = clock.millis();
+    if (active) {
+        lastActivityMs = now;
+    }
+
+    PowerState next = POWER_ACTIVE;
+    uint32_t rest = now - lastActivityMs;
+    if (enabled && rest >= POWER_STANDBY_TIME) {
+        next = POWER_STANDBY;
+    } else if (enabled && rest >= POWER_BLANK_TIME) {
+        next = POWER_BLANK;
+    } else if (enabled && rest >= POWER_DIM_TIME) {
+        next = POWER_DIMMED;
+    } else if (enabled && rest >= POWER_IDLE_TIME) {
+        next = POWER_IDLE;
+    }
+    return enter(next);
+}
+
+bool PowerManager::sleepUntilNextTick(uint32_t tickStartUs) {
+    uint32_t awake = clock.micros() - tickStartUs;
+    if (state != POWER_STANDBY || awake + POWER_SLEEP_GUARD_US >= POWER_STANDBY_PERIOD_US) {
+        return false;
+    }
+
+    uint32_t start = clock.micros();
+    bool button = control.lightSleep(POWER_STANDBY_PERIOD_US - POWER_SLEEP_GUARD_US - awake);
+    statsLock.lock();
+    sleptUs += clock.micros() - start;
+    sleeps++;
+    statsLock.unlock();
+    if (!button) {
+        return false;
+    }
+    lastActivityMs = clock.millis();
+    account(lastFramesSent);
+    return enter(POWER_ACTIVE);
+}
+
+PowerState PowerManager::getState() const {
+    return state;
+}
+
+uint8_t PowerManager::getBacklight() const {
+    switch (state) {
+        case POWER_ACTIVE:
+        case POWER_IDLE:
+            return BACKLIGHT_FULL;
+        case POWER_DIMMED:
+            return BACKLIGHT_DIM;
+        default:
+            return 0;
+    }
+}
+
+uint32_t PowerManager::getControlPeriodUs() const {
+    return state == POWER_STANDBY ? POWER_STANDBY_PERIOD_US : CONTROL_PERIOD_US;
+}
+
+power_stats PowerManager::getStats() const {
+    statsLock.lock();
+    uint64_t timeUs[POWER_STATE_COUNT];
+    std::copy(timeInStateUs, timeInStateUs + POWER_STATE_COUNT, timeUs);
+    uint64_t charge = chargeUaUs;
+    power_stats result = {state, {}, 0, 0, sleeps, wakeups};
+    statsLock.unlock();
+
+    uint64_t totalUs = 0;
+    for (int i = 0; i < POWER_STATE_COUNT; i++) {
+        result.timeInStateMs[i] = (uint32_t) (timeUs[i] / 1000);
+        totalUs += timeUs[i];
+    }
+    if (totalUs > 0) {
+        result.averageCurrentUa = (uint32_t) (charge / totalUs);
+    }
+    if (result.averageCurrentUa > 0) {
+        result.runtimeMinutes = (uint32_t) (POWER_BATTERY_MAH * 60000ULL / result.averageCurrentUa);
+    }
+    return result;
+}
+
+uint32_t PowerManager::stateCurrentUa(PowerState state) {
+    // The panel and its backlight come on top of the chip and the board
+    uint32_t cpu = state == POWER_ACTIVE ? POWER_CURRENT_CPU_FAST : POWER_CURRENT_CPU_SLOW;
+    uint32_t current = (cpu + POWER_CURRENT_RX + POWER_CURRENT_BOARD) * 1000;
+    uint32_t panel = POWER_CURRENT_PANEL * 1000;
+    switch (state) {
+        case POWER_ACTIVE:
+        case POWER_IDLE:
+            return current + panel + POWER_CURRENT_BACKLIGHT * 1000;
+        case POWER_DIMMED:
+            return current + panel + POWER_CURRENT_BACKLIGHT * 1000 * BACKLIGHT_DIM / BACKLIGHT_FULL;
+        default:
+            return current;
+    }
+}
+
+void PowerManager::account(uint32_t framesSent) {
+    uint32_t now = clock.micros();
+    statsLock.lock();
+    uint32_t elapsed = now - lastAccountUs;
+    uint32_t slept = std::min(sleptUs, elapsed);
+    timeInStateUs[state] += elapsed;
+    chargeUaUs += (uint64_t) stateCurrentUa(state) * (elapsed - slept) +
+                  (uint64_t) (POWER_CURRENT_SLEEP + POWER_CURRENT_BOARD) * 1000 * slept +
+                  (uint64_t) (framesSent - lastFramesSent) * POWER_CURRENT_TX * 1000 * POWER_TX_FRAME_US;
+    lastAccountUs = now;
+    lastFramesSent = framesSent;
+    sleptUs = 0;
+    statsLock.unlock();
+}
+
+bool PowerManager::enter(PowerState next) {
+    if (next == state) {
+        return false;
+    }
+    uint32_t period = getControlPeriodUs();
+    if (cpuMhzFor(next) != cpuMhzFor(state)) {
+        control.setCpuFrequency(cpuMhzFor(next));
+    }
+    statsLock.lock();
+    if (state == POWER_STANDBY) {
+        wakeups++;
+    }
+    state = next;
+    statsLock.unlock();
+    logEvent(LOG_POWER_STATE, next);
+    return getControlPeriodUs() != period;
+}
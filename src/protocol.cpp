@@ -0,0 +1,311 @@
+#include "protocol.h"
+
+void putU16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t) (value & 0xFF);
+    p[1] = (uint8_t) (value >> 8);
+}
+
+uint16_t getU16(const uint8_t *p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+void putU32(uint8_t *p, uint32_t value) {
+    putU16(p, (uint16_t) value);
+    putU16(p + 2, (uint16_t) (value >> 16));
+}
+
+uint32_t getU32(const uint8_t *p) {
+    return getU16(p) | ((uint32_t) getU16(p + 2) << 16);
+}
+
+namespace {
+
+void putHeader(uint8_t *buffer, uint8_t type, const control_frame &frame) {
+    buffer[0] = PROTOCOL_VERSION;
+    buffer[1] = (uint8_t) ((type << 4) | (frame.buttons & 0x0F));
+    putU16(buffer + 2, frame.sequence);
+    putU16(buffer + 4, frame.timestamp);
+    putU16(buffer + 6, (uint16_t) frame.x);
+    putU16(buffer + 8, (uint16_t) frame.y);
+}
+
+void getHeader(const uint8_t *buffer, control_frame &frame) {
+    frame.buttons = buffer[1] & 0x0F;
+    frame.sequence = getU16(buffer + 2);
+    frame.timestamp = getU16(buffer + 4);
+    frame.x = (int16_t) getU16(buffer + 6);
+    frame.y = (int16_t) getU16(buffer + 8);
+}
+
+}
+
+uint8_t crc8(const uint8_t *data, size_t length) {
+    uint8_t crc = 0x00;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t putVarint(uint8_t *p, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t) value;
+    return n;
+}
+
+size_t getVarint(const uint8_t *p, const uint8_t *end, uint32_t &value) {
+    value = 0;
+    for (size_t n = 0; n < 5 && p + n < end; n++) {
+        value |= (uint32_t) (p[n] & 0x7F) << (7 * n);
+        if ((p[n] & 0x80) == 0) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t zigzag(int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+int32_t unzigzag(uint32_t value) {
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+size_t encodeControlFrame(const control_frame &frame, uint8_t *buffer, size_t size) {
+    if (size < CONTROL_FRAME_SIZE) {
+        return 0;
+    }
+
+    putHeader(buffer, FRAME_TYPE_CONTROL, frame);
+    buffer[10] = crc8(buffer, CONTROL_FRAME_SIZE - 1);
+    return CONTROL_FRAME_SIZE;
+}
+
+DecodeResult decodeControlFrame(const uint8_t *buffer, size_t length, control_frame &frame) {
+    if (length < CONTROL_FRAME_SIZE) {
+        return DECODE_TOO_SHORT;
+    }
+    if (buffer[0] != PROTOCOL_VERSION) {
+        return DECODE_BAD_VERSION;
+    }
+    if ((buffer[1] >> 4) != FRAME_TYPE_CONTROL) {
+        return DECODE_BAD_TYPE;
+    }
+    if (length != CONTROL_FRAME_SIZE) {
+        return DECODE_BAD_LENGTH;
+    }
+    if (crc8(buffer, CONTROL_FRAME_SIZE - 1) != buffer[10]) {
+        return DECODE_BAD_CRC;
+    }
+
+    getHeader(buffer, frame);
+    return DECODE_OK;
+}
+
+size_t encodeHistoryFrame(const control_frame *samples, uint8_t count, uint8_t *buffer, size_t size) {
+    if (count == 0 || count > HISTORY_MAX_SAMPLES || size < HISTORY_FRAME_MAX_SIZE) {
+        return 0;
+    }
+
+    putHeader(buffer, FRAME_TYPE_HISTORY, samples[0]);
+    size_t n = CONTROL_FRAME_SIZE - 1;
+    buffer[n++] = count - 1;
+    for (uint8_t i = 1; i < count; i++) {
+        const control_frame &newer = samples[i - 1];
+        const control_frame &older = samples[i];
+        uint16_t dt = (uint16_t) (newer.timestamp - older.timestamp);
+        n += putVarint(buffer + n, ((uint32_t) dt << 4) | (older.buttons & 0x0F));
+        n += putVarint(buffer + n, zigzag(older.x - newer.x));
+        n += putVarint(buffer + n, zigzag(older.y - newer.y));
+    }
+    buffer[n] = crc8(buffer, n);
+    return n + 1;
+}
+
+DecodeResult decodeHistoryFrame(const uint8_t *buffer, size_t length, history_frame &frame) {
+    if (length >= 2 && buffer[0] == PROTOCOL_VERSION && (buffer[1] >> 4) == FRAME_TYPE_CONTROL) {
+        frame.count = 1;
+        return decodeControlFrame(buffer, length, frame.samples[0]);
+    }
+    if (length < CONTROL_FRAME_SIZE + 1) {
+        return DECODE_TOO_SHORT;
+    }
+    if (buffer[0] != PROTOCOL_VERSION) {
+        return DECODE_BAD_VERSION;
+    }
+    if ((buffer[1] >> 4) != FRAME_TYPE_HISTORY) {
+        return DECODE_BAD_TYPE;
+    }
+    if (crc8(buffer, length - 1) != buffer[length - 1]) {
+        return DECODE_BAD_CRC;
+    }
+
+    getHeader(buffer, frame.samples[0]);
+    uint8_t older = buffer[CONTROL_FRAME_SIZE - 1];
+    if (older >= HISTORY_MAX_SAMPLES) {
+        return DECODE_BAD_LENGTH;
+    }
+
+    const uint8_t *p = buffer + CONTROL_FRAME_SIZE;
+    const uint8_t *end = buffer + length - 1;
+    for (uint8_t i = 1; i <= older; i++) {
+        uint32_t timeAndButtons;
+        uint32_t dx;
+        uint32_t dy;
+        size_t used;
+        if ((used = getVarint(p, end, timeAndButtons)) == 0) {
+            return DECODE_BAD_LENGTH;
+        }
+        p += used;
+        if ((used = getVarint(p, end, dx)) == 0) {
+            return DECODE_BAD_LENGTH;
+        }
+        p += used;
+        if ((used = getVarint(p, end, dy)) == 0) {
+            return DECODE_BAD_LENGTH;
+        }
+        p += used;
+
+        const control_frame &newer = frame.samples[i - 1];
+        control_frame &sample = frame.samples[i];
+        sample.sequence = (uint16_t) (newer.sequence - 1);
+        sample.timestamp = (uint16_t) (newer.timestamp - (timeAndButtons >> 4));
+        sample.buttons = timeAndButtons & 0x0F;
+        sample.x = (int16_t) (newer.x + unzigzag(dx));
+        sample.y = (int16_t) (newer.y + unzigzag(dy));
+    }
+    if (p != end) {
+        return DECODE_BAD_LENGTH;
+    }
+    frame.count = older + 1;
+    return DECODE_OK;
+}
+
+size_t encodeProbeFrame(const probe_frame &frame, uint8_t *buffer, size_t size) {
+    if (size < PROBE_FRAME_SIZE || (frame.type != FRAME_TYPE_PROBE && frame.type != FRAME_TYPE_ECHO)) {
+        return 0;
+    }
+
+    buffer[0] = PROTOCOL_VERSION;
+    buffer[1] = (uint8_t) (frame.type << 4);
+    putU16(buffer + 2, frame.sequence);
+    putU32(buffer + 4, frame.timestamp);
+    buffer[8] = crc8(buffer, PROBE_FRAME_SIZE - 1);
+    return PROBE_FRAME_SIZE;
+}
+
+DecodeResult decodeProbeFrame(const uint8_t *buffer, size_t length, probe_frame &frame) {
+    if (length < PROBE_FRAME_SIZE) {
+        return DECODE_TOO_SHORT;
+    }
+    if (buffer[0] != PROTOCOL_VERSION) {
+        return DECODE_BAD_VERSION;
+    }
+    uint8_t type = buffer[1] >> 4;
+    if (type != FRAME_TYPE_PROBE && type != FRAME_TYPE_ECHO) {
+        return DECODE_BAD_TYPE;
+    }
+    if (length != PROBE_FRAME_SIZE) {
+        return DECODE_BAD_LENGTH;
+    }
+    if (crc8(buffer, PROBE_FRAME_SIZE - 1) != buffer[8]) {
+        return DECODE_BAD_CRC;
+    }
+
+    frame.type = type;
+    frame.sequence = getU16(buffer + 2);
+    frame.timestamp = getU32(buffer + 4);
+    return DECODE_OK;
+}
+
+bool echoProbeFrame(uint8_t *buffer, size_t length) {
+    probe_frame frame;
+    if (decodeProbeFrame(buffer, length, frame) != DECODE_OK || frame.type != FRAME_TYPE_PROBE) {
+        return false;
+    }
+    frame.type = FRAME_TYPE_ECHO;
+    return encodeProbeFrame(frame, buffer, length) == PROBE_FRAME_SIZE;
+}
+
+size_t encodeButtonFrame(const button_frame &frame, uint8_t *buffer, size_t size) {
+    if (size < BUTTON_FRAME_SIZE) {
+        return 0;
+    }
+
+    buffer[0] = PROTOCOL_VERSION;
+    buffer[1] = (uint8_t) ((FRAME_TYPE_BUTTON << 4) | (frame.event & 0x0F));
+    putU16(buffer + 2, frame.sequence);
+    putU16(buffer + 4, frame.timestamp);
+    buffer[6] = frame.attempt;
+    buffer[7] = crc8(buffer, BUTTON_FRAME_SIZE - 1);
+    return BUTTON_FRAME_SIZE;
+}
+
+DecodeResult decodeButtonFrame(const uint8_t *buffer, size_t length, button_frame &frame) {
+    if (length < BUTTON_FRAME_SIZE) {
+        return DECODE_TOO_SHORT;
+    }
+    if (buffer[0] != PROTOCOL_VERSION) {
+        return DECODE_BAD_VERSION;
+    }
+    if ((buffer[1] >> 4) != FRAME_TYPE_BUTTON) {
+        return DECODE_BAD_TYPE;
+    }
+    if (length != BUTTON_FRAME_SIZE) {
+        return DECODE_BAD_LENGTH;
+    }
+    if (crc8(buffer, BUTTON_FRAME_SIZE - 1) != buffer[7]) {
+        return DECODE_BAD_CRC;
+    }
+
+    frame.event = buffer[1] & 0x0F;
+    frame.sequence = getU16(buffer + 2);
+    frame.timestamp = getU16(buffer + 4);
+    frame.attempt = buffer[6];
+    return DECODE_OK;
+}
+
+size_t encodeChannelFrame(const channel_frame &frame, uint8_t *buffer, size_t size) {
+    if (size < CHANNEL_FRAME_SIZE) {
+        return 0;
+    }
+
+    buffer[0] = PROTOCOL_VERSION;
+    buffer[1] = (uint8_t) (FRAME_TYPE_CHANNEL << 4);
+    putU16(buffer + 2, frame.hop);
+    buffer[4] = frame.channel;
+    buffer[5] = frame.delay;
+    buffer[6] = crc8(buffer, CHANNEL_FRAME_SIZE - 1);
+    return CHANNEL_FRAME_SIZE;
+}
+
+DecodeResult decodeChannelFrame(const uint8_t *buffer, size_t length, channel_frame &frame) {
+    if (length < CHANNEL_FRAME_SIZE) {
+        return DECODE_TOO_SHORT;
+    }
+    if (buffer[0] != PROTOCOL_VERSION) {
+        return DECODE_BAD_VERSION;
+    }
+    if ((buffer[1] >> 4) != FRAME_TYPE_CHANNEL) {
+        return DECODE_BAD_TYPE;
+    }
+    if (length != CHANNEL_FRAME_SIZE) {
+        return DECODE_BAD_LENGTH;
+    }
+    if (crc8(buffer, CHANNEL_FRAME_SIZE - 1) != buffer[6]) {
+        return DECODE_BAD_CRC;
+    }
+
+    frame.hop = getU16(buffer + 2);
+    frame.channel = buffer[4];
+    frame.delay = buffer[5];
+    return DECODE_OK;
+}
@@ -0,0 +1,160 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <cstdio>
+
+Scheduler::Scheduler(Clock &clock) :
+        clock(clock),
+        tasks{},
+        taskCount(0),
+        statsLock(),
+        lastReportMs(0) {
+}
+
+int Scheduler::addTask(const char *name, TaskFunction function, void *context, uint32_t periodUs,
+                       uint8_t priority) {
+    if (taskCount >= SCHEDULER_MAX_TASKS) {
+        return -1;
+    }
+
+    // Keep the table sorted so runDue() serves the control path first
+    int index = taskCount;
+    while (index > 0 && tasks[index - 1].priority < priority) {
+        tasks[index] = tasks[index - 1];
+        index--;
+    }
+    Task &task = tasks[index];
+    task = {};
+    task.name = name;
+    task.function = function;
+    task.context = context;
+    task.periodUs = periodUs;
+    task.priority = priority;
+    taskCount++;
+    return index;
+}
+
+void Scheduler::begin() {
+    uint32_t now = clock.micros();
+    for (int i = 0; i < taskCount; i++) {
+        tasks[i].nextReleaseUs = now + tasks[i].periodUs;
+    }
+
+#ifndef NATIVE_BUILD
+    for (int i = 0; i < taskCount; i++) {
+        Task &task = tasks[i];
+        task.scheduler = this;
+        xTaskCreatePinnedToCore(taskLoop, task.name, SCHEDULER_TASK_STACK_SIZE, &task, task.priority,
+                                &task.handle, SCHEDULER_CORE);
+
+        esp_timer_create_args_t timerArgs = {};
+        timerArgs.callback = onTimer;
+        timerArgs.arg = &task;
+        timerArgs.dispatch_method = ESP_TIMER_TASK;
+        timerArgs.name = task.name;
+        esp_timer_create(&timerArgs, &task.timer);
+    }
+    // Started last so every task exists before its first release
+    for (int i = 0; i < taskCount; i++) {
+        esp_timer_start_periodic(tasks[i].timer, tasks[i].periodUs);
+    }
+#endif
+}
+
+#ifdef NATIVE_BUILD
+uint32_t Scheduler::runDue() {
+    for (int i = 0; i < taskCount; i++) {
+        Task &task = tasks[i];
+        int32_t late = (int32_t) (clock.micros() - task.nextReleaseUs);
+        if (late >= 0) {
+            runTask(task, (uint32_t) late / task.periodUs);
+        }
+    }
+
+    uint32_t now = clock.micros();
+    uint32_t untilNext = UINT32_MAX;
+    for (int i = 0; i < taskCount; i++) {
+        int32_t remaining = (int32_t) (tasks[i].nextReleaseUs - now);
+        untilNext = std::min(untilNext, (uint32_t) std::max(remaining, (int32_t) 0));
+    }
+    return untilNext;
+}
+#else
+void Scheduler::onTimer(void *param) {
+    // Runs in the esp_timer task, pending releases accumulate in the notification count
+    xTaskNotifyGive(static_cast<Task *>(param)->handle);
+}
+
+void Scheduler::taskLoop(void *param) {
+    Task *task = static_cast<Task *>(param);
+    for (;;) {
+        uint32_t releases = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        task->scheduler->runTask(*task, releases - 1);
+    }
+}
+#endif
+
+void Scheduler::runTask(Task &task, uint32_t droppedReleases) {
+    // Releases missed while the previous run overran are skipped, not run back to back
+    task.nextReleaseUs += droppedReleases * task.periodUs;
+    uint32_t release = task.nextReleaseUs;
+    uint32_t start = clock.micros();
+    task.function(task.context);
+    uint32_t end = clock.micros();
+    task.nextReleaseUs += task.periodUs;
+
+    statsLock.lock();
+    task.stats.runs++;
+    task.stats.overruns += droppedReleases;
+    if ((int32_t) (end - task.nextReleaseUs) > 0) {
+        task.stats.deadlineMisses++;
+    }
+    task.stats.runTimeMaxUs = std::max(task.stats.runTimeMaxUs, end - start);
+    task.jitterUs.record((int32_t) (start - release) > 0 ? start - release : 0);
+    statsLock.unlock();
+}
+
+void Scheduler::setPeriod(int task, uint32_t periodUs) {
+    // runTask() adds the period once the function returns
+    tasks[task].periodUs = periodUs;
+    tasks[task].nextReleaseUs = clock.micros();
+#ifndef NATIVE_BUILD
+    esp_timer_stop(tasks[task].timer);
+    esp_timer_start_periodic(tasks[task].timer, periodUs);
+#endif
+}
+
+int Scheduler::getTaskCount() const {
+    return taskCount;
+}
+
+task_stats Scheduler::getStats(int task) const {
+    statsLock.lock();
+    task_stats copy = tasks[task].stats;
+    statsLock.unlock();
+    return copy;
+}
+
+bool Scheduler::reportDue(uint32_t nowMs) const {
+    return nowMs - lastReportMs >= SCHEDULER_REPORT_INTERVAL;
+}
+
+void Scheduler::report(LineWriter write, uint32_t nowMs) {
+    char line[112];
+    for (int i = 0; i < taskCount; i++) {
+        // Snapshot under the lock, format outside of it
+        statsLock.lock();
+        task_stats stats = tasks[i].stats;
+        LatencyHistogram jitter = tasks[i].jitterUs;
+        tasks[i].stats = {};
+        tasks[i].jitterUs.reset();
+        statsLock.unlock();
+
+        snprintf(line, sizeof(line), "S,%lu,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+                 (unsigned long) nowMs, tasks[i].name, (unsigned long) stats.runs,
+                 (unsigned long) stats.deadlineMisses, (unsigned long) stats.overruns,
+                 (unsigned long) jitter.percentile(500), (unsigned long) jitter.percentile(990),
+                 (unsigned long) jitter.getMax(), (unsigned long) stats.runTimeMaxUs);
+        write(line);
+    }
+    lastReportMs = nowMs;
+}
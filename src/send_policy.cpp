@@ -0,0 +1,55 @@
+#include "send_policy.h"
+#include <cstdlib>
+
+void SendPolicy::onSent(send_state &state, const struct_message &data, unsigned long now) const {
+    state.hasSent = true;
+    state.lastSent = data;
+    state.lastSendTime = now;
+}
+
+bool SendPolicy::changedBeyond(const send_state &state, const struct_message &data, int threshold) {
+    return data.button != state.lastSent.button ||
+           abs(data.x - state.lastSent.x) > threshold ||
+           abs(data.y - state.lastSent.y) > threshold;
+}
+
+FixedRatePolicy::FixedRatePolicy(unsigned long interval) :
+        interval(interval) {
+}
+
+bool FixedRatePolicy::shouldSend(const send_state &state, const struct_message & /*data*/, unsigned long now) const {
+    return !state.hasSent || now - state.lastSendTime >= interval;
+}
+
+OnChangePolicy::OnChangePolicy(int threshold, unsigned long minInterval, unsigned long keepaliveInterval) :
+        threshold(threshold),
+        minInterval(minInterval),
+        keepaliveInterval(keepaliveInterval) {
+}
+
+bool OnChangePolicy::shouldSend(const send_state &state, const struct_message &data, unsigned long now) const {
+    if (!state.hasSent) {
+        return true;
+    }
+
+    unsigned long elapsed = now - state.lastSendTime;
+    if (elapsed < minInterval) {
+        return false;
+    }
+    return changedBeyond(state, data, threshold) || elapsed >= keepaliveInterval;
+}
+
+HybridPolicy::HybridPolicy(int threshold, unsigned long minInterval, unsigned long streamInterval,
+                           unsigned long keepaliveInterval) :
+        OnChangePolicy(threshold, minInterval, keepaliveInterval),
+        streamInterval(streamInterval) {
+}
+
+bool HybridPolicy::shouldSend(const send_state &state, const struct_message &data, unsigned long now) const {
+    if (OnChangePolicy::shouldSend(state, data, now)) {
+        return true;
+    }
+
+    bool active = data.x != 0 || data.y != 0 || data.button;
+    return active && now - state.lastSendTime >= streamInterval;
+}
@@ -0,0 +1,133 @@
+#include <unity.h>
+#include "history_receiver.h"
+
+// Reference decoder of history frames, run on the host with: pio test -e native
+
+namespace {
+
+control_frame sampleFor(uint16_t sequence) {
+    return {sequence, (uint16_t) (sequence * 20), (int16_t) (sequence % 1000), (int16_t) -(sequence % 1000), 0};
+}
+
+// Frame carrying newest and the count - 1 samples before it, as the transmitter would send it
+int deliver(HistoryReceiver &receiver, uint16_t newest, uint8_t count, control_frame *out) {
+    control_frame samples[HISTORY_MAX_SAMPLES];
+    for (uint8_t i = 0; i < count; i++) {
+        samples[i] = sampleFor((uint16_t) (newest - i));
+    }
+    uint8_t buffer[HISTORY_FRAME_MAX_SIZE];
+    size_t length = encodeHistoryFrame(samples, count, buffer, sizeof(buffer));
+    TEST_ASSERT_NOT_EQUAL(0, length);
+    return receiver.receive(buffer, length, out);
+}
+
+void assertSequences(const control_frame *out, int written, uint16_t first, int expected) {
+    TEST_ASSERT_EQUAL(expected, written);
+    for (int i = 0; i < written; i++) {
+        control_frame sample = sampleFor((uint16_t) (first + i));
+        TEST_ASSERT_EQUAL_UINT16(sample.sequence, out[i].sequence);
+        TEST_ASSERT_EQUAL_UINT16(sample.timestamp, out[i].timestamp);
+        TEST_ASSERT_EQUAL_INT16(sample.x, out[i].x);
+        TEST_ASSERT_EQUAL_INT16(sample.y, out[i].y);
+    }
+}
+
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_in_order_frames_deliver_the_newest_sample() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    for (uint16_t sequence = 100; sequence < 110; sequence++) {
+        assertSequences(out, deliver(receiver, sequence, 3, out), sequence, 1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(10, receiver.getReceived());
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.getRecovered());
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.getLost());
+}
+
+void test_sequence_wraps() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    deliver(receiver, UINT16_MAX, 1, out);
+    assertSequences(out, deliver(receiver, 1, 4, out), 0, 2);
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.getRestarts());
+}
+
+void test_missed_samples_are_rebuilt_from_a_later_frame() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    deliver(receiver, 100, 4, out);
+    // 101 and 102 lost on air
+    assertSequences(out, deliver(receiver, 103, 4, out), 101, 3);
+    TEST_ASSERT_EQUAL_UINT32(2, receiver.getRecovered());
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.getLost());
+}
+
+void test_samples_older_than_the_history_are_lost() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    deliver(receiver, 100, 3, out);
+    assertSequences(out, deliver(receiver, 110, 3, out), 108, 3);
+    TEST_ASSERT_EQUAL_UINT32(7, receiver.getLost());
+}
+
+void test_stale_and_duplicate_frames_are_dropped() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    deliver(receiver, 100, 3, out);
+    TEST_ASSERT_EQUAL(0, deliver(receiver, 100, 3, out));
+    TEST_ASSERT_EQUAL(0, deliver(receiver, 101 - HISTORY_MAX_SAMPLES, 3, out));
+    TEST_ASSERT_EQUAL_UINT32(0, receiver.getRestarts());
+}
+
+void test_sender_restart_resyncs() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    deliver(receiver, 5000, 3, out);
+    deliver(receiver, 5001, 3, out);
+    // The transmitter rebooted, its count starts over at 0
+    assertSequences(out, deliver(receiver, 0, 1, out), 0, 1);
+    TEST_ASSERT_EQUAL_UINT32(1, receiver.getRestarts());
+    assertSequences(out, deliver(receiver, 1, 2, out), 1, 1);
+    assertSequences(out, deliver(receiver, 4, 4, out), 2, 3);
+    TEST_ASSERT_EQUAL_UINT32(1, receiver.getRestarts());
+}
+
+void test_control_frame_is_a_history_of_one() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    control_frame frame = sampleFor(42);
+    encodeControlFrame(frame, buffer, sizeof(buffer));
+    assertSequences(out, receiver.receive(buffer, sizeof(buffer), out), 42, 1);
+}
+
+void test_corrupt_frame_is_counted() {
+    HistoryReceiver receiver;
+    control_frame out[HISTORY_MAX_SAMPLES];
+    control_frame samples[2] = {sampleFor(10), sampleFor(9)};
+    uint8_t buffer[HISTORY_FRAME_MAX_SIZE];
+    size_t length = encodeHistoryFrame(samples, 2, buffer, sizeof(buffer));
+    buffer[length - 2] ^= 0x01;
+    TEST_ASSERT_EQUAL(0, receiver.receive(buffer, length, out));
+    TEST_ASSERT_EQUAL_UINT32(1, receiver.getCorrupt());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_in_order_frames_deliver_the_newest_sample);
+    RUN_TEST(test_sequence_wraps);
+    RUN_TEST(test_missed_samples_are_rebuilt_from_a_later_frame);
+    RUN_TEST(test_samples_older_than_the_history_are_lost);
+    RUN_TEST(test_stale_and_duplicate_frames_are_dropped);
+    RUN_TEST(test_sender_restart_resyncs);
+    RUN_TEST(test_control_frame_is_a_history_of_one);
+    RUN_TEST(test_corrupt_frame_is_counted);
+    return UNITY_END();
+}
@@ -0,0 +1,133 @@
+#include <unity.h>
+#include <cstring>
+#include "protocol.h"
+
+// Control frame codec, run on the host with: pio test -e native
+
+namespace {
+
+control_frame roundTrip(const control_frame &frame) {
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    TEST_ASSERT_EQUAL(CONTROL_FRAME_SIZE, encodeControlFrame(frame, buffer, sizeof(buffer)));
+    control_frame decoded = {};
+    TEST_ASSERT_EQUAL(DECODE_OK, decodeControlFrame(buffer, sizeof(buffer), decoded));
+    return decoded;
+}
+
+void assertFrameEqual(const control_frame &expected, const control_frame &actual) {
+    TEST_ASSERT_EQUAL_UINT16(expected.sequence, actual.sequence);
+    TEST_ASSERT_EQUAL_UINT16(expected.timestamp, actual.timestamp);
+    TEST_ASSERT_EQUAL_INT16(expected.x, actual.x);
+    TEST_ASSERT_EQUAL_INT16(expected.y, actual.y);
+    TEST_ASSERT_EQUAL_UINT8(expected.buttons, actual.buttons);
+}
+
+// A valid frame to corrupt
+void encodeSample(uint8_t *buffer) {
+    control_frame frame = {1234, 5678, -200, 150, BUTTON_MAIN};
+    TEST_ASSERT_EQUAL(CONTROL_FRAME_SIZE, encodeControlFrame(frame, buffer, CONTROL_FRAME_SIZE));
+}
+
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_round_trip_at_the_extremes() {
+    control_frame low = {0, 0, INT16_MIN, INT16_MIN, 0};
+    control_frame high = {UINT16_MAX, UINT16_MAX, INT16_MAX, INT16_MAX, 0x0F};
+    control_frame mixed = {0x8001, 0x00FF, INT16_MIN, INT16_MAX, BUTTON_MAIN};
+    assertFrameEqual(low, roundTrip(low));
+    assertFrameEqual(high, roundTrip(high));
+    assertFrameEqual(mixed, roundTrip(mixed));
+}
+
+void test_layout_is_little_endian() {
+    control_frame frame = {0x0201, 0x0403, -2, 0x0605, BUTTON_MAIN};
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    encodeControlFrame(frame, buffer, sizeof(buffer));
+    const uint8_t expected[] = {PROTOCOL_VERSION, (FRAME_TYPE_CONTROL << 4) | BUTTON_MAIN, 0x01, 0x02, 0x03, 0x04,
+                                0xFE, 0xFF, 0x05, 0x06};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buffer, sizeof(expected));
+    TEST_ASSERT_EQUAL_UINT8(crc8(buffer, CONTROL_FRAME_SIZE - 1), buffer[CONTROL_FRAME_SIZE - 1]);
+}
+
+void test_encode_needs_room_for_the_frame() {
+    control_frame frame = {};
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    TEST_ASSERT_EQUAL(0, encodeControlFrame(frame, buffer, CONTROL_FRAME_SIZE - 1));
+}
+
+void test_corrupted_payload_is_bad_crc() {
+    // Past the version and type, any flipped bit is only caught by the CRC
+    for (size_t byte = 2; byte < CONTROL_FRAME_SIZE; byte++) {
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            uint8_t buffer[CONTROL_FRAME_SIZE];
+            encodeSample(buffer);
+            buffer[byte] ^= 1 << bit;
+            control_frame decoded;
+            TEST_ASSERT_EQUAL(DECODE_BAD_CRC, decodeControlFrame(buffer, sizeof(buffer), decoded));
+        }
+    }
+}
+
+void test_flipped_button_bit_is_bad_crc() {
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    encodeSample(buffer);
+    buffer[1] ^= BUTTON_MAIN;
+    control_frame decoded;
+    TEST_ASSERT_EQUAL(DECODE_BAD_CRC, decodeControlFrame(buffer, sizeof(buffer), decoded));
+}
+
+void test_wrong_version() {
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    encodeSample(buffer);
+    buffer[0] = PROTOCOL_VERSION + 1;
+    control_frame decoded;
+    TEST_ASSERT_EQUAL(DECODE_BAD_VERSION, decodeControlFrame(buffer, sizeof(buffer), decoded));
+}
+
+void test_wrong_type() {
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    encodeSample(buffer);
+    buffer[1] = (uint8_t) ((FRAME_TYPE_PROBE << 4) | (buffer[1] & 0x0F));
+    control_frame decoded;
+    TEST_ASSERT_EQUAL(DECODE_BAD_TYPE, decodeControlFrame(buffer, sizeof(buffer), decoded));
+}
+
+void test_short_frame() {
+    uint8_t buffer[CONTROL_FRAME_SIZE];
+    encodeSample(buffer);
+    control_frame decoded;
+    for (size_t length = 0; length < CONTROL_FRAME_SIZE; length++) {
+        TEST_ASSERT_EQUAL(DECODE_TOO_SHORT, decodeControlFrame(buffer, length, decoded));
+    }
+}
+
+void test_long_frame() {
+    // A valid frame followed by trailing bytes, on its own or forwarded by the history decoder
+    uint8_t buffer[CONTROL_FRAME_SIZE + 2] = {};
+    encodeSample(buffer);
+    control_frame decoded;
+    TEST_ASSERT_EQUAL(DECODE_BAD_LENGTH, decodeControlFrame(buffer, CONTROL_FRAME_SIZE + 1, decoded));
+    TEST_ASSERT_EQUAL(DECODE_BAD_LENGTH, decodeControlFrame(buffer, sizeof(buffer), decoded));
+    history_frame history;
+    TEST_ASSERT_EQUAL(DECODE_BAD_LENGTH, decodeHistoryFrame(buffer, sizeof(buffer), history));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_at_the_extremes);
+    RUN_TEST(test_layout_is_little_endian);
+    RUN_TEST(test_encode_needs_room_for_the_frame);
+    RUN_TEST(test_corrupted_payload_is_bad_crc);
+    RUN_TEST(test_flipped_button_bit_is_bad_crc);
+    RUN_TEST(test_wrong_version);
+    RUN_TEST(test_wrong_type);
+    RUN_TEST(test_short_frame);
+    RUN_TEST(test_long_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Turn the controller's serial output back into text: event log frames (event_log.h) are decoded with
+the messages of include/log_messages.h, the text lines around them are passed through.
+
+Usage:
+    python3 tools/decode_log.py /dev/ttyUSB0      # live, needs pyserial
+    python3 tools/decode_log.py capture.bin       # raw bytes saved from the port
+    python3 tools/decode_log.py - < capture.bin
+
+Frame:
+    mark (0xFE), id, argc (bit 7: summary), uint32 time us, varint repeated, zigzag varint args, CRC-8
+"""
+
+import os
+import re
+import stat
+import sys
+
+FRAME_MARK = 0xFE
+FLAG_SUMMARY = 0x80
+MESSAGES_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "include", "log_messages.h")
+
+
+def load_messages(path):
+    with open(path) as header:
+        text = header.read()
+    return [(name, text) for name, text in re.findall(r'X\((LOG_\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)]
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+class Truncated(Exception):
+    pass
+
+
+def varint(data, pos):
+    """Returns the value and the position after it, None for more than 5 bytes"""
+    value = 0
+    for shift in range(0, 35, 7):
+        if pos >= len(data):
+            raise Truncated()
+        byte = data[pos]
+        value |= (byte & 0x7F) << shift
+        pos += 1
+        if not byte & 0x80:
+            return value, pos
+    return None, pos
+
+
+def parse_frame(data, pos):
+    """Returns (id, flags, time us, repeated, args, end) for the frame at pos, None if it is not a valid
+    one; raises Truncated when data ends within it"""
+    if len(data) - pos < 8:
+        raise Truncated()
+    message_id, argc, flags = data[pos + 1], data[pos + 2] & 0x0F, data[pos + 2] & 0xF0
+    time_us = int.from_bytes(data[pos + 3:pos + 7], "little")
+    repeated, cursor = varint(data, pos + 7)
+    args = []
+    for _ in range(argc):
+        if repeated is None:
+            return None
+        value, cursor = varint(data, cursor)
+        if value is None:
+            return None
+        args.append((value >> 1) ^ -(value & 1))
+    if cursor >= len(data):
+        raise Truncated()
+    if repeated is None or crc8(data[pos:cursor]) != data[cursor]:
+        return None
+    return message_id, flags, time_us, repeated, args, cursor + 1
+
+
+def format_message(messages, message_id, args):
+    if message_id >= len(messages):
+        return "unknown message %d %s" % (message_id, args)
+    name, text = messages[message_id]
+    conversions = re.findall(r"%[-0-9.]*l*([dux])", text)
+    if len(conversions) != len(args):
+        return "%s %s" % (name, args)
+    values = [arg & 0xFFFFFFFF if kind in "ux" else arg for kind, arg in zip(conversions, args)]
+    return re.sub(r"%([-0-9.]*)l*([dux])", r"%\1\2", text) % tuple(values)
+
+
+def describe(messages, message_id, flags, repeated, args):
+    if flags & FLAG_SUMMARY:
+        name = messages[message_id][0] if message_id < len(messages) else "message %d" % message_id
+        return "%s repeated %d more times" % (name, repeated)
+    text = format_message(messages, message_id, args)
+    return text + (" (after %d more)" % repeated if repeated else "")
+
+
+def decode(stream, messages, out):
+    data = bytearray()
+    line = bytearray()
+    ended = False
+    while not ended:
+        chunk = stream.read1(256)
+        ended = not chunk
+        data += chunk
+        pos = 0
+        while pos < len(data):
+            if data[pos] == FRAME_MARK:
+                try:
+                    frame = parse_frame(data, pos)
+                except Truncated:
+                    if not ended:
+                        break
+                    frame = None
+                if frame:
+                    message_id, flags, time_us, repeated, args, pos = frame
+                    out.write("[%10.6f] %s\n" % (time_us / 1e6, describe(messages, message_id, flags, repeated, args)))
+                    continue
+            # Text, or a mark that does not start a valid frame
+            byte = data[pos]
+            pos += 1
+            if byte == ord("\n"):
+                out.write(line.decode(errors="replace").rstrip("\r") + "\n")
+                line.clear()
+            else:
+                line.append(byte)
+        del data[:pos]
+        out.flush()
+    if line:
+        out.write(line.decode(errors="replace") + "\n")
+
+
+class SerialInput:
+    def __init__(self, path):
+        import serial
+
+        self.port = serial.Serial(path, 115200)
+
+    def read1(self, size):
+        # Blocks for one byte, then takes whatever else has arrived
+        return self.port.read(max(1, min(size, self.port.in_waiting)))
+
+
+def open_input(path):
+    if path == "-":
+        return sys.stdin.buffer
+    if stat.S_ISCHR(os.stat(path).st_mode):
+        return SerialInput(path)
+    return open(path, "rb")
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    decode(open_input(sys.argv[1]), load_messages(MESSAGES_H), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+"""Plot the loop instrumentation CSV dumped over serial (build with -DLOOP_INSTRUMENTATION=1).
+
+Usage:
+    pio device monitor | tee loop.log
+    python3 tools/plot_loop_stats.py loop.log
+
+Only lines starting with "L," are read:
+    L,<uptime ms>,<stage>,<count>,<min us>,<p50 us>,<p99 us>,<max us>
+"""
+
+import sys
+from collections import defaultdict
+
+import matplotlib.pyplot as plt
+
+
+def parse(path):
+    series = defaultdict(lambda: defaultdict(list))
+    with open(path, errors="replace") as log:
+        for line in log:
+            fields = line.strip().split(",")
+            if len(fields) != 8 or fields[0] != "L":
+                continue
+            uptime, stage = int(fields[1]) / 1000.0, fields[2]
+            values = series[stage]
+            values["t"].append(uptime)
+            for name, value in zip(("count", "min", "p50", "p99", "max"), fields[3:]):
+                values[name].append(int(value))
+    return series
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    series = parse(sys.argv[1])
+    if not series:
+        sys.exit("no instrumentation lines found")
+
+    fig, axes = plt.subplots(len(series), 1, sharex=True, figsize=(10, 2.5 * len(series)))
+    for ax, (stage, values) in zip(axes if len(series) > 1 else [axes], sorted(series.items())):
+        for name in ("p50", "p99", "max"):
+            ax.plot(values["t"], values[name], label=name)
+        ax.set_ylabel(f"{stage} (us)")
+        ax.set_yscale("log")
+        ax.legend(loc="upper right")
+    axes[-1].set_xlabel("uptime (s)") if len(series) > 1 else axes.set_xlabel("uptime (s)")
+    plt.tight_layout()
+    plt.show()
+
+
+if __name__ == "__main__":
+    main()